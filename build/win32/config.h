@@ -33,6 +33,7 @@
 /* #undef HAVE_NCURSES_NCURSES_H */
 /* #undef HAVE_NETINET_IN_H */
 /* #undef HAVE_OPENGL_GL_H */
+/* #undef HAVE_PTHREAD_H */
 #define HAVE_PUTENV 1
 /* #undef HAVE_RESIZETERM */
 /* #undef HAVE_RESIZE_TERM */
@@ -85,6 +86,7 @@
 /* #undef USE_NCURSES */
 /* #undef USE_PLUGINS */
 /* #undef USE_SLANG */
+/* #undef USE_THREADS */
 /* #undef USE_VGA */
 #define USE_WIN32 1
 /* #undef USE_X11 */
@@ -0,0 +1,340 @@
+/*
+ *  libcaca       Colour ASCII-Art library
+ *  Copyright (c) 2002-2012 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This library is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What the Fuck You Want
+ *  to Public License, Version 2, as published by Sam Hocevar. See
+ *  http://www.wtfpl.net/ for more details.
+ */
+
+/*
+ *  This file contains the cell storage functions.
+ *
+ *
+ *  About cell arenas:
+ *
+ *  * A canvas created with caca_create_canvas_with_arena() stores the
+ *  cells of all its frames in one cache-aligned memory block that it
+ *  allocates upon creation. The block is split into chunks, each made of
+ *  a header and the cells themselves, and freed chunks are merged with
+ *  their free neighbours so that they can be reused, for instance when
+ *  the canvas is resized.
+ *
+ *  * If the cells no longer fit in the block, another block at least
+ *  twice as large is added. Blocks are never moved, because the frames
+ *  point into them. Extra blocks are freed as soon as they are empty.
+ */
+
+#include "config.h"
+
+#if !defined(__KERNEL__)
+#   include <stdio.h>
+#   include <stdlib.h>
+#   include <string.h>
+#endif
+
+#include "caca.h"
+#include "caca_internals.h"
+
+/* Chunk headers and sizes are multiples of ARENA_ALIGN so that all
+ * chunks start on a cache line. */
+#define ARENA_ALIGN 64
+
+struct chunk
+{
+    size_t size;
+    int free;
+};
+
+struct block
+{
+    struct block *next;
+    void *mem;
+    uint8_t *data;
+    size_t size, used;
+};
+
+struct caca_arena
+{
+    struct block *blocks;
+};
+
+static struct block *add_block(caca_arena_t *, size_t);
+static void *alloc_chunk(caca_arena_t *, size_t);
+static void free_chunk(caca_arena_t *, void *);
+static size_t chunk_bytes(size_t);
+
+/* Create a canvas's cell arena, large enough for the chars and attrs of
+ * a frame of the given number of cells */
+int _caca_create_arena(caca_canvas_t *cv, size_t cells)
+{
+    caca_arena_t *arena = malloc(sizeof(caca_arena_t));
+
+    if(!arena)
+    {
+        seterrno(ENOMEM);
+        return -1;
+    }
+
+    arena->blocks = NULL;
+
+    if(!add_block(arena, 2 * (ARENA_ALIGN
+                               + chunk_bytes(cells * sizeof(uint32_t)))))
+    {
+        free(arena);
+        seterrno(ENOMEM);
+        return -1;
+    }
+
+    cv->arena = arena;
+
+    return 0;
+}
+
+void _caca_free_arena(caca_canvas_t *cv)
+{
+    struct block *b, *next;
+
+    if(!cv->arena)
+        return;
+
+    for(b = cv->arena->blocks; b; b = next)
+    {
+        next = b->next;
+        free(b->mem);
+        free(b);
+    }
+
+    free(cv->arena);
+    cv->arena = NULL;
+}
+
+/* Allocate cells for a frame, from the canvas's arena if it has one */
+uint32_t *_caca_alloc_cells(caca_canvas_t *cv, size_t width, size_t height)
+{
+    if(!cv->arena)
+        return _caca_alloc2d(width, height, sizeof(uint32_t));
+
+    if(width == 0 || height == 0
+        || SIZE_MAX / width / height < sizeof(uint32_t))
+        return NULL;
+
+    return alloc_chunk(cv->arena, width * height * sizeof(uint32_t));
+}
+
+/* Resize a frame's cells. In an arena, the cells stay in place if their
+ * chunk is large enough, or can be grown into the following free space */
+uint32_t *_caca_realloc_cells(caca_canvas_t *cv, uint32_t *cells,
+                              size_t count)
+{
+    struct chunk *c, *next;
+    struct block *b;
+    size_t bytes;
+    uint8_t *end;
+    void *ret;
+
+    if(!cv->arena)
+        return realloc(cells, count * sizeof(uint32_t));
+
+    if(!cells)
+        return count ? alloc_chunk(cv->arena, count * sizeof(uint32_t))
+                     : NULL;
+
+    if(!count)
+    {
+        free_chunk(cv->arena, cells);
+        return NULL;
+    }
+
+    if(SIZE_MAX / sizeof(uint32_t) < count)
+        return NULL;
+
+    bytes = chunk_bytes(count * sizeof(uint32_t));
+    c = (struct chunk *)((uint8_t *)cells - ARENA_ALIGN);
+
+    if(c->size >= bytes)
+        return cells;
+
+    for(b = cv->arena->blocks; b; b = b->next)
+        if((uint8_t *)c >= b->data && (uint8_t *)c < b->data + b->used)
+            break;
+
+    /* Merge the following free chunks, or take the end of the block */
+    end = (uint8_t *)cells + c->size;
+    while(end < b->data + b->used && c->size < bytes)
+    {
+        next = (struct chunk *)end;
+        if(!next->free)
+            break;
+
+        c->size += ARENA_ALIGN + next->size;
+        end = (uint8_t *)cells + c->size;
+    }
+
+    if(end == b->data + b->used && c->size < bytes
+        && b->size - b->used >= bytes - c->size)
+    {
+        b->used += bytes - c->size;
+        c->size = bytes;
+    }
+
+    if(c->size >= bytes)
+        return cells;
+
+    ret = alloc_chunk(cv->arena, count * sizeof(uint32_t));
+    if(!ret)
+        return NULL;
+
+    memcpy(ret, cells, c->size);
+    free_chunk(cv->arena, cells);
+
+    return ret;
+}
+
+void _caca_free_cells(caca_canvas_t *cv, uint32_t *cells)
+{
+    if(!cv->arena)
+        free(cells);
+    else if(cells)
+        free_chunk(cv->arena, cells);
+}
+
+/*
+ * XXX: The following functions are local.
+ */
+
+static size_t chunk_bytes(size_t bytes)
+{
+    if(!bytes)
+        bytes = 1;
+
+    return (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+static struct block *add_block(caca_arena_t *arena, size_t size)
+{
+    struct block *b = malloc(sizeof(struct block)), **last;
+
+    if(!b)
+        return NULL;
+
+    b->mem = malloc(size + ARENA_ALIGN - 1);
+    if(!b->mem)
+    {
+        free(b);
+        return NULL;
+    }
+
+    b->data = (uint8_t *)b->mem
+            + (ARENA_ALIGN - (uintptr_t)b->mem % ARENA_ALIGN) % ARENA_ALIGN;
+    b->size = size;
+    b->used = 0;
+    b->next = NULL;
+
+    for(last = &arena->blocks; *last; last = &(*last)->next)
+        ;
+    *last = b;
+
+    return b;
+}
+
+/* First fit: reuse the first free chunk that is large enough, splitting
+ * it if the rest is worth keeping, or take the end of a block */
+static void *alloc_chunk(caca_arena_t *arena, size_t bytes)
+{
+    struct block *b, *last = NULL;
+    struct chunk *c;
+    size_t off;
+
+    bytes = chunk_bytes(bytes);
+
+    for(b = arena->blocks; b; last = b, b = b->next)
+    {
+        for(off = 0; off < b->used; off += ARENA_ALIGN + c->size)
+        {
+            c = (struct chunk *)(b->data + off);
+
+            if(!c->free || c->size < bytes)
+                continue;
+
+            if(c->size - bytes >= 2 * ARENA_ALIGN)
+            {
+                struct chunk *rest = (struct chunk *)
+                                 (b->data + off + ARENA_ALIGN + bytes);
+
+                rest->size = c->size - bytes - ARENA_ALIGN;
+                rest->free = 1;
+                c->size = bytes;
+            }
+
+            c->free = 0;
+            return (uint8_t *)c + ARENA_ALIGN;
+        }
+
+        if(b->size - b->used >= ARENA_ALIGN + bytes)
+            break;
+    }
+
+    if(!b)
+    {
+        size_t size = ARENA_ALIGN + bytes;
+
+        if(size < 2 * last->size)
+            size = 2 * last->size;
+
+        b = add_block(arena, size);
+        if(!b)
+            return NULL;
+    }
+
+    c = (struct chunk *)(b->data + b->used);
+    c->size = bytes;
+    c->free = 0;
+    b->used += ARENA_ALIGN + bytes;
+
+    return (uint8_t *)c + ARENA_ALIGN;
+}
+
+static void free_chunk(caca_arena_t *arena, void *ptr)
+{
+    struct block *b, **prev;
+    struct chunk *c, *last = NULL;
+    size_t off;
+
+    for(prev = &arena->blocks; (b = *prev); prev = &b->next)
+        if((uint8_t *)ptr > b->data && (uint8_t *)ptr < b->data + b->used)
+            break;
+
+    ((struct chunk *)((uint8_t *)ptr - ARENA_ALIGN))->free = 1;
+
+    /* Merge neighbouring free chunks */
+    for(off = 0; off < b->used; off += ARENA_ALIGN + c->size)
+    {
+        c = (struct chunk *)(b->data + off);
+
+        if(last && last->free && c->free)
+        {
+            last->size += ARENA_ALIGN + c->size;
+            c = last;
+            off = (uint8_t *)last - b->data;
+            continue;
+        }
+
+        last = c;
+    }
+
+    /* Give a trailing free chunk back to the end of the block */
+    if(last && last->free)
+        b->used = (uint8_t *)last - b->data;
+
+    /* Release empty blocks, except the first one */
+    if(!b->used && b != arena->blocks)
+    {
+        *prev = b->next;
+        free(b->mem);
+        free(b);
+    }
+}
@@ -187,6 +187,9 @@ int caca_put_attr(caca_canvas_t *cv, int x, int y, uint32_t attr)
     if(x < 0 || x >= (int)cv->width || y < 0 || y >= (int)cv->height)
         return 0;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return 0;
+
     xmin = xmax = x;
 
     curchar = cv->chars + x + y * cv->width;
@@ -109,7 +109,7 @@ int caca_draw_cp437_box(caca_canvas_t *cv, int x, int y, int w, int h)
 int caca_fill_box(caca_canvas_t *cv, int x, int y, int w, int h,
                    uint32_t ch)
 {
-    int i, j, xmax, ymax;
+    int j, xmax, ymax;
 
     int x2 = x + w - 1;
     int y2 = y + h - 1;
@@ -132,28 +132,11 @@ int caca_fill_box(caca_canvas_t *cv, int x, int y, int w, int h,
     if(x2 < 0 || y2 < 0 || x > xmax || y > ymax)
         return 0;
 
-    if(x < 0) x = 0;
     if(y < 0) y = 0;
-    if(x2 > xmax) x2 = xmax;
     if(y2 > ymax) y2 = ymax;
 
-#if 0
-    /* FIXME: this fails with fullwidth character blits. Also, the dirty
-     * rectangle handling may miss fullwidth cells. */
-    /* Optimise dirty rectangle handling, part 1 */
-    cv->dirty_disabled++;
-#endif
-
     for(j = y; j <= y2; j++)
-        for(i = x; i <= x2; i++)
-            caca_put_char(cv, i, j, ch);
-
-#if 0
-    /* Optimise dirty rectangle handling, part 2 */
-    cv->dirty_disabled--;
-    if(!cv->dirty_disabled)
-        caca_add_dirty_rect(cv, x, y, x2 - x + 1, y2 - y + 1);
-#endif
+        _caca_fill_span(cv, x, x2, j, ch);
 
     return 0;
 }
@@ -189,13 +172,13 @@ static int draw_box(caca_canvas_t *cv, int x, int y, int w, int h,
         return 0;
 
     /* Draw edges */
+    i = x2 < xmax ? x2 - 1 : xmax - 1;
+
     if(y >= 0)
-        for(i = x < 0 ? 1 : x + 1; i < x2 && i < xmax; i++)
-            caca_put_char(cv, i, y, chars[0]);
+        _caca_fill_span(cv, x < 0 ? 1 : x + 1, i, y, chars[0]);
 
     if(y2 <= ymax)
-        for(i = x < 0 ? 1 : x + 1; i < x2 && i < xmax; i++)
-            caca_put_char(cv, i, y2, chars[0]);
+        _caca_fill_span(cv, x < 0 ? 1 : x + 1, i, y2, chars[0]);
 
     if(x >= 0)
         for(j = y < 0 ? 1 : y + 1; j < y2 && j < ymax; j++)
@@ -51,12 +51,16 @@ extern "C"
 typedef struct caca_canvas caca_canvas_t;
 /** dither structure */
 typedef struct caca_dither caca_dither_t;
+/** progressive dither structure */
+typedef struct caca_dither_stream caca_dither_stream_t;
 /** character font structure */
 typedef struct caca_charfont caca_charfont_t;
 /** bitmap font structure */
 typedef struct caca_font caca_font_t;
 /** file handle structure */
 typedef struct caca_file caca_file_t;
+/** sparse canvas structure */
+typedef struct caca_sparse_canvas caca_sparse_canvas_t;
 /** \e libcaca display context */
 typedef struct caca_display caca_display_t;
 /** \e libcaca event structure */
@@ -231,6 +235,7 @@ enum caca_key
  *
  *  @{ */
 __extern caca_canvas_t * caca_create_canvas(int, int);
+__extern caca_canvas_t * caca_create_canvas_with_arena(int, int);
 __extern int caca_manage_canvas(caca_canvas_t *, int (*)(void *), void *);
 __extern int caca_unmanage_canvas(caca_canvas_t *, int (*)(void *), void *);
 __extern int caca_set_canvas_size(caca_canvas_t *, int, int);
@@ -254,6 +259,9 @@ __extern int caca_gotoxy(caca_canvas_t *, int, int);
 __extern int caca_wherex(caca_canvas_t const *);
 __extern int caca_wherey(caca_canvas_t const *);
 __extern int caca_put_char(caca_canvas_t *, int, int, uint32_t);
+__extern int caca_put_chars(caca_canvas_t *, int, int, uint32_t const *, int);
+__extern int caca_put_cells(caca_canvas_t *, int, int, uint32_t const *,
+                            uint32_t const *, int);
 __extern uint32_t caca_get_char(caca_canvas_t const *, int, int);
 __extern int caca_put_str(caca_canvas_t *, int, int, char const *);
 __extern int caca_printf(caca_canvas_t *, int, int, char const *, ...);
@@ -264,6 +272,7 @@ __extern int caca_get_canvas_handle_x(caca_canvas_t const *);
 __extern int caca_get_canvas_handle_y(caca_canvas_t const *);
 __extern int caca_blit(caca_canvas_t *, int, int, caca_canvas_t const *,
                        caca_canvas_t const *);
+__extern int caca_scroll_canvas(caca_canvas_t *, int, int, int, int, int);
 __extern int caca_set_canvas_boundaries(caca_canvas_t *, int, int, int, int);
 /*  @} */
 
@@ -276,9 +285,12 @@ __extern int caca_enable_dirty_rect(caca_canvas_t *);
 __extern int caca_get_dirty_rect_count(caca_canvas_t *);
 __extern int caca_get_dirty_rect(caca_canvas_t *, int, int *, int *,
                                  int *, int *);
+__extern int caca_get_dirty_span(caca_canvas_t *, int *, int *, int *);
 __extern int caca_add_dirty_rect(caca_canvas_t *, int, int, int, int);
 __extern int caca_remove_dirty_rect(caca_canvas_t *, int, int, int, int);
 __extern int caca_clear_dirty_rect_list(caca_canvas_t *);
+__extern int caca_diff_canvas(caca_canvas_t *, caca_canvas_t const *);
+__extern int caca_diff_frame(caca_canvas_t *, int);
 /*  @} */
 
 /** \defgroup caca_transform libcaca canvas transformation
@@ -378,6 +390,24 @@ __extern int caca_create_frame(caca_canvas_t *, int);
 __extern int caca_free_frame(caca_canvas_t *, int);
 /*  @} */
 
+/** \defgroup caca_sparse libcaca sparse canvas handling
+ *
+ *  These functions provide very large canvases that only use memory for
+ *  the areas that were written to, and ways to copy ordinary canvases
+ *  to and from them.
+ *
+ *  @{ */
+__extern caca_sparse_canvas_t *caca_create_sparse_canvas(int, int);
+__extern int caca_free_sparse_canvas(caca_sparse_canvas_t *);
+__extern int caca_get_sparse_canvas_width(caca_sparse_canvas_t const *);
+__extern int caca_get_sparse_canvas_height(caca_sparse_canvas_t const *);
+__extern int caca_get_sparse_canvas_tile_count(caca_sparse_canvas_t const *);
+__extern int caca_blit_to_sparse(caca_sparse_canvas_t *, int, int,
+                                 caca_canvas_t const *, caca_canvas_t const *);
+__extern int caca_blit_from_sparse(caca_canvas_t *, int, int,
+                                   caca_sparse_canvas_t const *);
+/*  @} */
+
 /** \defgroup caca_dither libcaca bitmap dithering
  *
  *  These functions provide high level routines for dither allocation and
@@ -387,6 +417,8 @@ __extern int caca_free_frame(caca_canvas_t *, int);
 __extern caca_dither_t *caca_create_dither(int, int, int, int,
                                              uint32_t, uint32_t,
                                              uint32_t, uint32_t);
+__extern caca_dither_t *caca_create_yuv_dither(char const *, int, int,
+                                                 int const *);
 __extern int caca_set_dither_palette(caca_dither_t *,
                                       uint32_t r[], uint32_t g[],
                                       uint32_t b[], uint32_t a[]);
@@ -404,6 +436,12 @@ __extern int caca_set_dither_color(caca_dither_t *, char const *);
 __extern char const * const * caca_get_dither_color_list(caca_dither_t
                                                           const *);
 __extern char const * caca_get_dither_color(caca_dither_t const *);
+__extern int caca_set_dither_distance(caca_dither_t *, char const *);
+__extern char const * const * caca_get_dither_distance_list(caca_dither_t
+                                                             const *);
+__extern char const * caca_get_dither_distance(caca_dither_t const *);
+__extern int caca_set_dither_output_palette(caca_dither_t *, int,
+                                           uint32_t const *, int const *);
 __extern int caca_set_dither_charset(caca_dither_t *, char const *);
 __extern char const * const * caca_get_dither_charset_list(caca_dither_t
                                                             const *);
@@ -412,8 +450,20 @@ __extern int caca_set_dither_algorithm(caca_dither_t *, char const *);
 __extern char const * const * caca_get_dither_algorithm_list(caca_dither_t
                                                               const *);
 __extern char const * caca_get_dither_algorithm(caca_dither_t const *);
+__extern int caca_set_dither_threads(caca_dither_t *, int);
+__extern int caca_get_dither_threads(caca_dither_t const *);
+__extern int caca_set_dither_incremental(caca_dither_t *, int);
+__extern int caca_get_dither_incremental(caca_dither_t const *);
+__extern int caca_set_dither_time_budget(caca_dither_t *, int);
+__extern int caca_get_dither_time_budget(caca_dither_t const *);
+__extern int caca_get_dither_quality(caca_dither_t const *);
 __extern int caca_dither_bitmap(caca_canvas_t *, int, int, int, int,
                          caca_dither_t const *, void const *);
+__extern caca_dither_stream_t *caca_create_dither_stream(caca_canvas_t *,
+                                                          int, int, int, int,
+                                                          caca_dither_t const *);
+__extern int caca_push_dither_rows(caca_dither_stream_t *, void const *, int);
+__extern int caca_free_dither_stream(caca_dither_stream_t *);
 __extern int caca_free_dither(caca_dither_t *);
 /*  @} */
 
@@ -19,11 +19,11 @@
 
 typedef struct caca_timer caca_timer_t;
 typedef struct caca_privevent caca_privevent_t;
+typedef struct caca_arena caca_arena_t;
 
 #if !defined(_DOXYGEN_SKIP_ME)
 #   define STAT_VALUES 32
 #   define EVENTBUF_LEN 10
-#   define MAX_DIRTY_COUNT 8
 #endif
 
 #undef __extern
@@ -38,9 +38,11 @@ struct caca_frame
     /* Frame size */
     int width, height;
 
-    /* Cell information */
+    /* Cell information, and the number of frames sharing it if it was
+     * copied from another frame and neither frame was written to since */
     uint32_t *chars;
     uint32_t *attrs;
+    int *shared;
 
     /* Painting context */
     int x, y;
@@ -60,19 +62,34 @@ struct caca_canvas
     int frame, framecount;
     struct caca_frame *frames;
 
+    /* Storage for the frames' cells, or NULL if they are on the heap */
+    caca_arena_t *arena;
+
     /* Canvas management */
     int refcount;
     int autoinc;
     int (*resize_callback)(void *);
     void *resize_data;
 
-    /* Dirty rectangles */
-    int ndirty, dirty_disabled;
+    /* Dirty cells: the extent of the changes on each line, a bitmap of
+     * the changed tiles of each line, and the rectangles built from them */
+    int dirty_disabled, dirty_lines, dirty_words, dirty_ymin, dirty_ymax;
+    struct
+    {
+        int xmin, xmax;
+    }
+    *dirty_spans;
+    uint32_t *dirty_tiles;
+    int ndirty, maxdirty, dirty_changed;
     struct
     {
         int xmin, ymin, xmax, ymax;
     }
-    dirty[MAX_DIRTY_COUNT + 1];
+    *dirty_rects;
+
+    /* Scroll of an area that the display has not caught up with yet, or
+     * a zero scroll_dy if there is none */
+    int scroll_x, scroll_y, scroll_w, scroll_h, scroll_dy;
 
     /* Shortcut to the active frame information */
     int width, height;
@@ -198,6 +215,7 @@ struct caca_display
         int (* get_event) (caca_display_t *, caca_privevent_t *);
         void (* set_mouse) (caca_display_t *, int);
         void (* set_cursor) (caca_display_t *, int);
+        int (* scroll) (caca_display_t *, int, int, int, int, int);
     } drv;
 
     /* Mouse position */
@@ -242,7 +260,12 @@ struct caca_display
 };
 
 /* Dirty rectangle functions */
-extern void _caca_clip_dirty_rect_list(caca_canvas_t *);
+extern int _caca_resize_dirty(caca_canvas_t *);
+extern void _caca_scroll_dirty(caca_canvas_t *, int, int, int, int, int);
+extern void _caca_flush_scroll(caca_canvas_t *);
+
+/* Drawing functions */
+extern void _caca_fill_span(caca_canvas_t *, int, int, int, uint32_t);
 
 /* Colour functions */
 extern uint32_t _caca_attr_to_rgb24fg(uint32_t);
@@ -250,7 +273,16 @@ extern uint32_t _caca_attr_to_rgb24bg(uint32_t);
 
 /* Frames functions */
 extern void _caca_save_frame_info(caca_canvas_t *);
-extern void _caca_load_frame_info(caca_canvas_t *);
+extern int _caca_load_frame_info(caca_canvas_t *);
+extern int _caca_unshare_frame(caca_canvas_t *, int);
+extern void _caca_release_frame(caca_canvas_t *, int);
+
+/* Cell storage functions */
+extern int _caca_create_arena(caca_canvas_t *, size_t);
+extern void _caca_free_arena(caca_canvas_t *);
+extern uint32_t *_caca_alloc_cells(caca_canvas_t *, size_t, size_t);
+extern uint32_t *_caca_realloc_cells(caca_canvas_t *, uint32_t *, size_t);
+extern void _caca_free_cells(caca_canvas_t *, uint32_t *);
 
 /* Internal timer functions */
 extern void _caca_sleep(int);
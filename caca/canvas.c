@@ -21,6 +21,7 @@
 #   include <stdio.h>
 #   include <stdlib.h>
 #   include <string.h>
+#   include <limits.h>
 #   include <time.h>
 #   include <sys/types.h>
 #   if defined(HAVE_UNISTD_H)
@@ -31,6 +32,7 @@
 #include "caca.h"
 #include "caca_internals.h"
 
+static caca_canvas_t *create_canvas(int, int, int);
 static int caca_resize(caca_canvas_t *, int, int);
 
 /** \brief Initialise a \e libcaca canvas.
@@ -54,63 +56,30 @@ static int caca_resize(caca_canvas_t *, int, int);
  */
 caca_canvas_t * caca_create_canvas(int width, int height)
 {
-    caca_canvas_t *cv;
-
-    if(width < 0 || height < 0)
-    {
-        seterrno(EINVAL);
-        return NULL;
-    }
-
-    cv = malloc(sizeof(caca_canvas_t));
-
-    if(!cv)
-        goto nomem;
-
-    cv->refcount = 0;
-    cv->autoinc = 0;
-    cv->resize_callback = NULL;
-    cv->resize_data = NULL;
-
-    cv->frame = 0;
-    cv->framecount = 1;
-    cv->frames = malloc(sizeof(struct caca_frame));
-    if(!cv->frames)
-    {
-        free(cv);
-        goto nomem;
-    }
-
-    cv->frames[0].width = cv->frames[0].height = 0;
-    cv->frames[0].chars = NULL;
-    cv->frames[0].attrs = NULL;
-    cv->frames[0].x = cv->frames[0].y = 0;
-    cv->frames[0].handlex = cv->frames[0].handley = 0;
-    cv->frames[0].curattr = 0;
-    cv->frames[0].name = strdup("frame#00000000");
-
-    _caca_load_frame_info(cv);
-    caca_set_color_ansi(cv, CACA_DEFAULT, CACA_TRANSPARENT);
-
-    cv->ndirty = 0;
-    cv->dirty_disabled = 0;
-    cv->ff = NULL;
-
-    if(caca_resize(cv, width, height) < 0)
-    {
-        int saved_errno = geterrno();
-        free(cv->frames[0].name);
-        free(cv->frames);
-        free(cv);
-        seterrno(saved_errno);
-        return NULL;
-    }
-
-    return cv;
+    return create_canvas(width, height, 0);
+}
 
-nomem:
-    seterrno(ENOMEM);
-    return NULL;
+/** \brief Initialise a \e libcaca canvas with a cell arena.
+ *
+ *  Initialise a canvas like caca_create_canvas() does, but store the
+ *  cells of all its frames in a single memory block owned by the canvas
+ *  instead of allocating them separately. Memory freed when frames are
+ *  deleted or the canvas is resized is reused for subsequent frames, and
+ *  caca_free_canvas() releases all cells at once. This is useful for
+ *  applications that create and destroy many canvases.
+ *
+ *  If an error occurs, NULL is returned and \b errno is set accordingly:
+ *  - \c EINVAL Specified width or height is invalid.
+ *  - \c EOVERFLOW Specified width and height overflowed.
+ *  - \c ENOMEM Not enough memory for the requested canvas size.
+ *
+ *  \param width The desired canvas width
+ *  \param height The desired canvas height
+ *  \return A libcaca canvas handle upon success, NULL if an error occurred.
+ */
+caca_canvas_t * caca_create_canvas_with_arena(int width, int height)
+{
+    return create_canvas(width, height, 1);
 }
 
 /** \brief Manage a canvas.
@@ -319,13 +288,17 @@ int caca_free_canvas(caca_canvas_t *cv)
 
     for(f = 0; f < cv->framecount; f++)
     {
-        free(cv->frames[f].chars);
-        free(cv->frames[f].attrs);
+        _caca_release_frame(cv, f);
         free(cv->frames[f].name);
     }
 
+    _caca_free_arena(cv);
+
     caca_canvas_set_figfont(cv, NULL);
 
+    free(cv->dirty_spans);
+    free(cv->dirty_tiles);
+    free(cv->dirty_rects);
     free(cv->frames);
     free(cv);
 
@@ -363,6 +336,146 @@ int caca_rand(int min, int max)
  * XXX: The following functions are local.
  */
 
+static caca_canvas_t *create_canvas(int width, int height, int arena)
+{
+    caca_canvas_t *cv;
+
+    if(width < 0 || height < 0)
+    {
+        seterrno(EINVAL);
+        return NULL;
+    }
+
+    cv = malloc(sizeof(caca_canvas_t));
+
+    if(!cv)
+        goto nomem;
+
+    cv->refcount = 0;
+    cv->autoinc = 0;
+    cv->resize_callback = NULL;
+    cv->resize_data = NULL;
+
+    cv->frame = 0;
+    cv->framecount = 1;
+    cv->frames = malloc(sizeof(struct caca_frame));
+    if(!cv->frames)
+    {
+        free(cv);
+        goto nomem;
+    }
+
+    cv->frames[0].width = cv->frames[0].height = 0;
+    cv->frames[0].chars = NULL;
+    cv->frames[0].attrs = NULL;
+    cv->frames[0].shared = NULL;
+    cv->frames[0].x = cv->frames[0].y = 0;
+    cv->frames[0].handlex = cv->frames[0].handley = 0;
+    cv->frames[0].curattr = 0;
+    cv->frames[0].name = strdup("frame#00000000");
+
+    /* Overflows are reported by caca_resize() below */
+    cv->arena = NULL;
+    if(arena && _caca_create_arena(cv, height && width > INT_MAX / height
+                                        ? 0 : width * height) < 0)
+    {
+        free(cv->frames[0].name);
+        free(cv->frames);
+        free(cv);
+        goto nomem;
+    }
+
+    cv->dirty_disabled = 0;
+    cv->dirty_lines = cv->dirty_words = 0;
+    cv->dirty_ymin = 0;
+    cv->dirty_ymax = -1;
+    cv->dirty_spans = NULL;
+    cv->dirty_tiles = NULL;
+    cv->ndirty = cv->maxdirty = cv->dirty_changed = 0;
+    cv->dirty_rects = NULL;
+    cv->scroll_dy = 0;
+
+    if(_caca_load_frame_info(cv) < 0)
+    {
+        free(cv->dirty_spans);
+        free(cv->dirty_tiles);
+        free(cv->dirty_rects);
+        _caca_free_arena(cv);
+        free(cv->frames[0].name);
+        free(cv->frames);
+        free(cv);
+        goto nomem;
+    }
+
+    caca_set_color_ansi(cv, CACA_DEFAULT, CACA_TRANSPARENT);
+
+    cv->ff = NULL;
+
+    if(caca_resize(cv, width, height) < 0)
+    {
+        int saved_errno = geterrno();
+        free(cv->dirty_spans);
+        free(cv->dirty_tiles);
+        free(cv->dirty_rects);
+        _caca_free_arena(cv);
+        free(cv->frames[0].name);
+        free(cv->frames);
+        free(cv);
+        seterrno(saved_errno);
+        return NULL;
+    }
+
+    return cv;
+
+nomem:
+    seterrno(ENOMEM);
+    return NULL;
+}
+
+/* Find the first frame that shares its cells with a given frame */
+static int first_sharing_frame(caca_canvas_t const *cv, int f)
+{
+    int g;
+
+    if(!cv->frames[f].shared)
+        return f;
+
+    for(g = 0; cv->frames[g].shared != cv->frames[f].shared; g++)
+        ;
+
+    return g;
+}
+
+static int shares_earlier_frame(caca_canvas_t const *cv, int f)
+{
+    return first_sharing_frame(cv, f) < f;
+}
+
+static int pads_differently(caca_canvas_t const *cv, int f)
+{
+    return cv->frames[first_sharing_frame(cv, f)].curattr
+            != cv->frames[f].curattr;
+}
+
+/* Point the frames sharing their cells with a given frame to its new
+ * cell buffers */
+static void update_sharing_frames(caca_canvas_t *cv, int f)
+{
+    int g;
+
+    if(!cv->frames[f].shared)
+        return;
+
+    for(g = f + 1; g < cv->framecount; g++)
+    {
+        if(cv->frames[g].shared != cv->frames[f].shared)
+            continue;
+
+        cv->frames[g].chars = cv->frames[f].chars;
+        cv->frames[g].attrs = cv->frames[f].attrs;
+    }
+}
+
 int caca_resize(caca_canvas_t *cv, int width, int height)
 {
     int x, y, f, old_width, old_height, old_size;
@@ -381,25 +494,38 @@ int caca_resize(caca_canvas_t *cv, int width, int height)
 
     _caca_save_frame_info(cv);
 
+    /* Frames that share their cells are resized only once. Those that
+     * would be padded with a different attribute need their own copy. */
+    if(width > old_width || height > old_height)
+    {
+        for(f = 0; f < cv->framecount; f++)
+            if(pads_differently(cv, f) && _caca_unshare_frame(cv, f) < 0)
+                return -1;
+    }
+
     /* Preload new width and height values into the canvas to optimise
      * dirty rectangle handling */
     cv->width = width;
     cv->height = height;
 
-    /* If width or height is smaller (or both), we have the opportunity to
-     * reduce or even remove dirty rectangles */
-    if(width < old_width || height < old_height)
-        _caca_clip_dirty_rect_list(cv);
+    /* Resize the dirty spans. If width or height is smaller (or both), we
+     * have the opportunity to reduce or even remove dirty rectangles */
+    if(_caca_resize_dirty(cv) < 0)
+        return -1;
 
     /* Step 1: if new area is bigger, resize the memory area now. */
     if(new_size > old_size)
     {
         for(f = 0; f < cv->framecount; f++)
         {
-            cv->frames[f].chars = realloc(cv->frames[f].chars,
-                                          new_size * sizeof(uint32_t));
-            cv->frames[f].attrs = realloc(cv->frames[f].attrs,
-                                          new_size * sizeof(uint32_t));
+            if(shares_earlier_frame(cv, f))
+                continue;
+
+            cv->frames[f].chars = _caca_realloc_cells(cv,
+                                          cv->frames[f].chars, new_size);
+            cv->frames[f].attrs = _caca_realloc_cells(cv,
+                                          cv->frames[f].attrs, new_size);
+            update_sharing_frames(cv, f);
             if(new_size && (!cv->frames[f].chars || !cv->frames[f].attrs))
             {
                 seterrno(ENOMEM);
@@ -424,6 +550,9 @@ int caca_resize(caca_canvas_t *cv, int width, int height)
             uint32_t *chars = cv->frames[f].chars;
             uint32_t *attrs = cv->frames[f].attrs;
 
+            if(shares_earlier_frame(cv, f))
+                continue;
+
             for(y = height < old_height ? height : old_height; y--; )
             {
                 uint32_t attr = cv->frames[f].curattr;
@@ -458,6 +587,9 @@ int caca_resize(caca_canvas_t *cv, int width, int height)
             uint32_t *chars = cv->frames[f].chars;
             uint32_t *attrs = cv->frames[f].attrs;
 
+            if(shares_earlier_frame(cv, f))
+                continue;
+
             for(y = 1; y < lines; y++)
             {
                 for(x = 0; x < width; x++)
@@ -478,6 +610,9 @@ int caca_resize(caca_canvas_t *cv, int width, int height)
             uint32_t *attrs = cv->frames[f].attrs;
             uint32_t attr = cv->frames[f].curattr;
 
+            if(shares_earlier_frame(cv, f))
+                continue;
+
             /* Zero the bottom of the screen */
             for(x = (height - old_height) * width; x--; )
             {
@@ -503,10 +638,14 @@ int caca_resize(caca_canvas_t *cv, int width, int height)
     {
         for(f = 0; f < cv->framecount; f++)
         {
-            cv->frames[f].chars = realloc(cv->frames[f].chars,
-                                          new_size * sizeof(uint32_t));
-            cv->frames[f].attrs = realloc(cv->frames[f].attrs,
-                                          new_size * sizeof(uint32_t));
+            if(shares_earlier_frame(cv, f))
+                continue;
+
+            cv->frames[f].chars = _caca_realloc_cells(cv,
+                                          cv->frames[f].chars, new_size);
+            cv->frames[f].attrs = _caca_realloc_cells(cv,
+                                          cv->frames[f].attrs, new_size);
+            update_sharing_frames(cv, f);
             if(new_size && (!cv->frames[f].chars || !cv->frames[f].attrs))
             {
                 seterrno(ENOMEM);
@@ -528,8 +667,6 @@ int caca_resize(caca_canvas_t *cv, int width, int height)
     }
 
     /* Reset the current frame shortcuts */
-    _caca_load_frame_info(cv);
-
-    return 0;
+    return _caca_load_frame_info(cv);
 }
 
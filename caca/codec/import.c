@@ -26,6 +26,9 @@
 #include "caca_internals.h"
 #include "codec.h"
 
+/* Number of cells decoded at once before being printed */
+#define IMPORT_CHUNK 256
+
 static inline uint32_t sscanu32(void const *s)
 {
     uint32_t x;
@@ -296,9 +299,10 @@ char const * const * caca_get_import_list(void)
 
 static ssize_t import_caca(caca_canvas_t *cv, void const *data, size_t size)
 {
+    uint32_t chars[IMPORT_CHUNK], attrs[IMPORT_CHUNK];
     uint8_t const *buf = (uint8_t const *)data;
     size_t control_size, data_size, expected_size;
-    unsigned int frames, f, n, offset;
+    unsigned int frames, f, n, count, offset;
     uint16_t version, flags;
     int32_t xmin = 0, ymin = 0, xmax = 0, ymax = 0;
 
@@ -384,15 +388,24 @@ static ssize_t import_caca(caca_canvas_t *cv, void const *data, size_t size)
 
         /* FIXME: check for return value */
 
-        for(n = width * height; n--; )
+        for(n = 0; n < width * height; n += count)
         {
+            uint8_t const *src = buf + 4 + control_size + offset + 8 * n;
             int x = (n % width) - cv->frames[f].handlex - xmin;
             int y = (n / width) - cv->frames[f].handley - ymin;
+            unsigned int i;
+
+            count = width - n % width;
+            if(count > IMPORT_CHUNK)
+                count = IMPORT_CHUNK;
+
+            for(i = 0; i < count; i++)
+            {
+                chars[i] = sscanu32(src + 8 * i);
+                attrs[i] = sscanu32(src + 8 * i + 4);
+            }
 
-            caca_put_char(cv, x, y, sscanu32(buf + 4 + control_size
-                                               + offset + 8 * n));
-            caca_put_attr(cv, x, y, sscanu32(buf + 4 + control_size
-                                               + offset + 8 * n + 4));
+            caca_put_cells(cv, x, y, chars, attrs, count);
         }
         offset += width * height * 8;
 
@@ -413,6 +426,7 @@ invalid_caca:
 
 ssize_t _import_bin(caca_canvas_t *cv, void const *data, size_t len)
 {
+    uint32_t chars[160], attrs[160];
     uint8_t const *buf = (uint8_t const *)data;
     size_t i;
     int x = 0, y = 0;
@@ -426,11 +440,13 @@ ssize_t _import_bin(caca_canvas_t *cv, void const *data, size_t len)
     for (i = 0; i < len; i += 2)
     {
         caca_set_color_ansi(cv, buf[i + 1] & 0xf, buf[i + 1] >> 4);
-        caca_put_char(cv, x, y, caca_cp437_to_utf32(buf[i]));
+        chars[x] = caca_cp437_to_utf32(buf[i]);
+        attrs[x] = caca_get_attr(cv, -1, -1);
 
         ++x;
-        if (x >= 160)
+        if (x >= 160 || i + 2 >= len)
         {
+            caca_put_cells(cv, 0, y, chars, attrs, x);
             ++y;
             x = 0;
         }
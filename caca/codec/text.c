@@ -43,29 +43,24 @@ static void ansi_parse_grcm(caca_canvas_t *, struct import *,
 
 ssize_t _import_text(caca_canvas_t *cv, void const *data, size_t size)
 {
-    char const *text = (char const *)data;
-    unsigned int width = 0, height = 0, x = 0, y = 0, i;
+    uint32_t buf[256];
+    unsigned char const *text = (unsigned char const *)data;
+    unsigned int width = 0, height = 0, x, y = 0, n;
+    size_t i, end;
 
     caca_set_canvas_size(cv, 0, 0);
 
-    for(i = 0; i < size; i++)
+    for(i = 0; i < size; i = end + 1)
     {
-        unsigned char ch = *text++;
+        /* Find the end of the line and grow the canvas only once */
+        for(end = i, n = 0; end < size && text[end] != '\n'; end++)
+            if(text[end] != '\r')
+                n++;
 
-        if(ch == '\r')
-            continue;
-
-        if(ch == '\n')
-        {
-            x = 0;
-            y++;
-            continue;
-        }
-
-        if(x >= width || y >= height)
+        if(n > width || (n && y >= height))
         {
-            if(x >= width)
-                width = x + 1;
+            if(n > width)
+                width = n;
 
             if(y >= height)
                 height = y + 1;
@@ -74,8 +69,20 @@ ssize_t _import_text(caca_canvas_t *cv, void const *data, size_t size)
                 return -1;
         }
 
-        caca_put_char(cv, x, y, ch);
-        x++;
+        for(x = 0, n = 0; i < end; i++)
+        {
+            if(text[i] != '\r')
+                buf[n++] = text[i];
+
+            if(n == sizeof(buf) / sizeof(*buf) || (n && i + 1 == end))
+            {
+                x += caca_put_chars(cv, x, y, buf, n);
+                n = 0;
+            }
+        }
+
+        if(end < size)
+            y++;
     }
 
     if (y > height)
@@ -460,6 +467,9 @@ ssize_t _import_ansi(caca_canvas_t *cv, void const *data, size_t size, int utf8)
             {
                 int lines = (y - height) + 1;
 
+                if(_caca_unshare_frame(cv, cv->frame) < 0)
+                    return -1;
+
                 for(j = 0; j + lines < height; j++)
                 {
                     memcpy(cv->attrs + j * cv->width,
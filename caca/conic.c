@@ -82,15 +82,15 @@ int caca_fill_ellipse(caca_canvas_t *cv, int xo, int yo, int a, int b,
         else
         {
             d1 += b*b*(2*x*1) + a*a*(-2*y+2);
-            caca_draw_line(cv, xo - x, yo - y, xo + x, yo - y, ch);
-            caca_draw_line(cv, xo - x, yo + y, xo + x, yo + y, ch);
+            _caca_fill_span(cv, xo - x, xo + x, yo - y, ch);
+            _caca_fill_span(cv, xo - x, xo + x, yo + y, ch);
             y--;
         }
         x++;
     }
 
-    caca_draw_line(cv, xo - x, yo - y, xo + x, yo - y, ch);
-    caca_draw_line(cv, xo - x, yo + y, xo + x, yo + y, ch);
+    _caca_fill_span(cv, xo - x, xo + x, yo - y, ch);
+    _caca_fill_span(cv, xo - x, xo + x, yo + y, ch);
 
     d2 = b*b*(x+0.5)*(x+0.5) + a*a*(y-1)*(y-1) - a*a*b*b;
     while(y > 0)
@@ -106,8 +106,8 @@ int caca_fill_ellipse(caca_canvas_t *cv, int xo, int yo, int a, int b,
         }
 
         y--;
-        caca_draw_line(cv, xo - x, yo - y, xo + x, yo - y, ch);
-        caca_draw_line(cv, xo - x, yo + y, xo + x, yo + y, ch);
+        _caca_fill_span(cv, xo - x, xo + x, yo - y, ch);
+        _caca_fill_span(cv, xo - x, xo + x, yo + y, ch);
     }
 
     return 0;
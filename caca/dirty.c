@@ -16,23 +16,45 @@
  *
  *  About dirty rectangles:
  *
+ *  * For each line, the canvas keeps the extent of the modified cells and
+ *  a bitmap of the modified tiles of DIRTY_TILE cells, so that scattered
+ *  updates do not collapse into a large bounding box. A dirty span is a
+ *  run of modified tiles, clipped to the line's extent. The dirty rectangle
+ *  list is derived from the spans when it is queried: consecutive lines
+ *  with the same spans form a single row of rectangles.
+ *
  *  * Dirty rectangles MUST NOT be larger than the canvas. If the user
  *  provides a large rectangle through caca_add_dirty_rect(), or if the
- *  canvas changes size to become smaller, all dirty rectangles MUST
+ *  canvas changes size to become smaller, all dirty spans MUST
  *  immediately be clipped to the canvas size.
+ *
+ *  * A scrolled area is not marked as dirty: the scroll is recorded so
+ *  that the display can scroll the screen, and the dirty cells of the
+ *  area move along with their contents. If anything else needs the dirty
+ *  cells before the display catches up, the whole area is marked as dirty.
  */
 
 #include "config.h"
 
 #if !defined(__KERNEL__)
 #   include <stdio.h>
+#   include <stdlib.h>
 #   include <string.h>
 #endif
 
 #include "caca.h"
 #include "caca_internals.h"
 
-static void merge_new_rect(caca_canvas_t *cv, int n);
+#define DIRTY_TILE 4
+
+static void mark_line(caca_canvas_t *cv, int y, int xmin, int xmax);
+static int find_span(caca_canvas_t const *cv, int y, int x, int *xmin,
+                     int *xmax);
+static void build_rect_list(caca_canvas_t *cv);
+static int diff_area(caca_canvas_t *cv, uint32_t const *chars,
+                     uint32_t const *attrs, int width, int height);
+static int diff_cells(caca_canvas_t *cv, uint32_t const *chars,
+                      uint32_t const *attrs, int width, int height);
 
 /** \brief Disable dirty rectangles.
  *
@@ -97,6 +119,11 @@ int caca_enable_dirty_rect(caca_canvas_t *cv)
  */
 int caca_get_dirty_rect_count(caca_canvas_t *cv)
 {
+    _caca_flush_scroll(cv);
+
+    if(cv->dirty_changed)
+        build_rect_list(cv);
+
     return cv->ndirty;
 }
 
@@ -125,22 +152,80 @@ int caca_get_dirty_rect_count(caca_canvas_t *cv)
 int caca_get_dirty_rect(caca_canvas_t *cv, int r,
                         int *x, int *y, int *width, int *height)
 {
+    _caca_flush_scroll(cv);
+
+    if(cv->dirty_changed)
+        build_rect_list(cv);
+
     if(r < 0 || r >= cv->ndirty)
     {
         seterrno(EINVAL);
         return -1;
     }
 
-    *x = cv->dirty[r].xmin;
-    *y = cv->dirty[r].ymin;
-    *width = cv->dirty[r].xmax - cv->dirty[r].xmin + 1;
-    *height = cv->dirty[r].ymax - cv->dirty[r].ymin + 1;
+    *x = cv->dirty_rects[r].xmin;
+    *y = cv->dirty_rects[r].ymin;
+    *width = cv->dirty_rects[r].xmax - cv->dirty_rects[r].xmin + 1;
+    *height = cv->dirty_rects[r].ymax - cv->dirty_rects[r].ymin + 1;
 
     debug("dirty #%i: %ix%i at (%i,%i)", r, *width, *height, *x, *y);
 
     return 0;
 }
 
+/** \brief Get the next dirty span of a canvas.
+ *
+ *  Find the first dirty span starting at or after the given cell, in
+ *  reading order. A dirty span is a horizontal run of cells that contains
+ *  changed cells. Unlike the dirty rectangles, which are built from them,
+ *  spans give the extent of the changes on each line, and several spans
+ *  may lie on the same line. They can be iterated as follows:
+ *
+ *  \code
+ *  for(x = y = 0; !caca_get_dirty_span(cv, &x, &y, &width); x += width)
+ *      redraw(x, y, width);
+ *  \endcode
+ *
+ *  This function never fails.
+ *
+ *  \param cv A libcaca canvas.
+ *  \param x A pointer to the column where the search starts, where the
+ *           leftmost edge of the dirty span will be stored.
+ *  \param y A pointer to the line where the search starts, where the
+ *           line of the dirty span will be stored.
+ *  \param width A pointer to an integer where the width of the
+ *               dirty span will be stored.
+ *  \return 0 if a dirty span was found, -1 if there are no dirty spans
+ *          left.
+ */
+int caca_get_dirty_span(caca_canvas_t *cv, int *x, int *y, int *width)
+{
+    int j, xmin, xmax, startx = *x < 0 ? 0 : *x;
+
+    _caca_flush_scroll(cv);
+
+    j = *y;
+    if(j < cv->dirty_ymin)
+    {
+        j = cv->dirty_ymin;
+        startx = 0;
+    }
+
+    for( ; j <= cv->dirty_ymax; j++, startx = 0)
+    {
+        if(!find_span(cv, j, startx, &xmin, &xmax))
+            continue;
+
+        *x = xmin;
+        *y = j;
+        *width = xmax - xmin + 1;
+
+        return 0;
+    }
+
+    return -1;
+}
+
 /** \brief Add an area to the canvas's dirty rectangle list.
  *
  *  Add an invalidating zone to the canvas's dirty rectangle list. For more
@@ -163,6 +248,8 @@ int caca_get_dirty_rect(caca_canvas_t *cv, int r,
  */
 int caca_add_dirty_rect(caca_canvas_t *cv, int x, int y, int width, int height)
 {
+    int j;
+
     debug("new dirty: %ix%i at (%i,%i)", width, height, x, y);
 
     /* Clip arguments to canvas */
@@ -183,17 +270,15 @@ int caca_add_dirty_rect(caca_canvas_t *cv, int x, int y, int width, int height)
         return -1;
     }
 
-    /* Add the new rectangle to the list; it works even if cv->ndirty
-     * is MAX_DIRTY_COUNT because there's an extra cell in the array. */
-    cv->dirty[cv->ndirty].xmin = x;
-    cv->dirty[cv->ndirty].ymin = y;
-    cv->dirty[cv->ndirty].xmax = x + width - 1;
-    cv->dirty[cv->ndirty].ymax = y + height - 1;
-    cv->ndirty++;
+    for(j = y; j < y + height; j++)
+        mark_line(cv, j, x, x + width - 1);
 
-    /* Try to merge the new rectangle with existing ones. This also ensures
-     * that cv->ndirty is brought back below MAX_DIRTY_COUNT. */
-    merge_new_rect(cv, cv->ndirty - 1);
+    if(cv->dirty_ymin > y)
+        cv->dirty_ymin = y;
+    if(cv->dirty_ymax < y + height - 1)
+        cv->dirty_ymax = y + height - 1;
+
+    cv->dirty_changed = 1;
 
     return 0;
 }
@@ -203,8 +288,9 @@ int caca_add_dirty_rect(caca_canvas_t *cv, int x, int y, int width, int height)
  *  Mark a cell area in the canvas as not dirty. For more information about
  *  the dirty rectangles, see caca_get_dirty_rect().
  *
- *  Values such that \b xmin > \b xmax or \b ymin > \b ymax indicate that
- *  the dirty rectangle is empty. They will be silently ignored.
+ *  Dirty cells are tracked by tiles of a few cells, so only the tiles that
+ *  the area covers entirely, and the ends of each line's changes, are
+ *  marked as not dirty.
  *
  *  If an error occurs, -1 is returned and \b errno is set accordingly:
  *  - \c EINVAL Specified rectangle coordinates are out of bounds.
@@ -219,6 +305,10 @@ int caca_add_dirty_rect(caca_canvas_t *cv, int x, int y, int width, int height)
 int caca_remove_dirty_rect(caca_canvas_t *cv, int x, int y,
                            int width, int height)
 {
+    int j, t, tmin, tmax;
+
+    _caca_flush_scroll(cv);
+
     /* Clip arguments to canvas size */
     if(x < 0) { width += x; x = 0; }
 
@@ -237,9 +327,46 @@ int caca_remove_dirty_rect(caca_canvas_t *cv, int x, int y,
         return -1;
     }
 
-    /* FIXME: implement this function. It's OK to have it do nothing,
-     * since we take a conservative approach in dirty rectangle handling,
-     * but we ought to help the rendering eventually. */
+    /* Tiles entirely inside the area */
+    tmin = (x + DIRTY_TILE - 1) / DIRTY_TILE;
+    tmax = (x + width) / DIRTY_TILE - 1;
+
+    for(j = y; j < y + height; j++)
+    {
+        uint32_t *tiles = cv->dirty_tiles + j * cv->dirty_words;
+        int xmin = cv->dirty_spans[j].xmin, xmax = cv->dirty_spans[j].xmax;
+
+        if(xmin > xmax || x > xmax || x + width - 1 < xmin)
+            continue;
+
+        for(t = tmin; t <= tmax; t++)
+            tiles[t / 32] &= ~(1u << (t % 32));
+
+        if(x <= xmin)
+            xmin = x + width;
+        if(x + width - 1 >= xmax)
+            xmax = x - 1;
+
+        /* Shrink the line's extent to its remaining tiles */
+        cv->dirty_spans[j].xmin = xmin;
+        cv->dirty_spans[j].xmax = xmax;
+        if(xmin <= xmax && find_span(cv, j, xmin, &xmin, &t))
+        {
+            for(xmax = t; find_span(cv, j, xmax + 1, &t, &xmax); )
+                ;
+
+            cv->dirty_spans[j].xmin = xmin;
+            cv->dirty_spans[j].xmax = xmax;
+        }
+        else
+        {
+            cv->dirty_spans[j].xmin = cv->width;
+            cv->dirty_spans[j].xmax = -1;
+            memset(tiles, 0, cv->dirty_words * sizeof(uint32_t));
+        }
+
+        cv->dirty_changed = 1;
+    }
 
     return 0;
 }
@@ -255,127 +382,458 @@ int caca_remove_dirty_rect(caca_canvas_t *cv, int x, int y,
  */
 int caca_clear_dirty_rect_list(caca_canvas_t *cv)
 {
+    int j;
+
+    for(j = cv->dirty_ymin; j <= cv->dirty_ymax; j++)
+    {
+        cv->dirty_spans[j].xmin = cv->width;
+        cv->dirty_spans[j].xmax = -1;
+    }
+
+    if(cv->dirty_ymin <= cv->dirty_ymax)
+        memset(cv->dirty_tiles + cv->dirty_ymin * cv->dirty_words, 0,
+               (cv->dirty_ymax - cv->dirty_ymin + 1) * cv->dirty_words
+                * sizeof(uint32_t));
+
+    cv->dirty_ymin = cv->height;
+    cv->dirty_ymax = -1;
     cv->ndirty = 0;
+    cv->dirty_changed = 0;
+    cv->scroll_dy = 0;
 
     return 0;
 }
 
+/** \brief Mark the cells that differ from another canvas as dirty.
+ *
+ *  Compare the current frame of a canvas with the current frame of a
+ *  reference canvas, for instance a copy of what was last displayed, and
+ *  add the cells that differ to the canvas's dirty spans. The changed cell
+ *  runs can then be iterated with caca_get_dirty_span(), and their
+ *  contents read with caca_get_canvas_chars() and caca_get_canvas_attrs().
+ *
+ *  If the canvases do not have the same size, the cells that lie outside
+ *  the reference canvas are marked as dirty.
+ *
+ *  This function never fails.
+ *
+ *  \param cv A libcaca canvas.
+ *  \param ref The reference canvas.
+ *  \return The number of cells that differ.
+ */
+int caca_diff_canvas(caca_canvas_t *cv, caca_canvas_t const *ref)
+{
+    return diff_cells(cv, ref->chars, ref->attrs, ref->width, ref->height);
+}
+
+/** \brief Mark the cells that differ from another frame as dirty.
+ *
+ *  Compare the current canvas frame with another frame of the same canvas
+ *  and add the cells that differ to the canvas's dirty spans. This is
+ *  useful when playing animations: caca_set_frame() marks the whole canvas
+ *  as dirty, unless dirty rectangles are disabled during the call, whereas
+ *  consecutive frames usually only differ in a few places.
+ *
+ *  \code
+ *  caca_disable_dirty_rect(cv);
+ *  caca_set_frame(cv, next);
+ *  caca_enable_dirty_rect(cv);
+ *  caca_diff_frame(cv, prev);
+ *  \endcode
+ *
+ *  If the frames do not have the same size, the cells that lie outside
+ *  the other frame are marked as dirty.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Requested frame is out of range.
+ *
+ *  \param cv A libcaca canvas.
+ *  \param id The frame to compare the current frame with.
+ *  \return The number of cells that differ, or -1 if an error occurred.
+ */
+int caca_diff_frame(caca_canvas_t *cv, int id)
+{
+    if(id < 0 || id >= cv->framecount)
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    /* Frames that share their cells are identical */
+    if(id == cv->frame || cv->frames[id].chars == cv->chars)
+        return 0;
+
+    return diff_cells(cv, cv->frames[id].chars, cv->frames[id].attrs,
+                      cv->frames[id].width, cv->frames[id].height);
+}
+
 /*
  * XXX: the following functions are local.
  */
 
-static inline int int_min(int a, int b) { return a < b ? a : b; }
-static inline int int_max(int a, int b) { return a > b ? a : b; }
+/* Mark cells xmin to xmax of a line as dirty */
+static void mark_line(caca_canvas_t *cv, int y, int xmin, int xmax)
+{
+    uint32_t *tiles = cv->dirty_tiles + y * cv->dirty_words;
+    int t = xmin / DIRTY_TILE, tmax = xmax / DIRTY_TILE;
+
+    while(t <= tmax)
+    {
+        int n = tmax - t + 1 < 32 - t % 32 ? tmax - t + 1 : 32 - t % 32;
+
+        tiles[t / 32] |= (n == 32 ? 0xffffffff : (1u << n) - 1) << (t % 32);
+        t += n;
+    }
+
+    if(cv->dirty_spans[y].xmin > xmin)
+        cv->dirty_spans[y].xmin = xmin;
+    if(cv->dirty_spans[y].xmax < xmax)
+        cv->dirty_spans[y].xmax = xmax;
+}
 
-/* Merge a newly added rectangle, if necessary. */
-static void merge_new_rect(caca_canvas_t *cv, int n)
+/* Find the first dirty span of a line that ends at or after column x */
+static int find_span(caca_canvas_t const *cv, int y, int x, int *xmin,
+                     int *xmax)
 {
-    int wasted[MAX_DIRTY_COUNT + 1];
-    int i, sn, best, best_score;
+    uint32_t const *tiles = cv->dirty_tiles + y * cv->dirty_words;
+    int t, tmax;
 
-    best = -1;
-    best_score = cv->width * cv->height;
+    if(x < cv->dirty_spans[y].xmin)
+        x = cv->dirty_spans[y].xmin;
 
-    sn = (cv->dirty[n].xmax - cv->dirty[n].xmin + 1)
-           * (cv->dirty[n].ymax - cv->dirty[n].ymin + 1);
+    if(x > cv->dirty_spans[y].xmax)
+        return 0;
 
-    /* Check whether the new rectangle can be merged with an existing one. */
-    for(i = 0; i < cv->ndirty; i++)
-    {
-        int si, sf, xmin, ymin, xmax, ymax;
+    tmax = cv->dirty_spans[y].xmax / DIRTY_TILE;
 
-        if(i == n)
-            continue;
+    for(t = x / DIRTY_TILE; t <= tmax; t++)
+        if(tiles[t / 32] & (1u << (t % 32)))
+            break;
+
+    if(t > tmax)
+        return 0;
+
+    *xmin = t * DIRTY_TILE > x ? t * DIRTY_TILE : x;
 
-        xmin = int_min(cv->dirty[i].xmin, cv->dirty[n].xmin);
-        ymin = int_min(cv->dirty[i].ymin, cv->dirty[n].ymin);
-        xmax = int_max(cv->dirty[i].xmax, cv->dirty[n].xmax);
-        ymax = int_max(cv->dirty[i].ymax, cv->dirty[n].ymax);
+    for(t++; t <= tmax; t++)
+        if(!(tiles[t / 32] & (1u << (t % 32))))
+            break;
 
-        sf = (xmax - xmin + 1) * (ymax - ymin + 1);
+    *xmax = t * DIRTY_TILE - 1 < cv->dirty_spans[y].xmax
+             ? t * DIRTY_TILE - 1 : cv->dirty_spans[y].xmax;
 
-        /* Shortcut: if the current rectangle is inside the new rectangle,
-         * we remove the current rectangle and continue trying merges. */
-        if(sf == sn)
+    return 1;
+}
+
+/* Check whether two lines have the same dirty spans */
+static int same_spans(caca_canvas_t const *cv, int y1, int y2)
+{
+    if(cv->dirty_spans[y1].xmin != cv->dirty_spans[y2].xmin
+        || cv->dirty_spans[y1].xmax != cv->dirty_spans[y2].xmax)
+        return 0;
+
+    return !memcmp(cv->dirty_tiles + y1 * cv->dirty_words,
+                   cv->dirty_tiles + y2 * cv->dirty_words,
+                   cv->dirty_words * sizeof(uint32_t));
+}
+
+/* Build the dirty rectangle list from the dirty spans: each run of
+ * consecutive lines with the same spans gives one rectangle per span. If
+ * there is not enough memory for all the rectangles, each run of lines
+ * gives a single rectangle covering the lines' extent instead. */
+static void build_rect_list(caca_canvas_t *cv)
+{
+    int j, k, x, xmin, xmax, n = 0, coarse = 0;
+
+    for(j = cv->dirty_ymin; j <= cv->dirty_ymax; j = k)
+    {
+        for(k = j + 1; k <= cv->dirty_ymax && same_spans(cv, j, k); k++)
+            ;
+
+        for(x = 0; find_span(cv, j, x, &xmin, &xmax); x = xmax + 1)
         {
-            memmove(&cv->dirty[i], &cv->dirty[i + 1],
-                    (cv->ndirty - i) * sizeof(cv->dirty[0]));
-            cv->ndirty--;
+            if(coarse)
+            {
+                xmin = cv->dirty_spans[j].xmin;
+                xmax = cv->dirty_spans[j].xmax;
+            }
+            else if(n == cv->maxdirty)
+            {
+                void *rects = realloc(cv->dirty_rects, 2 * cv->maxdirty
+                                                 * sizeof(*cv->dirty_rects));
+                if(!rects)
+                {
+                    /* Start again with one rectangle per run of lines */
+                    coarse = 1;
+                    n = 0;
+                    k = cv->dirty_ymin;
+                    break;
+                }
+
+                cv->dirty_rects = rects;
+                cv->maxdirty *= 2;
+            }
+
+            cv->dirty_rects[n].xmin = xmin;
+            cv->dirty_rects[n].ymin = j;
+            cv->dirty_rects[n].xmax = xmax;
+            cv->dirty_rects[n].ymax = k - 1;
+            n++;
+
+            if(coarse)
+                break;
+        }
+    }
 
-            if(i < n)
-                n--;
-            else
-                i--;
+    cv->ndirty = n;
+    cv->dirty_changed = 0;
+}
 
-            continue;
+/* Resize the dirty cell tracking to the canvas size, clipping the line
+ * extents in case they're larger than the canvas */
+int _caca_resize_dirty(caca_canvas_t *cv)
+{
+    uint32_t *old;
+    int j, oldwords, lines = cv->height ? cv->height : 1;
+    int words = (cv->width + 32 * DIRTY_TILE - 1) / (32 * DIRTY_TILE);
+
+    if(cv->dirty_ymax >= cv->height)
+        cv->dirty_ymax = cv->height - 1;
+
+    for(j = cv->dirty_ymin; j <= cv->dirty_ymax; j++)
+        if(cv->dirty_spans[j].xmax >= cv->width)
+            cv->dirty_spans[j].xmax = cv->width - 1;
+
+    if(!words)
+        words = 1;
+
+    if(lines != cv->dirty_lines || words != cv->dirty_words)
+    {
+        void *spans = realloc(cv->dirty_spans,
+                              lines * sizeof(*cv->dirty_spans));
+        uint32_t *tiles = calloc(lines * words, sizeof(uint32_t));
+
+        if(spans)
+            cv->dirty_spans = spans;
+
+        if(!spans || !tiles)
+        {
+            free(tiles);
+            seterrno(ENOMEM);
+            return -1;
         }
 
-        si = (cv->dirty[i].xmax - cv->dirty[i].xmin + 1)
-               * (cv->dirty[i].ymax - cv->dirty[i].ymin + 1);
+        if(!cv->dirty_rects)
+        {
+            cv->dirty_rects = malloc(lines * sizeof(*cv->dirty_rects));
+            if(!cv->dirty_rects)
+            {
+                free(tiles);
+                seterrno(ENOMEM);
+                return -1;
+            }
+            cv->maxdirty = lines;
+        }
 
-        /* Shortcut: if the new rectangle is inside the current rectangle,
-         * we get rid of the new rectangle and bail out. */
-        if(sf == si)
+        for(j = cv->dirty_lines; j < lines; j++)
         {
-            cv->ndirty--;
-            memmove(&cv->dirty[n], &cv->dirty[n + 1],
-                    (cv->ndirty - n) * sizeof(cv->dirty[0]));
-            return;
+            cv->dirty_spans[j].xmin = cv->width;
+            cv->dirty_spans[j].xmax = -1;
         }
 
-        /* We store approximately how many bytes were wasted. FIXME: this is
-         * not an exact computation, we need to be more precise. */
-        wasted[i] = sf - si - sn;
+        /* Copy the old tiles, or mark the whole extent of each line if
+         * the tile layout changed */
+        old = cv->dirty_tiles;
+        oldwords = cv->dirty_words;
+        cv->dirty_tiles = tiles;
+        cv->dirty_words = words;
 
-        if(wasted[i] < best_score)
+        for(j = cv->dirty_ymin; j <= cv->dirty_ymax; j++)
         {
-             best = i;
-             best_score = wasted[i];
+            int xmin = cv->dirty_spans[j].xmin, xmax = cv->dirty_spans[j].xmax;
+
+            if(xmin > xmax)
+                continue;
+
+            if(words == oldwords)
+                memcpy(tiles + j * words, old + j * words,
+                       words * sizeof(uint32_t));
+            else
+            {
+                cv->dirty_spans[j].xmin = cv->width;
+                cv->dirty_spans[j].xmax = -1;
+                mark_line(cv, j, xmin, xmax);
+            }
         }
+
+        free(old);
+        cv->dirty_lines = lines;
+    }
+
+    cv->dirty_changed = 1;
+
+    /* The scrolled area may no longer fit in the canvas */
+    _caca_flush_scroll(cv);
+
+    return 0;
+}
+
+/* Record the scroll of a canvas area, merging it with the pending one if
+ * it is the same area, and move the area's dirty cells along with their
+ * contents. The lines that scroll into view are marked as dirty. */
+void _caca_scroll_dirty(caca_canvas_t *cv, int x, int y, int w, int h, int dy)
+{
+    int j, end, step, xmin, xmax;
+
+    if(cv->scroll_dy && (cv->scroll_x != x || cv->scroll_y != y
+                          || cv->scroll_w != w || cv->scroll_h != h))
+        _caca_flush_scroll(cv);
+
+    if(dy >= h || dy <= -h
+        || cv->scroll_dy + dy >= h || cv->scroll_dy + dy <= -h)
+    {
+        cv->scroll_dy = 0;
+        caca_add_dirty_rect(cv, x, y, w, h);
+        return;
     }
 
-    /* FIXME: we only try to merge the current rectangle, ignoring
-     * potentially better merges. */
+    /* Walk the lines in the direction of the scroll, so that the cells
+     * marked on a line are not moved again */
+    j = dy > 0 ? y + dy : y + h - 1 + dy;
+    end = dy > 0 ? y + h : y - 1;
+    step = dy > 0 ? 1 : -1;
 
-    /* If no acceptable score was found and the dirty rectangle list is
-     * not full, we bail out. */
-    if(best_score > 0 && cv->ndirty < MAX_DIRTY_COUNT)
+    for( ; j != end; j += step)
+    {
+        for(xmin = x; find_span(cv, j, xmin, &xmin, &xmax) && xmin < x + w;
+            xmin = xmax + 1)
+            mark_line(cv, j - dy, xmin, xmax < x + w ? xmax : x + w - 1);
+
+        if(cv->dirty_spans[j - dy].xmin > cv->dirty_spans[j - dy].xmax)
+            continue;
+
+        if(cv->dirty_ymin > j - dy)
+            cv->dirty_ymin = j - dy;
+        if(cv->dirty_ymax < j - dy)
+            cv->dirty_ymax = j - dy;
+    }
+
+    caca_add_dirty_rect(cv, x, dy > 0 ? y + h - dy : y, w, dy > 0 ? dy : -dy);
+
+    cv->scroll_x = x;
+    cv->scroll_y = y;
+    cv->scroll_w = w;
+    cv->scroll_h = h;
+    cv->scroll_dy += dy;
+}
+
+/* Give up on the pending scroll and mark the scrolled area as dirty */
+void _caca_flush_scroll(caca_canvas_t *cv)
+{
+    if(!cv->scroll_dy)
         return;
 
-    /* Otherwise, merge the rectangle with the best candidate */
-    cv->dirty[best].xmin = int_min(cv->dirty[best].xmin, cv->dirty[n].xmin);
-    cv->dirty[best].ymin = int_min(cv->dirty[best].ymin, cv->dirty[n].ymin);
-    cv->dirty[best].xmax = int_max(cv->dirty[best].xmax, cv->dirty[n].xmax);
-    cv->dirty[best].ymax = int_max(cv->dirty[best].ymax, cv->dirty[n].ymax);
+    cv->scroll_dy = 0;
+    caca_add_dirty_rect(cv, cv->scroll_x, cv->scroll_y,
+                        cv->scroll_w, cv->scroll_h);
+}
+
+/* Skip the cells that are the same in two lines, two cells at a time */
+static int skip_same(uint32_t const *c1, uint32_t const *a1,
+                     uint32_t const *c2, uint32_t const *a2, int x, int w)
+{
+    for( ; x + 2 <= w; x += 2)
+    {
+        uint64_t w1, w2, w3, w4;
+
+        memcpy(&w1, c1 + x, sizeof(w1));
+        memcpy(&w2, c2 + x, sizeof(w2));
+        memcpy(&w3, a1 + x, sizeof(w3));
+        memcpy(&w4, a2 + x, sizeof(w4));
 
-    memmove(&cv->dirty[n], &cv->dirty[n + 1],
-            (cv->ndirty - n) * sizeof(cv->dirty[0]));
-    cv->ndirty--;
+        if((w1 ^ w2) | (w3 ^ w4))
+            break;
+    }
+
+    while(x < w && c1[x] == c2[x] && a1[x] == a2[x])
+        x++;
 
-    if(best < n)
-        merge_new_rect(cv, best);
-    else
-        merge_new_rect(cv, best - 1);
+    return x;
 }
 
-/* Clip all dirty rectangles in case they're larger than the canvas */
-void _caca_clip_dirty_rect_list(caca_canvas_t *cv)
+/* Mark the cells that differ from a width x height cell area as dirty,
+ * as well as the cells that lie outside that area */
+static int diff_cells(caca_canvas_t *cv, uint32_t const *chars,
+                      uint32_t const *attrs, int width, int height)
 {
-    int i;
+    int w, h, n;
+
+    w = width < cv->width ? width : cv->width;
+    h = height < cv->height ? height : cv->height;
+
+    n = diff_area(cv, chars, attrs, width, h);
+
+    if(w < cv->width && h > 0)
+        caca_add_dirty_rect(cv, w, 0, cv->width - w, h);
+
+    if(h < cv->height)
+        caca_add_dirty_rect(cv, 0, h, cv->width, cv->height - h);
 
-    for(i = 0; i < cv->ndirty; i++)
+    return n + cv->width * cv->height - w * h;
+}
+
+/* Mark the cells of the canvas that differ from the given cell arrays as
+ * dirty. The arrays are width cells wide, and only the top left corner
+ * they have in common with the canvas is compared. */
+static int diff_area(caca_canvas_t *cv, uint32_t const *chars,
+                     uint32_t const *attrs, int width, int height)
+{
+    int x, y, start, n = 0;
+    int w = width < cv->width ? width : cv->width;
+
+    for(y = 0; y < height; y++)
     {
-        if(cv->dirty[i].xmin < 0)
-            cv->dirty[i].xmin = 0;
+        uint32_t const *c1 = cv->chars + y * cv->width;
+        uint32_t const *a1 = cv->attrs + y * cv->width;
+        uint32_t const *c2 = chars + y * width;
+        uint32_t const *a2 = attrs + y * width;
+        int changed = 0;
+
+        /* Most lines are usually unchanged */
+        if(!memcmp(c1, c2, w * sizeof(uint32_t))
+            && !memcmp(a1, a2, w * sizeof(uint32_t)))
+            continue;
 
-        if(cv->dirty[i].ymin < 0)
-            cv->dirty[i].ymin = 0;
+        for(x = skip_same(c1, a1, c2, a2, 0, w); x < w;
+            x = skip_same(c1, a1, c2, a2, x, w))
+        {
+            start = x;
+
+            while(x < w && (c1[x] != c2[x] || a1[x] != a2[x]))
+                x++;
+
+            n += x - start;
+
+            /* If a fullwidth character changed, its first half must be
+             * redrawn as well */
+            if(start > 0 && (c1[start] == CACA_MAGIC_FULLWIDTH
+                              || c2[start] == CACA_MAGIC_FULLWIDTH))
+                start--;
+
+            mark_line(cv, y, start, x - 1);
+            changed = 1;
+        }
+
+        if(!changed)
+            continue;
 
-        if(cv->dirty[i].xmax >= cv->width)
-            cv->dirty[i].xmax = cv->width - 1;
+        if(cv->dirty_ymin > y)
+            cv->dirty_ymin = y;
+        if(cv->dirty_ymax < y)
+            cv->dirty_ymax = y;
 
-        if(cv->dirty[i].ymax >= cv->height)
-            cv->dirty[i].ymax = cv->height - 1;
+        cv->dirty_changed = 1;
     }
-}
 
+    return n;
+}
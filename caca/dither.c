@@ -24,6 +24,16 @@
 #   include <stdlib.h>
 #   include <limits.h>
 #   include <string.h>
+#   if defined(__AVX2__)
+#       include <immintrin.h>
+#   elif defined(__SSE2__)
+#       include <emmintrin.h>
+#   elif defined(__ARM_NEON)
+#       include <arm_neon.h>
+#   endif
+#endif
+#if defined(USE_THREADS)
+#   include <pthread.h>
 #endif
 
 #include "caca.h"
@@ -35,26 +45,15 @@
  * Local variables
  */
 #if !defined(_DOXYGEN_SKIP_ME)
-#   define LOOKUP_VAL 32
-#   define LOOKUP_SAT 32
-#   define LOOKUP_HUE 16
+#   define RGB_LOOKUP_BITS 4
+#   define RGB_LOOKUP_MAX ((1 << RGB_LOOKUP_BITS) - 1)
+#   define RGB_LOOKUP_SIZE (1 << (3 * RGB_LOOKUP_BITS))
+    /* Quality levels for time budgets: full quality, ordered8 instead of
+     * fstein, no dithering, no antialiasing */
+#   define QUALITY_LEVELS 4
+    /* Calls in a row with enough headroom before stepping back up */
+#   define QUALITY_HEADROOM 8
 #endif
-static uint8_t hsv_distances[LOOKUP_VAL][LOOKUP_SAT][LOOKUP_HUE];
-static uint16_t lookup_colors[8];
-static int lookup_initialised = 0;
-
-static int const hsv_palette[] =
-{
-    /* weight, hue, saturation, value */
-    4,    0x0,    0x0,    0x0,   /* black */
-    5,    0x0,    0x0,    0x5ff, /* 30% */
-    5,    0x0,    0x0,    0x9ff, /* 70% */
-    4,    0x0,    0x0,    0xfff, /* white */
-    3,    0x1000, 0xfff,  0x5ff, /* dark yellow */
-    2,    0x1000, 0xfff,  0xfff, /* light yellow */
-    3,    0x0,    0xfff,  0x5ff, /* dark red */
-    2,    0x0,    0xfff,  0xfff  /* light red */
-};
 
 /* RGB palette for the new colour picker */
 static int const rgb_palette[] =
@@ -101,6 +100,17 @@ static uint32_t blocks_glyphs[] =
     ' ', 0x2598, 0x259a, '?'
 };
 
+/* Sub-cell glyphs, indexed by the pattern of their foreground sub-cells.
+ * Bit 0 is the upper left sub-cell, bit 1 the one on its right, and so
+ * on line by line. */
+static uint32_t const quadrants_glyphs[] =
+{
+    /* ' ', '▘', '▝', '▀', '▖', '▌', '▞', '▛',
+     * '▗', '▚', '▐', '▜', '▄', '▙', '▟', '█' */
+    ' ', 0x2598, 0x259d, 0x2580, 0x2596, 0x258c, 0x259e, 0x259b,
+    0x2597, 0x259a, 0x2590, 0x259c, 0x2584, 0x2599, 0x259f, 0x2588
+};
+
 #if !defined(_DOXYGEN_SKIP_ME)
 enum color_mode
 {
@@ -110,7 +120,120 @@ enum color_mode
     COLOR_MODE_16,
     COLOR_MODE_FULLGRAY,
     COLOR_MODE_FULL8,
-    COLOR_MODE_FULL16
+    COLOR_MODE_FULL16,
+    COLOR_MODE_TRUECOLOR
+};
+
+enum yuv_format
+{
+    YUV_FORMAT_NONE,
+    YUV_FORMAT_I420,
+    YUV_FORMAT_NV12,
+    YUV_FORMAT_YUY2
+};
+
+/* What an incremental dither remembers about each cell: a hash of its
+ * bitmap footprint and, for Floyd-Steinberg, of the error it received,
+ * the error it diffused, and what it left on the canvas. */
+struct dither_cell
+{
+    uint64_t key;
+    int error[3];
+    int transparent;
+    uint32_t ch, attr;
+};
+
+/* The caca_dither_bitmap() arguments that must not change between calls
+ * for an incremental dither to reuse its cell history */
+struct dither_call
+{
+    caca_canvas_t const *cv;
+    int x, y, w, h, width, height;
+    uint32_t attr;
+    unsigned int serial;
+    int quality;
+};
+
+/* A glyph and its coverage of each 4x4th of the cell, from 0 to 255 */
+struct glyph_shape
+{
+    uint8_t coverage[16];
+    uint32_t ch;
+    int mean;
+};
+
+/* The glyph shapes of a built-in font for a "structure" charset. They are
+ * computed on first use and then shared by all dithers. */
+static struct glyph_index
+{
+    char const *charset, *font;
+    struct glyph_shape *shapes;
+    int count;
+}
+glyph_indices[] =
+{
+    { "structure", "Monospace 9", NULL, 0 },
+    { "boldstructure", "Monospace Bold 12", NULL, 0 },
+};
+
+#if defined(USE_THREADS)
+static pthread_mutex_t glyph_index_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Memory reused across caca_dither_bitmap() calls */
+struct dither_scratch
+{
+    int *errors;
+    size_t errors_size;
+    uint32_t *cells;
+    size_t cells_size;
+    uint32_t seed;
+
+    struct dither_cell *history;
+    size_t history_size;
+    struct dither_call last_call;
+    int history_valid;
+
+    /* Time budget state: the current quality level, the number of calls
+     * in a row with enough headroom to step back up, the average call time
+     * before stepping down, the running average of call times, or -1 until
+     * the first call, and for each level the estimated time ratio with the
+     * level above. The degraded dither is a copy of the dither with the
+     * settings of the current quality level. */
+    int quality, headroom, overrun, average;
+    float ratio[QUALITY_LEVELS];
+    caca_dither_t *degraded;
+};
+
+/* Per-call dithering state. The dithering algorithms only keep their
+ * state here, so that different dither objects can be used at the same
+ * time from different threads. */
+struct dither_state
+{
+    int const *table;
+    int line, index, count;
+    uint32_t seed;
+    int remain_r, remain_g, remain_b;
+};
+
+/* Parameters shared by all the lines of a caca_dither_bitmap() call. The
+ * lines from ymin to ymax are dithered into the cells array, one row of
+ * stride values per line: xmax - xmin + 1 characters followed by as many
+ * attributes. The first line of pixels is bitmap line y0. */
+struct dither_job
+{
+    caca_dither_t const *d;
+    caca_canvas_t const *cv;
+    void const *pixels;
+    int y0;
+    int x1, y1, deltax, deltay;
+    int xmin, xmax, ymin, ymax;
+    uint32_t seed, attr;
+    int *fs_r, *fs_g, *fs_b;
+    uint32_t *cells;
+    int stride;
+    struct dither_cell *history;
+    int history_valid;
 };
 
 struct caca_dither
@@ -123,6 +246,14 @@ struct caca_dither
     void (*get_hsv)(caca_dither_t *, char *, int, int);
     int red[256], green[256], blue[256], alpha[256];
 
+    /* YUV source format, with one pitch per plane */
+    enum yuv_format yuv;
+    size_t plane_pitch[3];
+
+    /* Pixel fetching kernel, chosen according to the pixel format */
+    void (*sum_pixels)(caca_dither_t const *, void const *,
+                       int, int, int, uint32_t *);
+
     /* Colour features */
     float gamma, brightness, contrast;
     int gammatab[4097];
@@ -134,34 +265,65 @@ struct caca_dither
     char const *color_name;
     enum color_mode color;
 
+    char const *distance_name;
+    int perceptual;
+
     char const *algo_name;
-    void (*init_dither) (int);
-    int (*get_dither) (void);
-    void (*increment_dither) (void);
+    void (*init_dither) (struct dither_state *, int);
+    int (*get_dither) (struct dither_state *);
+    void (*increment_dither) (struct dither_state *);
 
     char const *glyph_name;
     uint32_t const * glyphs;
     int glyph_count;
 
+    /* Sub-cells per cell for sub-cell character sets, whose glyphs are
+     * indexed by sub-cell pattern; 1x1 for the other character sets */
+    int subcell_w, subcell_h;
+    uint32_t subcell_glyphs[256];
+
+    /* Glyph shapes for the "structure" charsets */
+    struct glyph_shape const *shapes;
+    int shape_count, use_shapes;
+
+    /* Glyph index for a coverage in "truecolor" mode, computed as
+     * ((coverage + glyph_bias) * glyph_mul) >> glyph_shift */
+    int glyph_bias, glyph_mul, glyph_shift;
+
+    /* Quantised RGB to background and foreground colour lookup table. It
+     * depends on the colour mode and needs to be rebuilt whenever the
+     * colour mode changes. */
+    uint16_t rgb_lookup[RGB_LOOKUP_SIZE];
+
+    /* Output palette, the 16 ANSI colours unless a custom palette was set.
+     * A custom palette holds the colours, then the weights, then the
+     * colours in canvas attribute format, and is output as ARGB values. */
+    int const *palette, *palette_weight;
+    int palette_size;
+    int *custom_palette;
+
     int invert;
+
+    int threads, incremental;
+    int budget;
+    struct dither_scratch *scratch;
+
+    /* Incremented whenever a setting that changes the output changes */
+    unsigned int serial;
 };
 
-#define HSV_XRATIO 6
-#define HSV_YRATIO 3
-#define HSV_HRATIO 3
-
-#define HSV_DISTANCE(h, s, v, index) \
-    (hsv_palette[index * 4] \
-     * ((HSV_XRATIO * ((v) - hsv_palette[index * 4 + 3]) \
-                    * ((v) - hsv_palette[index * 4 + 3])) \
-       + (hsv_palette[index * 4 + 3] \
-           ? (HSV_YRATIO * ((s) - hsv_palette[index * 4 + 2]) \
-                         * ((s) - hsv_palette[index * 4 + 2])) \
-           : 0) \
-       + (hsv_palette[index * 4 + 2] \
-           ? (HSV_HRATIO * ((h) - hsv_palette[index * 4 + 1]) \
-                         * ((h) - hsv_palette[index * 4 + 1])) \
-           : 0)))
+struct caca_dither_stream
+{
+    caca_canvas_t *cv;
+    struct dither_job job;
+    int line, received;
+
+    /* Bitmap lines first to first + count - 1, and room for size lines */
+    uint8_t *rows;
+    int first, count, size;
+
+    int *errors;
+};
 #endif
 
 /*
@@ -171,39 +333,127 @@ static void mask2shift(uint32_t, int *, int *);
 static float gammapow(float x, float y);
 
 static void get_rgba_default(caca_dither_t const *, uint8_t const *, int, int,
-                             unsigned int *);
-static int init_lookup(void);
+                             uint32_t *);
+
+static void init_pixel_kernel(caca_dither_t *);
+static void sum_pixels_generic(caca_dither_t const *, void const *,
+                               int, int, int, uint32_t *);
+static void sum_pixels_palette(caca_dither_t const *, void const *,
+                               int, int, int, uint32_t *);
+static void sum_pixels_rgb16(caca_dither_t const *, void const *,
+                             int, int, int, uint32_t *);
+static void sum_pixels_rgb24(caca_dither_t const *, void const *,
+                             int, int, int, uint32_t *);
+static void sum_pixels_rgb32(caca_dither_t const *, void const *,
+                             int, int, int, uint32_t *);
+#if !defined(__KERNEL__) && (defined(__SSE2__) || defined(__ARM_NEON))
+static void sum_pixels_bytes32(caca_dither_t const *, void const *,
+                               int, int, int, uint32_t *);
+#endif
+static void sum_pixels_i420(caca_dither_t const *, void const *,
+                            int, int, int, uint32_t *);
+static void sum_pixels_nv12(caca_dither_t const *, void const *,
+                            int, int, int, uint32_t *);
+static void sum_pixels_yuy2(caca_dither_t const *, void const *,
+                            int, int, int, uint32_t *);
+static uint64_t hash_bytes(uint64_t, uint8_t const *, size_t);
+static uint64_t hash_footprint(caca_dither_t const *, void const *,
+                               int, int, int, int);
+static caca_dither_t const *get_quality_dither(caca_dither_t const *);
+static void update_quality(caca_dither_t const *, int);
+static int cell_unchanged(struct dither_job const *, int, int,
+                          struct dither_cell const *);
+static void get_line_rows(struct dither_job const *, int, int *, int *);
+static void dither_lines(struct dither_job const *, int, int, uint32_t *);
+static void dither_line(struct dither_job const *, struct dither_state *,
+                        int, int, int, uint32_t *);
+static void dither_subcells(struct dither_job const *, struct dither_state *,
+                            int, int, int *, struct dither_cell *,
+                            uint32_t *, uint32_t *);
+static void get_sample_range(caca_dither_t const *, int64_t, int64_t, int,
+                             int *, int *);
+static void put_dithered_line(caca_canvas_t *, struct dither_job const *,
+                              int, uint32_t const *);
+#if defined(USE_THREADS)
+static int dither_lines_threaded(struct dither_job const *, int);
+static int dither_lines_wavefront(struct dither_job const *, int);
+#endif
+static void init_rgb_lookup(caca_dither_t *);
+static void rgb2oklab(int const *, float *);
+static void find_nearest_colors(caca_dither_t const *, int const *,
+                                float const *, float const *,
+                                int *, int *);
+static int uses_two_colours(caca_dither_t const *);
+static uint32_t palette_attr(caca_dither_t const *, int, int, uint32_t);
+static void init_truecolor_glyphs(caca_dither_t *);
+static void init_subcell_glyphs(caca_dither_t *, int, int);
+static int init_glyph_shapes(struct glyph_index *);
+static struct glyph_shape const *match_glyph_shape(caca_dither_t const *,
+                                                   int const (*)[3],
+                                                   int (*)[3], int *);
+static uint32_t pack_truecolor(uint32_t const *);
+static int truecolor_cell(caca_dither_t const *, uint32_t, int *, int *);
+static uint32_t truecolor_attr(caca_dither_t const *, int, int, uint32_t);
+static void solve_truecolor(caca_dither_t const *, uint32_t,
+                            uint32_t *, uint32_t *, int);
 
 /* Dithering algorithms */
-static void init_no_dither(int);
-static int get_no_dither(void);
-static void increment_no_dither(void);
+static void init_no_dither(struct dither_state *, int);
+static int get_no_dither(struct dither_state *);
+static void increment_no_dither(struct dither_state *);
 
-static void init_fstein_dither(int);
-static int get_fstein_dither(void);
-static void increment_fstein_dither(void);
+static void init_fstein_dither(struct dither_state *, int);
+static int get_fstein_dither(struct dither_state *);
+static void increment_fstein_dither(struct dither_state *);
 
-static void init_ordered2_dither(int);
-static int get_ordered2_dither(void);
-static void increment_ordered2_dither(void);
+static void init_ordered2_dither(struct dither_state *, int);
+static int get_ordered2_dither(struct dither_state *);
+static void increment_ordered2_dither(struct dither_state *);
 
-static void init_ordered4_dither(int);
-static int get_ordered4_dither(void);
-static void increment_ordered4_dither(void);
+static void init_ordered4_dither(struct dither_state *, int);
+static int get_ordered4_dither(struct dither_state *);
+static void increment_ordered4_dither(struct dither_state *);
 
-static void init_ordered8_dither(int);
-static int get_ordered8_dither(void);
-static void increment_ordered8_dither(void);
+static void init_ordered8_dither(struct dither_state *, int);
+static int get_ordered8_dither(struct dither_state *);
+static void increment_ordered8_dither(struct dither_state *);
 
-static void init_random_dither(int);
-static int get_random_dither(void);
-static void increment_random_dither(void);
+static void init_random_dither(struct dither_state *, int);
+static int get_random_dither(struct dither_state *);
+static void increment_random_dither(struct dither_state *);
 
 static inline int sq(int x)
 {
     return x * x;
 }
 
+/* Whether a colour mask is empty or covers exactly one byte */
+static inline int is_byte_mask(uint32_t mask)
+{
+    return mask == 0 || mask == 0xff || mask == 0xff00
+            || mask == 0xff0000 || mask == 0xff000000;
+}
+
+/* Clamp an RGB triplet and quantise it to a colour lookup table index */
+static inline int rgb_lookup_index(uint32_t const *rgba)
+{
+    int i, ret = 0;
+
+    for(i = 0; i < 3; i++)
+    {
+        int val = (int)rgba[i];
+
+        if(val < 0)
+            val = 0;
+        else if(val > 0xfff)
+            val = 0xfff;
+
+        ret = (ret << RGB_LOOKUP_BITS) | ((val * RGB_LOOKUP_MAX + 0x800) >> 12);
+    }
+
+    return ret;
+}
+
 static inline void rgb2hsv_default(int r, int g, int b,
                                    int *hue, int *sat, int *val)
 {
@@ -279,15 +529,30 @@ caca_dither_t *caca_create_dither(int bpp, int w, int h, int pitch,
         return NULL;
     }
 
-    if(!lookup_initialised)
+    d->scratch = malloc(sizeof(struct dither_scratch));
+    if(!d->scratch)
     {
-        /* XXX: because we do not wish to be thread-safe, there is a slight
-         * chance that the following code will be executed twice. It is
-         * totally harmless. */
-        init_lookup();
-        lookup_initialised = 1;
+        free(d);
+        seterrno(ENOMEM);
+        return NULL;
     }
 
+    d->scratch->errors = NULL;
+    d->scratch->errors_size = 0;
+    d->scratch->cells = NULL;
+    d->scratch->cells_size = 0;
+    d->scratch->seed = 0;
+    d->scratch->history = NULL;
+    d->scratch->history_size = 0;
+    d->scratch->history_valid = 0;
+    d->scratch->quality = 0;
+    d->scratch->headroom = 0;
+    d->scratch->overrun = 0;
+    d->scratch->average = -1;
+    d->scratch->degraded = NULL;
+    for(i = 0; i < QUALITY_LEVELS; i++)
+        d->scratch->ratio[i] = 2.0;
+
     d->bpp = bpp;
     d->has_palette = 0;
     d->has_alpha = amask ? 1 : 0;
@@ -296,6 +561,8 @@ caca_dither_t *caca_create_dither(int bpp, int w, int h, int pitch,
     d->h = h;
     d->pitch = pitch;
 
+    d->yuv = YUV_FORMAT_NONE;
+
     d->rmask = rmask;
     d->gmask = gmask;
     d->bmask = bmask;
@@ -339,9 +606,21 @@ caca_dither_t *caca_create_dither(int bpp, int w, int h, int pitch,
     d->color_name = "full16";
     d->color = COLOR_MODE_FULL16;
 
+    d->distance_name = "rgb";
+    d->perceptual = 0;
+
+    d->palette = rgb_palette;
+    d->palette_weight = rgb_weight;
+    d->palette_size = 16;
+    d->custom_palette = NULL;
+
     d->glyph_name = "ascii";
     d->glyphs = ascii_glyphs;
     d->glyph_count = sizeof(ascii_glyphs) / sizeof(*ascii_glyphs);
+    d->subcell_w = d->subcell_h = 1;
+    d->shapes = NULL;
+    d->shape_count = d->use_shapes = 0;
+    init_truecolor_glyphs(d);
 
     d->algo_name = "fstein";
     d->init_dither = init_fstein_dither;
@@ -350,6 +629,88 @@ caca_dither_t *caca_create_dither(int bpp, int w, int h, int pitch,
 
     d->invert = 0;
 
+    d->threads = 1;
+    d->incremental = 0;
+    d->budget = 0;
+    d->serial = 0;
+
+    init_pixel_kernel(d);
+    init_rgb_lookup(d);
+
+    return d;
+}
+
+/** \brief Create an internal dither object for YUV bitmaps.
+ *
+ *  Create a dither structure for video frames in one of the following
+ *  YUV formats, using ITU-R BT.601 limited range coefficients:
+ *  - \c "I420": planar 4:2:0, with a Y plane followed by U and V planes
+ *    subsampled by two in both directions.
+ *  - \c "NV12": semi-planar 4:2:0, with a Y plane followed by a plane of
+ *    interleaved U and V values subsampled by two in both directions.
+ *  - \c "YUY2": packed 4:2:2, with Y0 U Y1 V bytes for each pair of pixels.
+ *
+ *  When dithering such a bitmap, the pixel pointer given to
+ *  caca_dither_bitmap() is an array of pointers to each plane. Pixels are
+ *  converted to RGB as they are read, so only the sampled ones are ever
+ *  converted.
+ *
+ *  If an error occurs, NULL is returned and \b errno is set accordingly:
+ *  - \c EINVAL Requested format, width, height or pitch value was invalid.
+ *  - \c ENOMEM Not enough memory to allocate dither structure.
+ *
+ *  \param format A string describing the YUV format.
+ *  \param w Bitmap width in pixels.
+ *  \param h Bitmap height in pixels.
+ *  \param pitch An array with the pitch of each plane in bytes.
+ *  \return Dither object upon success, NULL if an error occurred.
+ */
+caca_dither_t *caca_create_yuv_dither(char const *format, int w, int h,
+                                      int const *pitch)
+{
+    caca_dither_t *d;
+    enum yuv_format yuv;
+    int planes;
+
+    if(!strcasecmp(format, "i420"))
+    {
+        yuv = YUV_FORMAT_I420;
+        planes = 3;
+    }
+    else if(!strcasecmp(format, "nv12"))
+    {
+        yuv = YUV_FORMAT_NV12;
+        planes = 2;
+    }
+    else if(!strcasecmp(format, "yuy2"))
+    {
+        yuv = YUV_FORMAT_YUY2;
+        planes = 1;
+    }
+    else
+    {
+        seterrno(EINVAL);
+        return NULL;
+    }
+
+    if(pitch[0] < 0 || (planes > 1 && pitch[1] < 0)
+                    || (planes > 2 && pitch[2] < 0))
+    {
+        seterrno(EINVAL);
+        return NULL;
+    }
+
+    d = caca_create_dither(32, w, h, pitch[0], 0xff0000, 0xff00, 0xff, 0);
+    if(!d)
+        return NULL;
+
+    d->yuv = yuv;
+    d->plane_pitch[0] = pitch[0];
+    d->plane_pitch[1] = planes > 1 ? pitch[1] : 0;
+    d->plane_pitch[2] = planes > 2 ? pitch[2] : 0;
+
+    init_pixel_kernel(d);
+
     return d;
 }
 
@@ -404,6 +765,10 @@ int caca_set_dither_palette(caca_dither_t *d,
 
     d->has_alpha = has_alpha;
 
+    init_pixel_kernel(d);
+
+    d->serial++;
+
     return 0;
 }
 
@@ -475,6 +840,10 @@ int caca_set_dither_gamma(caca_dither_t *d, float gamma)
     for(i = 0; i < 4096; i++)
         d->gammatab[i] = 4096.0 * gammapow((float)i / 4096.0, 1.0 / gamma);
 
+    init_pixel_kernel(d);
+
+    d->serial++;
+
     return 0;
 }
 
@@ -559,6 +928,8 @@ int caca_set_dither_antialias(caca_dither_t *d, char const *str)
         return -1;
     }
 
+    d->serial++;
+
     return 0;
 }
 
@@ -616,6 +987,10 @@ char const * caca_get_dither_antialias(caca_dither_t const *d)
  *    background.
  *  - \c "full16" or \c "default": use the 16 ANSI colours for both the
  *    characters and the background. This is the default value.
+ *  - \c "truecolor": use ARGB colours, such as the ones set with
+ *    caca_set_color_argb(), for both the characters and the background.
+ *    No palette search is needed, and the colours are only limited by the
+ *    precision of canvas attributes.
  *
  *  If an error occurs, -1 is returned and \b errno is set accordingly:
  *  - \c EINVAL Invalid colour set.
@@ -662,12 +1037,21 @@ int caca_set_dither_color(caca_dither_t *d, char const *str)
         d->color_name = "full16";
         d->color = COLOR_MODE_FULL16;
     }
+    else if(!strcasecmp(str, "truecolor"))
+    {
+        d->color_name = "truecolor";
+        d->color = COLOR_MODE_TRUECOLOR;
+    }
     else
     {
         seterrno(EINVAL);
         return -1;
     }
 
+    init_rgb_lookup(d);
+
+    d->serial++;
+
     return 0;
 }
 
@@ -696,6 +1080,7 @@ char const * const *
         "fullgray", "full grayscale",
         "full8", "full 8 colours",
         "full16", "full 16 colours",
+        "truecolor", "full ARGB colours",
         NULL, NULL
     };
 
@@ -716,6 +1101,190 @@ char const * caca_get_dither_color(caca_dither_t const *d)
     return d->color_name;
 }
 
+/** \brief Choose the colour distance used for dithering
+ *
+ *  Tell the renderer how to measure the distance between a pixel and the
+ *  colours of the palette when looking for the nearest ones. Valid values
+ *  for \c str are:
+ *  - \c "rgb" or \c "default": use the squared euclidean distance in RGB
+ *    space. This is the default value.
+ *  - \c "oklab": use the squared euclidean distance in the OKLab colour
+ *    space, which follows the eye's sensitivity more closely and gives
+ *    better results on gradients and skin tones.
+ *
+ *  Distances are only computed when the nearest colour lookup table is
+ *  built, so the choice of distance does not change the dithering speed.
+ *  It has no effect in \c "truecolor" mode.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Invalid colour distance.
+ *
+ *  \param d Dither object.
+ *  \param str A string describing the colour distance that will be used
+ *         for the dithering.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_set_dither_distance(caca_dither_t *d, char const *str)
+{
+    if(!strcasecmp(str, "rgb") || !strcasecmp(str, "default"))
+    {
+        d->distance_name = "rgb";
+        d->perceptual = 0;
+    }
+    else if(!strcasecmp(str, "oklab"))
+    {
+        d->distance_name = "oklab";
+        d->perceptual = 1;
+    }
+    else
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    init_rgb_lookup(d);
+
+    d->serial++;
+
+    return 0;
+}
+
+/** \brief Get available colour distances
+ *
+ *  Return a list of available colour distances for a given dither. The
+ *  list is a NULL-terminated array of strings, interleaving a string
+ *  containing the internal value for the colour distance, to be used with
+ *  caca_set_dither_distance(), and a string containing the natural
+ *  language description for that colour distance.
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return An array of strings.
+ */
+char const * const *
+    caca_get_dither_distance_list(caca_dither_t const *d)
+{
+    static char const * const list[] =
+    {
+        "rgb", "RGB distance",
+        "oklab", "perceptual OKLab distance",
+        NULL, NULL
+    };
+
+    return list;
+}
+
+/** \brief Get current colour distance
+ *
+ *  Return the given dither's current colour distance.
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return A static string.
+ */
+char const * caca_get_dither_distance(caca_dither_t const *d)
+{
+    return d->distance_name;
+}
+
+/** \brief Set the output palette of a dither
+ *
+ *  Replace the 16 ANSI colours used for dithering with a custom palette,
+ *  such as the xterm 256-colour set. Colours are 24-bit RGB values; since
+ *  cells store ARGB colours with 4 bits of red and green and 3 bits of
+ *  blue, colours are rounded to that precision and output as ARGB values.
+ *
+ *  Each colour may be given a weight: the distance between a pixel and a
+ *  colour is multiplied by the colour's weight before finding the nearest
+ *  one, so colours with a higher weight are used less often. If \c weights
+ *  is NULL, all colours have a weight of 1.
+ *
+ *  All colour modes except \c "truecolor" use the custom palette, and
+ *  they all behave like \c "full16" except for \c "fullgray", which only
+ *  uses the gray colours of the palette. Nearest colours are looked up in
+ *  a 12-bit table built by this function, so the palette size does not
+ *  change the dithering speed.
+ *
+ *  Passing zero colours restores the ANSI palette.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Invalid number of colours or invalid weight.
+ *  - \c ENOMEM Not enough memory to store the palette.
+ *
+ *  \param d Dither object.
+ *  \param count Number of colours, between 2 and 256, or 0.
+ *  \param colors Array of \e count 24-bit RGB values.
+ *  \param weights Array of \e count positive weights, or NULL.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_set_dither_output_palette(caca_dither_t *d, int count,
+                                   uint32_t const *colors, int const *weights)
+{
+    int *pal = NULL;
+    int i;
+
+    if(count == 1 || count < 0 || count > 256)
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    for(i = 0; weights && i < count; i++)
+        if(weights[i] <= 0)
+        {
+            seterrno(EINVAL);
+            return -1;
+        }
+
+    if(count)
+    {
+        pal = malloc(5 * count * sizeof(int));
+        if(!pal)
+        {
+            seterrno(ENOMEM);
+            return -1;
+        }
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        int r = (((colors[i] >> 16) & 0xff) * 15 + 0x7f) / 0xff;
+        int g = (((colors[i] >> 8) & 0xff) * 15 + 0x7f) / 0xff;
+        int b = ((colors[i] & 0xff) * 7 + 0x7f) / 0xff;
+
+        /* Store the colour as the canvas will render it */
+        pal[i * 3] = r * 0x111;
+        pal[i * 3 + 1] = g * 0x111;
+        pal[i * 3 + 2] = b * 0x222;
+        pal[3 * count + i] = weights ? weights[i] : 1;
+        pal[4 * count + i] = (r << 7) | (g << 3) | b;
+    }
+
+    free(d->custom_palette);
+    d->custom_palette = pal;
+
+    if(count)
+    {
+        d->palette = pal;
+        d->palette_weight = pal + 3 * count;
+        d->palette_size = count;
+    }
+    else
+    {
+        d->palette = rgb_palette;
+        d->palette_weight = rgb_weight;
+        d->palette_size = 16;
+    }
+
+    init_rgb_lookup(d);
+
+    d->serial++;
+
+    return 0;
+}
+
 /** \brief Choose characters used for dithering
  *
  *  Tell the renderer which characters should be used to render the
@@ -727,9 +1296,26 @@ char const * caca_get_dither_color(caca_dither_t const *d)
  *    present in the CP437 codepage available on DOS and VGA.
  *  - \c "blocks": use Unicode quarter-cell block combinations. These
  *    characters are only found in the Unicode set.
+ *  - \c "quadrants": split each cell in 2x2 sub-cells and draw them with
+ *    Unicode quadrant block elements.
+ *  - \c "sextants": split each cell in 2x3 sub-cells and draw them with
+ *    Unicode sextant block elements, which are fairly recent and missing
+ *    from many fonts.
+ *  - \c "braille": split each cell in 2x4 sub-cells and draw them with
+ *    Unicode braille patterns.
+ *  - \c "structure": use the ASCII character or Unicode block element
+ *    whose shape in the "Monospace 9" built-in font best matches the
+ *    cell contents. Edges and text stay legible at small canvas sizes.
+ *  - \c "boldstructure": same as \c "structure", with the shapes of the
+ *    "Monospace Bold 12" built-in font.
+ *
+ *  With the sub-cell character sets, each cell gets the two colours that
+ *  best split its sub-cells, instead of a glyph of matching intensity.
+ *  This gives a much higher resolution for a given canvas size.
  *
  *  If an error occurs, -1 is returned and \b errno is set accordingly:
  *  - \c EINVAL Invalid character set.
+ *  - \c ENOMEM Not enough memory to compute the glyph shapes.
  *
  *  \param d Dither object.
  *  \param str A string describing the characters that need to be used
@@ -738,6 +1324,41 @@ char const * caca_get_dither_color(caca_dither_t const *d)
  */
 int caca_set_dither_charset(caca_dither_t *d, char const *str)
 {
+    int i, ret;
+
+    for(i = 0; i < (int)(sizeof(glyph_indices) / sizeof(*glyph_indices)); i++)
+    {
+        struct glyph_index *index = glyph_indices + i;
+
+        if(strcasecmp(str, index->charset))
+            continue;
+
+#if defined(USE_THREADS)
+        pthread_mutex_lock(&glyph_index_lock);
+#endif
+        ret = index->shapes ? 0 : init_glyph_shapes(index);
+#if defined(USE_THREADS)
+        pthread_mutex_unlock(&glyph_index_lock);
+#endif
+        if(ret < 0)
+            return -1;
+
+        d->glyph_name = index->charset;
+        d->subcell_w = d->subcell_h = 4;
+        d->glyphs = NULL;
+        d->shapes = index->shapes;
+        d->shape_count = index->count;
+        d->glyph_count = index->count;
+        d->use_shapes = 1;
+        init_truecolor_glyphs(d);
+        d->serial++;
+
+        return 0;
+    }
+
+    d->subcell_w = d->subcell_h = 1;
+    d->use_shapes = 0;
+
     if(!strcasecmp(str, "shades"))
     {
         d->glyph_name = "shades";
@@ -756,12 +1377,31 @@ int caca_set_dither_charset(caca_dither_t *d, char const *str)
         d->glyphs = ascii_glyphs;
         d->glyph_count = sizeof(ascii_glyphs) / sizeof(*ascii_glyphs);
     }
+    else if(!strcasecmp(str, "quadrants"))
+    {
+        d->glyph_name = "quadrants";
+        init_subcell_glyphs(d, 2, 2);
+    }
+    else if(!strcasecmp(str, "sextants"))
+    {
+        d->glyph_name = "sextants";
+        init_subcell_glyphs(d, 2, 3);
+    }
+    else if(!strcasecmp(str, "braille"))
+    {
+        d->glyph_name = "braille";
+        init_subcell_glyphs(d, 2, 4);
+    }
     else
     {
         seterrno(EINVAL);
         return -1;
     }
 
+    init_truecolor_glyphs(d);
+
+    d->serial++;
+
     return 0;
 }
 
@@ -785,6 +1425,11 @@ char const * const * caca_get_dither_charset_list(caca_dither_t const *d)
         "ascii", "plain ASCII",
         "shades", "CP437 shades",
         "blocks", "Unicode blocks",
+        "quadrants", "Unicode quadrants (2x2)",
+        "sextants", "Unicode sextants (2x3)",
+        "braille", "Unicode braille (2x4)",
+        "structure", "glyph shape matching",
+        "boldstructure", "bold glyph shape matching",
         NULL, NULL
     };
 
@@ -875,6 +1520,8 @@ int caca_set_dither_algorithm(caca_dither_t *d, char const *str)
         return -1;
     }
 
+    d->serial++;
+
     return 0;
 }
 
@@ -921,337 +1568,644 @@ char const * caca_get_dither_algorithm(caca_dither_t const *d)
     return d->algo_name;
 }
 
-/** \brief Dither a bitmap on the canvas.
+/** \brief Set the number of dithering threads
  *
- *  Dither a bitmap at the given coordinates. The dither can be of any size
- *  and will be stretched to the text area.
+ *  Tell the renderer how many threads caca_dither_bitmap() may use. The
+ *  destination area is split into horizontal bands that are dithered in
+ *  parallel. With the \c "fstein" algorithm, the error of a line diffuses
+ *  to the next one, so lines are instead dithered concurrently with each
+ *  line lagging a few cells behind the previous one. In both cases the
+ *  result is identical to the single-threaded one.
  *
- *  This function never fails.
+ *  The default value is 1, which disables multithreading.
  *
- *  \param cv A handle to the libcaca canvas.
- *  \param x X coordinate of the upper-left corner of the drawing area.
- *  \param y Y coordinate of the upper-left corner of the drawing area.
- *  \param w Width of the drawing area.
- *  \param h Height of the drawing area.
- *  \param d Dither object to be drawn.
- *  \param pixels Bitmap's pixels.
- *  \return This function always returns 0.
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL The number of threads is less than 1.
+ *  - \c ENOSYS libcaca was built without thread support and more than one
+ *    thread was requested.
+ *
+ *  \param d Dither object.
+ *  \param threads The maximum number of threads.
+ *  \return 0 in case of success, -1 if an error occurred.
  */
-int caca_dither_bitmap(caca_canvas_t *cv, int x, int y, int w, int h,
-                        caca_dither_t const *d, void const *pixels)
+int caca_set_dither_threads(caca_dither_t *d, int threads)
 {
-    int *floyd_steinberg, *fs_r, *fs_g, *fs_b;
-    uint32_t savedattr;
-    int fs_length;
-    int x1, y1, x2, y2, pitch, deltax, deltay, dchmax;
+    if(threads < 1)
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
 
-    if(!d || !pixels)
-        return 0;
+#if !defined(USE_THREADS)
+    if(threads > 1)
+    {
+        seterrno(ENOSYS);
+        return -1;
+    }
+#endif
 
-    savedattr = caca_get_attr(cv, -1, -1);
+    d->threads = threads;
+
+    return 0;
+}
+
+/** \brief Get the number of dithering threads
+ *
+ *  Return the maximum number of threads used by the given dither.
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return The number of threads.
+ */
+int caca_get_dither_threads(caca_dither_t const *d)
+{
+    return d->threads;
+}
 
-    x1 = x; x2 = x + w - 1;
-    y1 = y; y2 = y + h - 1;
+/** \brief Enable or disable incremental dithering
+ *
+ *  In incremental mode, caca_dither_bitmap() remembers a hash of the
+ *  bitmap pixels used by each character cell, and leaves alone the cells
+ *  whose pixels did not change since the previous call. This saves time
+ *  when dithering mostly static video, and the canvas' dirty rectangles
+ *  only cover the cells that actually changed.
+ *
+ *  The history is only reused if the previous call was on the same canvas
+ *  and area, with the same dither settings. Cells that no longer show what
+ *  the previous call printed, for instance after caca_clear_canvas() or
+ *  caca_set_frame(), are redrawn. Enabling incremental mode again forgets
+ *  the history and forces a full redraw on the next call.
+ *
+ *  The hash of each cell also covers its position in the ordered dithering
+ *  pattern or, with Floyd-Steinberg dithering, the error it receives from
+ *  its neighbours, so the result is identical to a full redraw for all
+ *  algorithms but \c "random".
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \param incremental 1 to enable incremental dithering, 0 to disable it.
+ *  \return This function always returns 0.
+ */
+int caca_set_dither_incremental(caca_dither_t *d, int incremental)
+{
+    d->incremental = incremental ? 1 : 0;
+    d->scratch->history_valid = 0;
 
-    /* FIXME: do not overwrite arguments */
-    w = d->w;
-    h = d->h;
-    pitch = d->pitch;
+    return 0;
+}
 
-    deltax = x2 - x1 + 1;
-    deltay = y2 - y1 + 1;
-    dchmax = d->glyph_count;
+/** \brief Get the incremental dithering status
+ *
+ *  Return whether incremental dithering is enabled for the given dither.
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return 1 if incremental dithering is enabled, 0 otherwise.
+ */
+int caca_get_dither_incremental(caca_dither_t const *d)
+{
+    return d->incremental;
+}
 
-    fs_length = ((int)cv->width <= x2 ? (int)cv->width : x2) + 1;
-    floyd_steinberg = malloc(3 * (fs_length + 2) * sizeof(int));
-    memset(floyd_steinberg, 0, 3 * (fs_length + 2) * sizeof(int));
-    fs_r = floyd_steinberg + 1;
-    fs_g = fs_r + fs_length + 2;
-    fs_b = fs_g + fs_length + 2;
+/** \brief Set the time budget of a dither
+ *
+ *  Set the time that each caca_dither_bitmap() call should not exceed.
+ *  When a call takes longer than that, the next calls lower the dithering
+ *  quality by one step:
+ *  - the \c "fstein" algorithm is replaced with \c "ordered8";
+ *  - then no dithering algorithm is used at all;
+ *  - then antialiasing is disabled as well.
+ *
+ *  When calls are fast enough for the next quality level to fit in the
+ *  budget again, the quality steps back up. The dither settings returned
+ *  by caca_get_dither_algorithm() and similar functions do not change.
+ *
+ *  This is meant for interactive programs that cannot afford to drop
+ *  frames when the host is loaded. Streams created with
+ *  caca_create_dither_stream() do not follow the time budget.
+ *
+ *  Changing the budget keeps the current quality level, which then adapts
+ *  to the new budget. Setting a budget of zero, the default value,
+ *  disables this feature and restores full quality.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Invalid time budget.
+ *
+ *  \param d Dither object.
+ *  \param usec The time budget in microseconds, or 0.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_set_dither_time_budget(caca_dither_t *d, int usec)
+{
+    int i;
 
-    for(y = y1 > 0 ? y1 : 0; y <= y2 && y <= (int)cv->height; y++)
+    if(usec < 0)
     {
-        int remain_r = 0, remain_g = 0, remain_b = 0;
+        seterrno(EINVAL);
+        return -1;
+    }
 
-        for(x = x1 > 0 ? x1 : 0, d->init_dither(y);
-            x <= x2 && x <= (int)cv->width;
-            x++)
+    d->budget = usec;
+
+    if(!usec)
     {
-        unsigned int rgba[4];
-        int error[3];
-        int i, ch = 0, distmin;
-        int fg_r = 0, fg_g = 0, fg_b = 0, bg_r, bg_g, bg_b;
-        int fromx, fromy, tox, toy, myx, myy, dots, dist;
+        d->scratch->quality = 0;
+        d->scratch->headroom = 0;
+        d->scratch->overrun = 0;
+        d->scratch->average = -1;
+        for(i = 0; i < QUALITY_LEVELS; i++)
+            d->scratch->ratio[i] = 2.0;
+    }
 
-        int outfg = 0, outbg = 0;
-        uint32_t outch;
+    return 0;
+}
 
-        rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+/** \brief Get the time budget of a dither
+ *
+ *  Return the time budget set with caca_set_dither_time_budget().
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return The time budget in microseconds, or 0 if there is none.
+ */
+int caca_get_dither_time_budget(caca_dither_t const *d)
+{
+    return d->budget;
+}
 
-        /* First get RGB */
-        if(d->antialias)
-        {
-            fromx = (uint64_t)(x - x1) * w / deltax;
-            fromy = (uint64_t)(y - y1) * h / deltay;
-            tox = (uint64_t)(x - x1 + 1) * w / deltax;
-            toy = (uint64_t)(y - y1 + 1) * h / deltay;
+/** \brief Get the current quality level of a dither
+ *
+ *  Return how many steps the dithering quality was lowered to fit in the
+ *  time budget set with caca_set_dither_time_budget(), from 0 for full
+ *  quality to 3 when neither dithering nor antialiasing are used.
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return The current quality level.
+ */
+int caca_get_dither_quality(caca_dither_t const *d)
+{
+    return d->scratch->quality;
+}
 
-            /* We want at least one pixel */
-            if(tox == fromx) tox++;
-            if(toy == fromy) toy++;
+/** \brief Dither a bitmap on the canvas.
+ *
+ *  Dither a bitmap at the given coordinates. The dither can be of any size
+ *  and will be stretched to the text area.
+ *
+ *  This function is reentrant: different dither objects may be used from
+ *  different threads at the same time, on different canvases. A given
+ *  dither object keeps scratch memory between calls and must not be used
+ *  by several threads at once.
+ *
+ *  If a time budget was set with caca_set_dither_time_budget(), the
+ *  dithering quality may be lowered to meet it.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to allocate the dithering buffers.
+ *
+ *  \param cv A handle to the libcaca canvas.
+ *  \param x X coordinate of the upper-left corner of the drawing area.
+ *  \param y Y coordinate of the upper-left corner of the drawing area.
+ *  \param w Width of the drawing area.
+ *  \param h Height of the drawing area.
+ *  \param d Dither object to be drawn.
+ *  \param pixels Bitmap's pixels, or an array of plane pointers if the
+ *  dither was created with caca_create_yuv_dither().
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_dither_bitmap(caca_canvas_t *cv, int x, int y, int w, int h,
+                        caca_dither_t const *d, void const *pixels)
+{
+    struct dither_job job;
+    caca_timer_t timer = { 0, 0 };
+    uint32_t savedattr;
+    size_t fs_size, cells_size;
+    int fs_length, width, lines, threads;
 
-            dots = 0;
+    if(!d || !pixels)
+        return 0;
 
-            for(myx = fromx; myx < tox; myx++)
-                for(myy = fromy; myy < toy; myy++)
-            {
-                dots++;
-                get_rgba_default(d, pixels, myx, myy, rgba);
-            }
+    if(d->budget)
+    {
+        d = get_quality_dither(d);
+        _caca_getticks(&timer);
+    }
 
-            /* Normalize */
-            rgba[0] /= dots;
-            rgba[1] /= dots;
-            rgba[2] /= dots;
-            rgba[3] /= dots;
-        }
-        else
-        {
-            fromx = (uint64_t)(x - x1) * w / deltax;
-            fromy = (uint64_t)(y - y1) * h / deltay;
-            tox = (uint64_t)(x - x1 + 1) * w / deltax;
-            toy = (uint64_t)(y - y1 + 1) * h / deltay;
-
-            /* tox and toy can overflow the canvas, but they cannot overflow
-             * when averaged with fromx and fromy because these are guaranteed
-             * to be within the pixel boundaries. */
-            myx = (fromx + tox) / 2;
-            myy = (fromy + toy) / 2;
-
-            get_rgba_default(d, pixels, myx, myy, rgba);
-        }
+    job.d = d;
+    job.cv = cv;
+    job.pixels = pixels;
+    job.y0 = 0;
+    job.x1 = x;
+    job.y1 = y;
+    job.deltax = w;
+    job.deltay = h;
+
+    /* Cells beyond the right and bottom edges of the canvas are dithered
+     * but not printed, because their error still diffuses to the visible
+     * cells. */
+    job.xmin = x > 0 ? x : 0;
+    job.xmax = x + w - 1 < (int)cv->width ? x + w - 1 : (int)cv->width;
+    job.ymin = y > 0 ? y : 0;
+    job.ymax = y + h - 1 < (int)cv->height ? y + h - 1 : (int)cv->height;
+
+    width = job.xmax - job.xmin + 1;
+    lines = job.ymax - job.ymin + 1;
+    if(width <= 0 || lines <= 0)
+        return 0;
 
-        /* FIXME: hack to force greyscale */
-        if(d->color == COLOR_MODE_FULLGRAY)
-        {
-            unsigned int gray = (3 * rgba[0] + 4 * rgba[1] + rgba[2] + 4) / 8;
-            rgba[0] = rgba[1] = rgba[2] = gray;
-        }
+    threads = d->threads < lines ? d->threads : lines;
 
-        if(d->has_alpha && rgba[3] < 0x800)
-        {
-            remain_r = remain_g = remain_b = 0;
-            fs_r[x] = 0;
-            fs_g[x] = 0;
-            fs_b[x] = 0;
-            continue;
-        }
+    /* Grow the scratch buffers if necessary */
+    fs_length = job.xmax + 1;
+    fs_size = 3 * (fs_length + 2);
 
-        /* XXX: OMG HAX */
-        if(d->init_dither == init_fstein_dither)
-        {
-            rgba[0] += remain_r;
-            rgba[1] += remain_g;
-            rgba[2] += remain_b;
-        }
-        else
+    job.stride = 2 * width;
+
+    cells_size = job.stride * (threads > 1 ? lines : 1);
+
+    if(d->scratch->errors_size < fs_size)
+    {
+        int *errors = realloc(d->scratch->errors, fs_size * sizeof(int));
+        if(!errors)
         {
-            rgba[0] += (d->get_dither() - 0x80) * 4;
-            rgba[1] += (d->get_dither() - 0x80) * 4;
-            rgba[2] += (d->get_dither() - 0x80) * 4;
+            seterrno(ENOMEM);
+            return -1;
         }
+        d->scratch->errors = errors;
+        d->scratch->errors_size = fs_size;
+    }
 
-        distmin = INT_MAX;
-        for(i = 0; i < 16; i++)
+    if(d->scratch->cells_size < cells_size)
+    {
+        uint32_t *cells = realloc(d->scratch->cells,
+                                  cells_size * sizeof(uint32_t));
+        if(!cells)
         {
-            if(d->color == COLOR_MODE_FULLGRAY
-                && (rgb_palette[i * 3] != rgb_palette[i * 3 + 1]
-                     || rgb_palette[i * 3] != rgb_palette[i * 3 + 2]))
-                continue;
-            dist = sq(rgba[0] - rgb_palette[i * 3])
-                 + sq(rgba[1] - rgb_palette[i * 3 + 1])
-                 + sq(rgba[2] - rgb_palette[i * 3 + 2]);
-            dist *= rgb_weight[i];
-            if(dist < distmin)
-            {
-                outbg = i;
-                distmin = dist;
-            }
+            seterrno(ENOMEM);
+            return -1;
         }
-        bg_r = rgb_palette[outbg * 3];
-        bg_g = rgb_palette[outbg * 3 + 1];
-        bg_b = rgb_palette[outbg * 3 + 2];
+        d->scratch->cells = cells;
+        d->scratch->cells_size = cells_size;
+    }
 
-        /* FIXME: we currently only honour "full16" */
-        if(d->color == COLOR_MODE_FULL16 || d->color == COLOR_MODE_FULLGRAY)
-        {
-            distmin = INT_MAX;
-            for(i = 0; i < 16; i++)
-            {
-                if(i == outbg)
-                    continue;
-                if(d->color == COLOR_MODE_FULLGRAY
-                    && (rgb_palette[i * 3] != rgb_palette[i * 3 + 1]
-                         || rgb_palette[i * 3] != rgb_palette[i * 3 + 2]))
-                    continue;
-                dist = sq(rgba[0] - rgb_palette[i * 3])
-                     + sq(rgba[1] - rgb_palette[i * 3 + 1])
-                     + sq(rgba[2] - rgb_palette[i * 3 + 2]);
-                dist *= rgb_weight[i];
-                if(dist < distmin)
-                {
-                    outfg = i;
-                    distmin = dist;
-                }
-            }
-            fg_r = rgb_palette[outfg * 3];
-            fg_g = rgb_palette[outfg * 3 + 1];
-            fg_b = rgb_palette[outfg * 3 + 2];
+    job.history = NULL;
+    job.history_valid = 0;
 
-            distmin = INT_MAX;
-            for(i = 0; i < dchmax - 1; i++)
-            {
-                int newr = i * fg_r + ((2*dchmax-1) - i) * bg_r;
-                int newg = i * fg_g + ((2*dchmax-1) - i) * bg_g;
-                int newb = i * fg_b + ((2*dchmax-1) - i) * bg_b;
-                dist = abs(rgba[0] * (2*dchmax-1) - newr)
-                     + abs(rgba[1] * (2*dchmax-1) - newg)
-                     + abs(rgba[2] * (2*dchmax-1) - newb);
-
-                if(dist < distmin)
-                {
-                    ch = i;
-                    distmin = dist;
-                }
-            }
-            outch = d->glyphs[ch];
+    if(d->incremental)
+    {
+        struct dither_call call;
+        size_t history_size = (size_t)width * lines;
 
-            /* XXX: OMG HAX */
-            if(d->init_dither == init_fstein_dither)
+        if(d->scratch->history_size < history_size)
+        {
+            struct dither_cell *history = realloc(d->scratch->history,
+                                     history_size * sizeof(struct dither_cell));
+            if(!history)
             {
-                error[0] = rgba[0] - (fg_r * ch + bg_r * ((2*dchmax-1) - ch)) / (2*dchmax-1);
-                error[1] = rgba[1] - (fg_g * ch + bg_g * ((2*dchmax-1) - ch)) / (2*dchmax-1);
-                error[2] = rgba[2] - (fg_b * ch + bg_b * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+                seterrno(ENOMEM);
+                return -1;
             }
+            d->scratch->history = history;
+            d->scratch->history_size = history_size;
+            d->scratch->history_valid = 0;
         }
-        else
-        {
-            unsigned int lum = rgba[0];
-            if(rgba[1] > lum) lum = rgba[1];
-            if(rgba[2] > lum) lum = rgba[2];
-            outfg = outbg;
-            outbg = CACA_BLACK;
 
-            ch = lum * dchmax / 0x1000;
-            if(ch < 0)
-                ch = 0;
-            else if(ch > (int)(dchmax - 1))
-                ch = dchmax - 1;
-            outch = d->glyphs[ch];
+        memset(&call, 0, sizeof(call));
+        call.cv = cv;
+        call.x = x;
+        call.y = y;
+        call.w = w;
+        call.h = h;
+        call.width = cv->width;
+        call.height = cv->height;
+        call.attr = caca_get_attr(cv, -1, -1) & 0x0000000f;
+        call.serial = d->serial;
+        call.quality = d->scratch->quality;
+
+        job.history = d->scratch->history;
+        job.history_valid = d->scratch->history_valid
+            && !memcmp(&call, &d->scratch->last_call, sizeof(call));
+
+        d->scratch->last_call = call;
+        d->scratch->history_valid = 1;
+    }
 
-            /* XXX: OMG HAX */
-            if(d->init_dither == init_fstein_dither)
-            {
-                error[0] = rgba[0] - bg_r * ch / (dchmax-1);
-                error[1] = rgba[1] - bg_g * ch / (dchmax-1);
-                error[2] = rgba[2] - bg_b * ch / (dchmax-1);
-            }
-        }
+    memset(d->scratch->errors, 0, fs_size * sizeof(int));
+    job.fs_r = d->scratch->errors + 1;
+    job.fs_g = job.fs_r + fs_length + 2;
+    job.fs_b = job.fs_g + fs_length + 2;
+    job.cells = d->scratch->cells;
 
-        /* XXX: OMG HAX */
-        if(d->init_dither == init_fstein_dither)
-        {
-            remain_r = fs_r[x+1] + 7 * error[0] / 16;
-            remain_g = fs_g[x+1] + 7 * error[1] / 16;
-            remain_b = fs_b[x+1] + 7 * error[2] / 16;
-            fs_r[x-1] += 3 * error[0] / 16;
-            fs_g[x-1] += 3 * error[1] / 16;
-            fs_b[x-1] += 3 * error[2] / 16;
-            fs_r[x] = 5 * error[0] / 16;
-            fs_g[x] = 5 * error[1] / 16;
-            fs_b[x] = 5 * error[2] / 16;
-            fs_r[x+1] = 1 * error[0] / 16;
-            fs_g[x+1] = 1 * error[1] / 16;
-            fs_b[x+1] = 1 * error[2] / 16;
-        }
+    /* Use a different random seed for each call */
+    job.seed = d->scratch->seed++ * 0x2545f491;
 
-        if(d->invert)
-        {
-            outfg = 15 - outfg;
-            outbg = 15 - outbg;
-        }
+    savedattr = caca_get_attr(cv, -1, -1);
+    job.attr = savedattr & 0x0000000f;
+
+#if defined(USE_THREADS)
+    /* XXX: OMG HAX */
+    if(threads > 1 && (d->init_dither == init_fstein_dither
+                        ? dither_lines_wavefront(&job, threads)
+                        : dither_lines_threaded(&job, threads)) == 0)
+    {
+        for(y = job.ymin; y <= job.ymax; y++)
+            put_dithered_line(cv, &job, y,
+                              job.cells + job.stride * (y - job.ymin));
 
-        /* Now output the character */
-        caca_set_color_ansi(cv, outfg, outbg);
-        caca_put_char(cv, x, y, outch);
+        caca_set_attr(cv, savedattr);
 
-        d->increment_dither();
-    }
-        /* end loop */
+        if(d->budget)
+            update_quality(d, _caca_getticks(&timer));
+
+        return 0;
     }
+#endif
 
-    free(floyd_steinberg);
+    for(y = job.ymin; y <= job.ymax; y++)
+    {
+        dither_lines(&job, y, y, job.cells);
+        put_dithered_line(cv, &job, y, job.cells);
+    }
 
     caca_set_attr(cv, savedattr);
 
+    if(d->budget)
+        update_quality(d, _caca_getticks(&timer));
+
     return 0;
 }
 
-/** \brief Free the memory associated with a dither.
+/** \brief Start dithering a bitmap progressively
  *
- *  Free the memory allocated by caca_create_dither().
+ *  Prepare the dithering of a bitmap whose lines are not all available at
+ *  once, such as a very large image or the output of a decoder. The bitmap
+ *  lines are then given in order to caca_push_dither_rows(), and each
+ *  canvas line is drawn as soon as all the bitmap lines it covers are
+ *  known. Only the bitmap lines needed by the current canvas line are kept
+ *  in memory.
  *
- *  This function never fails.
+ *  The result is the same as a caca_dither_bitmap() call with the same
+ *  arguments on the whole bitmap, except that dithering is neither
+ *  multithreaded nor incremental. The dither object must not be modified
+ *  or freed before the stream is freed.
  *
- *  \param d Dither object.
- *  \return This function always returns 0.
- */
-int caca_free_dither(caca_dither_t *d)
-{
-    if(!d)
-        return 0;
-
-    free(d);
-
-    return 0;
-}
-
-/*
- * XXX: The following functions are local.
+ *  If an error occurs, NULL is returned and \b errno is set accordingly:
+ *  - \c EINVAL The dither was created with caca_create_yuv_dither().
+ *  - \c ENOMEM Not enough memory to allocate the stream.
+ *
+ *  \param cv A handle to the libcaca canvas.
+ *  \param x X coordinate of the upper-left corner of the drawing area.
+ *  \param y Y coordinate of the upper-left corner of the drawing area.
+ *  \param w Width of the drawing area.
+ *  \param h Height of the drawing area.
+ *  \param d Dither object to be drawn.
+ *  \return A dither stream upon success, NULL if an error occurred.
  */
-
-/* Convert a mask, eg. 0x0000ff00, to shift values, eg. 8 and -4. */
-static void mask2shift(uint32_t mask, int *right, int *left)
+caca_dither_stream_t *caca_create_dither_stream(caca_canvas_t *cv,
+                                                int x, int y, int w, int h,
+                                                caca_dither_t const *d)
 {
-    int rshift = 0, lshift = 0;
+    caca_dither_stream_t *s;
+    int width, fs_length;
 
-    if(!mask)
+    if(d->yuv != YUV_FORMAT_NONE)
     {
-        *right = *left = 0;
-        return;
+        seterrno(EINVAL);
+        return NULL;
     }
 
-    while(!(mask & 1))
+    s = malloc(sizeof(caca_dither_stream_t));
+    if(!s)
     {
-        mask >>= 1;
-        rshift++;
+        seterrno(ENOMEM);
+        return NULL;
     }
-    *right = rshift;
 
-    while(mask & 1)
+    s->cv = cv;
+    s->job.d = d;
+    s->job.cv = cv;
+    s->job.x1 = x;
+    s->job.y1 = y;
+    s->job.deltax = w;
+    s->job.deltay = h;
+    s->job.xmin = x > 0 ? x : 0;
+    s->job.xmax = x + w - 1 < (int)cv->width ? x + w - 1 : (int)cv->width;
+    s->job.ymin = y > 0 ? y : 0;
+    s->job.ymax = y + h - 1 < (int)cv->height ? y + h - 1 : (int)cv->height;
+
+    /* Nothing will ever be drawn if the area is empty */
+    width = s->job.xmax - s->job.xmin + 1;
+    if(width <= 0 || h <= 0)
     {
-        mask >>= 1;
-        lshift++;
+        width = 0;
+        s->job.ymax = s->job.ymin - 1;
     }
-    *left = 12 - lshift;
-}
 
-/* Compute x^y without relying on the math library */
-static float gammapow(float x, float y)
-{
-#ifdef HAVE_FLDLN2
-    register double logx;
-    register long double v, e;
+    s->job.stride = 2 * width;
+    s->job.history = NULL;
+    s->job.history_valid = 0;
+    s->job.seed = d->scratch->seed++ * 0x2545f491;
+    s->job.attr = caca_get_attr(cv, -1, -1) & 0x0000000f;
+
+    s->line = s->job.ymin;
+    s->received = 0;
+    s->first = s->count = 0;
+
+    /* A canvas line never needs more bitmap lines than this */
+    s->size = h > 0 ? (d->h + h - 1) / h + d->subcell_h : 0;
+
+    fs_length = s->job.xmax + 1 > 0 ? s->job.xmax + 1 : 0;
+    s->errors = calloc(3 * (fs_length + 2), sizeof(int));
+    s->job.cells = malloc((s->job.stride + 1) * sizeof(uint32_t));
+    s->rows = malloc(s->size * d->pitch + 1);
+
+    if(!s->errors || !s->job.cells || !s->rows)
+    {
+        free(s->errors);
+        free(s->job.cells);
+        free(s->rows);
+        free(s);
+        seterrno(ENOMEM);
+        return NULL;
+    }
+
+    s->job.fs_r = s->errors + 1;
+    s->job.fs_g = s->job.fs_r + fs_length + 2;
+    s->job.fs_b = s->job.fs_g + fs_length + 2;
+
+    return s;
+}
+
+/** \brief Give the next bitmap lines to a dither stream
+ *
+ *  Give the next bitmap lines to a dither stream created with
+ *  caca_create_dither_stream(), and draw all the canvas lines that can be
+ *  completed with them. Lines are \e rows consecutive bitmap lines with
+ *  the pitch given to caca_create_dither(). Bitmap lines that no canvas
+ *  line needs are not even copied.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL More lines than the bitmap height were given.
+ *
+ *  \param s Dither stream.
+ *  \param pixels The bitmap lines.
+ *  \param rows The number of bitmap lines.
+ *  \return The number of canvas lines drawn, or -1 if an error occurred.
+ */
+int caca_push_dither_rows(caca_dither_stream_t *s, void const *pixels,
+                          int rows)
+{
+    struct dither_job *job = &s->job;
+    caca_dither_t const *d = job->d;
+    uint8_t const *src = pixels;
+    uint32_t savedattr;
+    int i, fromy, toy, lines = 0;
+
+    if(rows < 0 || s->received + rows > (int)d->h)
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    savedattr = caca_get_attr(s->cv, -1, -1);
+
+    for(i = 0; i < rows; i++, s->received++)
+    {
+        if(s->line > job->ymax)
+            continue;
+
+        /* Keep the bitmap line if the current canvas line needs it */
+        get_line_rows(job, s->line, &fromy, &toy);
+        if(s->received < fromy)
+            continue;
+
+        if(!s->count)
+            s->first = s->received;
+        memcpy(s->rows + s->count * d->pitch, src + i * d->pitch, d->pitch);
+        s->count++;
+
+        /* Draw all the canvas lines that are now complete */
+        while(toy <= s->received + 1)
+        {
+            job->pixels = s->rows;
+            job->y0 = s->first;
+            dither_lines(job, s->line, s->line, job->cells);
+            put_dithered_line(s->cv, job, s->line, job->cells);
+            s->line++;
+            lines++;
+
+            if(s->line > job->ymax)
+                break;
+
+            /* Forget the bitmap lines the next canvas line does not need */
+            get_line_rows(job, s->line, &fromy, &toy);
+            if(fromy - s->first >= s->count)
+                s->count = 0;
+            else if(fromy > s->first)
+            {
+                s->count -= fromy - s->first;
+                memmove(s->rows, s->rows + (fromy - s->first) * d->pitch,
+                        s->count * d->pitch);
+                s->first = fromy;
+            }
+        }
+    }
+
+    caca_set_attr(s->cv, savedattr);
+
+    return lines;
+}
+
+/** \brief Free the memory associated with a dither stream.
+ *
+ *  Free the memory allocated by caca_create_dither_stream(). Canvas lines
+ *  whose bitmap lines were not all given are not drawn.
+ *
+ *  This function never fails.
+ *
+ *  \param s Dither stream.
+ *  \return This function always returns 0.
+ */
+int caca_free_dither_stream(caca_dither_stream_t *s)
+{
+    if(!s)
+        return 0;
+
+    free(s->errors);
+    free(s->job.cells);
+    free(s->rows);
+    free(s);
+
+    return 0;
+}
+
+/** \brief Free the memory associated with a dither.
+ *
+ *  Free the memory allocated by caca_create_dither().
+ *
+ *  This function never fails.
+ *
+ *  \param d Dither object.
+ *  \return This function always returns 0.
+ */
+int caca_free_dither(caca_dither_t *d)
+{
+    if(!d)
+        return 0;
+
+    free(d->scratch->errors);
+    free(d->scratch->cells);
+    free(d->scratch->history);
+    free(d->scratch->degraded);
+    free(d->scratch);
+    free(d->custom_palette);
+    free(d);
+
+    return 0;
+}
+
+/*
+ * XXX: The following functions are local.
+ */
+
+/* Convert a mask, eg. 0x0000ff00, to shift values, eg. 8 and -4. */
+static void mask2shift(uint32_t mask, int *right, int *left)
+{
+    int rshift = 0, lshift = 0;
+
+    if(!mask)
+    {
+        *right = *left = 0;
+        return;
+    }
+
+    while(!(mask & 1))
+    {
+        mask >>= 1;
+        rshift++;
+    }
+    *right = rshift;
+
+    while(mask & 1)
+    {
+        mask >>= 1;
+        lshift++;
+    }
+    *left = 12 - lshift;
+}
+
+/* Compute x^y without relying on the math library */
+static float gammapow(float x, float y)
+{
+#ifdef HAVE_FLDLN2
+    register double logx;
+    register long double v, e;
 #else
     register float tmp, t, t2, r;
     int i;
@@ -1286,292 +2240,2117 @@ static float gammapow(float x, float y)
     tmp = r = t;
     for(i = 3; i < 20; i += 2)
     {
-        r *= t2;
-        tmp += r / i;
+        r *= t2;
+        tmp += r / i;
+    }
+
+    /* Compute -y*ln(x) */
+    tmp = - y * 2.0 * tmp;
+
+    /* Compute x^-y as e^t where t = -y*ln(x):
+     *   e^t = 1 + t/1! + t^2/2! + t^3/3! + t^4/4! + t^5/5! ...
+     * The convergence is quite faster here, thanks to the factorial. */
+    r = t = tmp;
+    tmp = 1.0 + t;
+    for(i = 2; i < 16; i++)
+    {
+        r = r * t / i;
+        tmp += r;
+    }
+
+    /* Return x^y as 1/(x^-y) */
+    return 1.0 / tmp;
+#endif
+}
+
+static void get_rgba_default(caca_dither_t const *d, uint8_t const *pixels,
+                             int x, int y, uint32_t *rgba)
+{
+    uint32_t bits;
+
+    pixels += (d->bpp / 8) * x + d->pitch * y;
+
+    switch(d->bpp / 8)
+    {
+        case 4:
+            bits = *(uint32_t const *)pixels;
+            break;
+        case 3:
+        {
+#if defined(HAVE_ENDIAN_H)
+            if(__BYTE_ORDER == __BIG_ENDIAN)
+#else
+            /* This is compile-time optimised with at least -O1 or -Os */
+            uint32_t const tmp = 0x12345678;
+            if(*(uint8_t const *)&tmp == 0x12)
+#endif
+                bits = ((uint32_t)pixels[0] << 16) |
+                       ((uint32_t)pixels[1] << 8) |
+                       ((uint32_t)pixels[2]);
+            else
+                bits = ((uint32_t)pixels[2] << 16) |
+                       ((uint32_t)pixels[1] << 8) |
+                       ((uint32_t)pixels[0]);
+            break;
+        }
+        case 2:
+            bits = *(uint16_t const *)pixels;
+            break;
+        case 1:
+        default:
+            bits = pixels[0];
+            break;
+    }
+
+    if(d->has_palette)
+    {
+        rgba[0] += d->gammatab[d->red[bits]];
+        rgba[1] += d->gammatab[d->green[bits]];
+        rgba[2] += d->gammatab[d->blue[bits]];
+        rgba[3] += d->alpha[bits];
+    }
+    else
+    {
+        rgba[0] += d->gammatab[((bits & d->rmask) >> d->rright) << d->rleft];
+        rgba[1] += d->gammatab[((bits & d->gmask) >> d->gright) << d->gleft];
+        rgba[2] += d->gammatab[((bits & d->bmask) >> d->bright) << d->bleft];
+        rgba[3] += ((bits & d->amask) >> d->aright) << d->aleft;
+    }
+}
+
+/* Choose the fastest pixel fetching kernel for the dither's pixel format.
+ * This needs to be called again whenever the palette or the gamma table
+ * change. */
+static void init_pixel_kernel(caca_dither_t *d)
+{
+#if !defined(__KERNEL__) && (defined(__SSE2__) || defined(__ARM_NEON))
+    int i, identity = 1;
+#endif
+
+    switch(d->yuv)
+    {
+    case YUV_FORMAT_I420:
+        d->sum_pixels = sum_pixels_i420;
+        return;
+    case YUV_FORMAT_NV12:
+        d->sum_pixels = sum_pixels_nv12;
+        return;
+    case YUV_FORMAT_YUY2:
+        d->sum_pixels = sum_pixels_yuy2;
+        return;
+    default:
+        break;
+    }
+
+    if(d->has_palette)
+    {
+        d->sum_pixels = d->bpp == 8 ? sum_pixels_palette : sum_pixels_generic;
+        return;
+    }
+
+    switch(d->bpp)
+    {
+    case 16:
+        d->sum_pixels = sum_pixels_rgb16;
+        break;
+    case 24:
+        d->sum_pixels = sum_pixels_rgb24;
+        break;
+    case 32:
+        d->sum_pixels = sum_pixels_rgb32;
+#if !defined(__KERNEL__) && (defined(__SSE2__) || defined(__ARM_NEON))
+        /* The vector kernel adds up whole bytes and only works if gamma
+         * correction is disabled. */
+        for(i = 0; i < 4096; i++)
+            if(d->gammatab[i] != i)
+                identity = 0;
+
+        if(identity && is_byte_mask(d->rmask) && is_byte_mask(d->gmask)
+             && is_byte_mask(d->bmask) && is_byte_mask(d->amask))
+            d->sum_pixels = sum_pixels_bytes32;
+#endif
+        break;
+    default:
+        d->sum_pixels = sum_pixels_generic;
+        break;
+    }
+}
+
+/* The pixel fetching kernels add up pixels xa to xb - 1 of line y into
+ * rgba. They all give the same result as calling get_rgba_default() on
+ * each pixel. */
+static void sum_pixels_generic(caca_dither_t const *d, void const *pixels,
+                               int xa, int xb, int y, uint32_t *rgba)
+{
+    int x;
+
+    for(x = xa; x < xb; x++)
+        get_rgba_default(d, pixels, x, y, rgba);
+}
+
+static void sum_pixels_palette(caca_dither_t const *d, void const *pixels,
+                               int xa, int xb, int y, uint32_t *rgba)
+{
+    uint8_t const *p = (uint8_t const *)pixels + d->pitch * y + xa;
+    uint32_t r = 0, g = 0, b = 0, a = 0;
+    int x;
+
+    for(x = xa; x < xb; x++)
+    {
+        uint8_t bits = *p++;
+
+        r += d->gammatab[d->red[bits]];
+        g += d->gammatab[d->green[bits]];
+        b += d->gammatab[d->blue[bits]];
+        a += d->alpha[bits];
+    }
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b; rgba[3] += a;
+}
+
+static inline void add_bits(caca_dither_t const *d, uint32_t bits,
+                            uint32_t *r, uint32_t *g, uint32_t *b, uint32_t *a)
+{
+    *r += d->gammatab[((bits & d->rmask) >> d->rright) << d->rleft];
+    *g += d->gammatab[((bits & d->gmask) >> d->gright) << d->gleft];
+    *b += d->gammatab[((bits & d->bmask) >> d->bright) << d->bleft];
+    *a += ((bits & d->amask) >> d->aright) << d->aleft;
+}
+
+static void sum_pixels_rgb16(caca_dither_t const *d, void const *pixels,
+                             int xa, int xb, int y, uint32_t *rgba)
+{
+    uint16_t const *p = (uint16_t const *)
+                            ((uint8_t const *)pixels + d->pitch * y) + xa;
+    uint32_t r = 0, g = 0, b = 0, a = 0;
+    int x;
+
+    for(x = xa; x < xb; x++)
+        add_bits(d, *p++, &r, &g, &b, &a);
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b; rgba[3] += a;
+}
+
+static void sum_pixels_rgb24(caca_dither_t const *d, void const *pixels,
+                             int xa, int xb, int y, uint32_t *rgba)
+{
+    uint8_t const *p = (uint8_t const *)pixels + d->pitch * y + 3 * xa;
+    uint32_t r = 0, g = 0, b = 0, a = 0;
+    int x;
+
+    for(x = xa; x < xb; x++, p += 3)
+    {
+#if defined(HAVE_ENDIAN_H)
+        if(__BYTE_ORDER == __BIG_ENDIAN)
+#else
+        /* This is compile-time optimised with at least -O1 or -Os */
+        uint32_t const tmp = 0x12345678;
+        if(*(uint8_t const *)&tmp == 0x12)
+#endif
+            add_bits(d, ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8)
+                         | ((uint32_t)p[2]), &r, &g, &b, &a);
+        else
+            add_bits(d, ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8)
+                         | ((uint32_t)p[0]), &r, &g, &b, &a);
+    }
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b; rgba[3] += a;
+}
+
+static void sum_pixels_rgb32(caca_dither_t const *d, void const *pixels,
+                             int xa, int xb, int y, uint32_t *rgba)
+{
+    uint32_t const *p = (uint32_t const *)
+                            ((uint8_t const *)pixels + d->pitch * y) + xa;
+    uint32_t r = 0, g = 0, b = 0, a = 0;
+    int x;
+
+    for(x = xa; x < xb; x++)
+        add_bits(d, *p++, &r, &g, &b, &a);
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b; rgba[3] += a;
+}
+
+#if !defined(__KERNEL__) && (defined(__SSE2__) || defined(__ARM_NEON))
+/* 32-bit pixels whose channels are whole bytes, without gamma correction.
+ * Each channel is masked and its bytes are added up in vector registers,
+ * then scaled to 12 bits once at the end. */
+static void sum_pixels_bytes32(caca_dither_t const *d, void const *pixels,
+                               int xa, int xb, int y, uint32_t *rgba)
+{
+    uint32_t const *p = (uint32_t const *)
+                            ((uint8_t const *)pixels + d->pitch * y) + xa;
+    uint64_t r = 0, g = 0, b = 0, a = 0;
+    int n = xb - xa;
+
+#if defined(__AVX2__)
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const rmask = _mm256_set1_epi32(d->rmask);
+    __m256i const gmask = _mm256_set1_epi32(d->gmask);
+    __m256i const bmask = _mm256_set1_epi32(d->bmask);
+    __m256i const amask = _mm256_set1_epi32(d->amask);
+    __m256i vr = zero, vg = zero, vb = zero, va = zero;
+    uint64_t tmp[4][4];
+
+    for( ; n >= 8; n -= 8, p += 8)
+    {
+        __m256i px = _mm256_loadu_si256((__m256i const *)p);
+
+        vr = _mm256_add_epi64(vr, _mm256_sad_epu8(_mm256_and_si256(px, rmask), zero));
+        vg = _mm256_add_epi64(vg, _mm256_sad_epu8(_mm256_and_si256(px, gmask), zero));
+        vb = _mm256_add_epi64(vb, _mm256_sad_epu8(_mm256_and_si256(px, bmask), zero));
+        va = _mm256_add_epi64(va, _mm256_sad_epu8(_mm256_and_si256(px, amask), zero));
+    }
+
+    _mm256_storeu_si256((__m256i *)tmp[0], vr);
+    _mm256_storeu_si256((__m256i *)tmp[1], vg);
+    _mm256_storeu_si256((__m256i *)tmp[2], vb);
+    _mm256_storeu_si256((__m256i *)tmp[3], va);
+    r = tmp[0][0] + tmp[0][1] + tmp[0][2] + tmp[0][3];
+    g = tmp[1][0] + tmp[1][1] + tmp[1][2] + tmp[1][3];
+    b = tmp[2][0] + tmp[2][1] + tmp[2][2] + tmp[2][3];
+    a = tmp[3][0] + tmp[3][1] + tmp[3][2] + tmp[3][3];
+#elif defined(__SSE2__)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const rmask = _mm_set1_epi32(d->rmask);
+    __m128i const gmask = _mm_set1_epi32(d->gmask);
+    __m128i const bmask = _mm_set1_epi32(d->bmask);
+    __m128i const amask = _mm_set1_epi32(d->amask);
+    __m128i vr = zero, vg = zero, vb = zero, va = zero;
+    uint64_t tmp[4][2];
+
+    for( ; n >= 4; n -= 4, p += 4)
+    {
+        __m128i px = _mm_loadu_si128((__m128i const *)p);
+
+        vr = _mm_add_epi64(vr, _mm_sad_epu8(_mm_and_si128(px, rmask), zero));
+        vg = _mm_add_epi64(vg, _mm_sad_epu8(_mm_and_si128(px, gmask), zero));
+        vb = _mm_add_epi64(vb, _mm_sad_epu8(_mm_and_si128(px, bmask), zero));
+        va = _mm_add_epi64(va, _mm_sad_epu8(_mm_and_si128(px, amask), zero));
+    }
+
+    _mm_storeu_si128((__m128i *)tmp[0], vr);
+    _mm_storeu_si128((__m128i *)tmp[1], vg);
+    _mm_storeu_si128((__m128i *)tmp[2], vb);
+    _mm_storeu_si128((__m128i *)tmp[3], va);
+    r = tmp[0][0] + tmp[0][1];
+    g = tmp[1][0] + tmp[1][1];
+    b = tmp[2][0] + tmp[2][1];
+    a = tmp[3][0] + tmp[3][1];
+#else
+    uint32x4_t const rmask = vdupq_n_u32(d->rmask);
+    uint32x4_t const gmask = vdupq_n_u32(d->gmask);
+    uint32x4_t const bmask = vdupq_n_u32(d->bmask);
+    uint32x4_t const amask = vdupq_n_u32(d->amask);
+    int32x4_t const rshift = vdupq_n_s32(-d->rright);
+    int32x4_t const gshift = vdupq_n_s32(-d->gright);
+    int32x4_t const bshift = vdupq_n_s32(-d->bright);
+    int32x4_t const ashift = vdupq_n_s32(-d->aright);
+    uint64x2_t vr = vdupq_n_u64(0), vg = vr, vb = vr, va = vr;
+
+    for( ; n >= 4; n -= 4, p += 4)
+    {
+        uint32x4_t px = vld1q_u32(p);
+
+        vr = vpadalq_u32(vr, vshlq_u32(vandq_u32(px, rmask), rshift));
+        vg = vpadalq_u32(vg, vshlq_u32(vandq_u32(px, gmask), gshift));
+        vb = vpadalq_u32(vb, vshlq_u32(vandq_u32(px, bmask), bshift));
+        va = vpadalq_u32(va, vshlq_u32(vandq_u32(px, amask), ashift));
+    }
+
+    r = vgetq_lane_u64(vr, 0) + vgetq_lane_u64(vr, 1);
+    g = vgetq_lane_u64(vg, 0) + vgetq_lane_u64(vg, 1);
+    b = vgetq_lane_u64(vb, 0) + vgetq_lane_u64(vb, 1);
+    a = vgetq_lane_u64(va, 0) + vgetq_lane_u64(va, 1);
+#endif
+
+    for( ; n > 0; n--, p++)
+    {
+        r += (*p & d->rmask) >> d->rright;
+        g += (*p & d->gmask) >> d->gright;
+        b += (*p & d->bmask) >> d->bright;
+        a += (*p & d->amask) >> d->aright;
+    }
+
+    rgba[0] += (uint32_t)(r << d->rleft);
+    rgba[1] += (uint32_t)(g << d->gleft);
+    rgba[2] += (uint32_t)(b << d->bleft);
+    rgba[3] += (uint32_t)(a << d->aleft);
+}
+#endif
+
+/* YUV pixels are converted to 8-bit RGB with BT.601 limited range integer
+ * coefficients, then scaled to 12 bits like 8-bit RGB channels would be. */
+static inline void add_yuv(caca_dither_t const *d, int y, int u, int v,
+                           uint32_t *r, uint32_t *g, uint32_t *b)
+{
+    int c = 298 * (y - 16) + 128, e = u - 128, f = v - 128;
+    int red = (c + 409 * f) >> 8;
+    int green = (c - 100 * e - 208 * f) >> 8;
+    int blue = (c + 516 * e) >> 8;
+
+    red = red < 0 ? 0 : red > 255 ? 255 : red;
+    green = green < 0 ? 0 : green > 255 ? 255 : green;
+    blue = blue < 0 ? 0 : blue > 255 ? 255 : blue;
+
+    *r += d->gammatab[red << 4];
+    *g += d->gammatab[green << 4];
+    *b += d->gammatab[blue << 4];
+}
+
+static void sum_pixels_i420(caca_dither_t const *d, void const *pixels,
+                            int xa, int xb, int y, uint32_t *rgba)
+{
+    uint8_t const * const *planes = pixels;
+    uint8_t const *py = planes[0] + d->plane_pitch[0] * y;
+    uint8_t const *pu = planes[1] + d->plane_pitch[1] * (y / 2);
+    uint8_t const *pv = planes[2] + d->plane_pitch[2] * (y / 2);
+    uint32_t r = 0, g = 0, b = 0;
+    int x;
+
+    for(x = xa; x < xb; x++)
+        add_yuv(d, py[x], pu[x / 2], pv[x / 2], &r, &g, &b);
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b;
+}
+
+static void sum_pixels_nv12(caca_dither_t const *d, void const *pixels,
+                            int xa, int xb, int y, uint32_t *rgba)
+{
+    uint8_t const * const *planes = pixels;
+    uint8_t const *py = planes[0] + d->plane_pitch[0] * y;
+    uint8_t const *puv = planes[1] + d->plane_pitch[1] * (y / 2);
+    uint32_t r = 0, g = 0, b = 0;
+    int x;
+
+    for(x = xa; x < xb; x++)
+        add_yuv(d, py[x], puv[x & ~1], puv[x | 1], &r, &g, &b);
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b;
+}
+
+static void sum_pixels_yuy2(caca_dither_t const *d, void const *pixels,
+                            int xa, int xb, int y, uint32_t *rgba)
+{
+    uint8_t const * const *planes = pixels;
+    uint8_t const *p = planes[0] + d->plane_pitch[0] * y;
+    uint32_t r = 0, g = 0, b = 0;
+    int x;
+
+    for(x = xa; x < xb; x++)
+        add_yuv(d, p[2 * x], p[4 * (x / 2) + 1], p[4 * (x / 2) + 3],
+                &r, &g, &b);
+
+    rgba[0] += r; rgba[1] += g; rgba[2] += b;
+}
+
+/* Return a dither with the settings of the current quality level. The
+ * settings are copied at every call so that changes made to the dither
+ * are always taken into account; this is negligible compared to the
+ * dithering itself. If the copy cannot be allocated, the dither is used
+ * at full quality. */
+static caca_dither_t const *get_quality_dither(caca_dither_t const *d)
+{
+    struct dither_scratch *s = d->scratch;
+    caca_dither_t *q;
+
+    if(!s->quality)
+        return d;
+
+    if(!s->degraded)
+    {
+        s->degraded = malloc(sizeof(caca_dither_t));
+        if(!s->degraded)
+            return d;
+    }
+
+    q = s->degraded;
+    memcpy(q, d, sizeof(caca_dither_t));
+
+    if(s->quality >= 1 && q->init_dither == init_fstein_dither)
+    {
+        q->init_dither = init_ordered8_dither;
+        q->get_dither = get_ordered8_dither;
+        q->increment_dither = increment_ordered8_dither;
+    }
+
+    if(s->quality >= 2)
+    {
+        q->init_dither = init_no_dither;
+        q->get_dither = get_no_dither;
+        q->increment_dither = increment_no_dither;
+    }
+
+    if(s->quality >= 3)
+        q->antialias = 0;
+
+    return q;
+}
+
+/* Adjust the quality level after a call that took usec microseconds.
+ * Call times are averaged so that a single slow call, for instance when
+ * the process was preempted, does not lower the quality. The quality is
+ * raised again after several calls in a row whose average time, scaled
+ * by the ratio measured when leaving the level above, fits in the budget
+ * with some margin, so that the quality does not flip at every call. */
+static void update_quality(caca_dither_t const *d, int usec)
+{
+    struct dither_scratch *s = d->scratch;
+
+    /* Ignore the first call, which also allocates memory */
+    if(s->average < 0)
+    {
+        s->average = 0;
+        return;
+    }
+
+    if(usec <= 0)
+        usec = 1;
+
+    /* First call since stepping down: measure what it saved */
+    if(s->overrun)
+    {
+        float ratio = (float)s->overrun / usec;
+        s->ratio[s->quality] = ratio < 1.0 ? 1.0 : ratio > 4.0 ? 4.0 : ratio;
+        s->overrun = 0;
+        s->average = usec;
+    }
+    else
+        s->average = s->average ? (3 * s->average + usec) / 4 : usec;
+
+    if(s->average > d->budget)
+    {
+        if(s->quality < QUALITY_LEVELS - 1)
+        {
+            s->quality++;
+            s->overrun = s->average;
+        }
+        s->headroom = 0;
+    }
+    else if(s->quality
+             && s->average * s->ratio[s->quality] < d->budget * 0.75)
+    {
+        if(++s->headroom >= QUALITY_HEADROOM)
+        {
+            s->average = s->average * s->ratio[s->quality];
+            s->quality--;
+            s->headroom = 0;
+        }
+    }
+    else
+        s->headroom = 0;
+}
+
+/* Check that a cell still shows what the previous call left on the
+ * canvas. The cells beyond the edges of the canvas are never printed. */
+static int cell_unchanged(struct dither_job const *job, int x, int y,
+                          struct dither_cell const *history)
+{
+    caca_canvas_t const *cv = job->cv;
+
+    if(x >= cv->width || y >= cv->height)
+        return 1;
+
+    return cv->chars[y * cv->width + x] == history->ch
+            && cv->attrs[y * cv->width + x] == history->attr;
+}
+
+/* Find the bitmap lines used by a canvas line, in the same way as
+ * dither_line() */
+static void get_line_rows(struct dither_job const *job, int y,
+                          int *fromy, int *toy)
+{
+    caca_dither_t const *d = job->d;
+    int sh = d->subcell_h, dummy;
+
+    get_sample_range(d, (int64_t)(y - job->y1) * sh,
+                     (int64_t)job->deltay * sh, d->h, fromy, toy);
+    if(sh > 1)
+        get_sample_range(d, (int64_t)(y - job->y1) * sh + sh - 1,
+                         (int64_t)job->deltay * sh, d->h, &dummy, toy);
+}
+
+/* Find the bitmap pixels used by sample i of a line of count samples */
+static void get_sample_range(caca_dither_t const *d, int64_t i, int64_t count,
+                             int size, int *from, int *to)
+{
+    *from = (uint64_t)i * size / count;
+    *to = (uint64_t)(i + 1) * size / count;
+
+    if(d->antialias)
+    {
+        /* We want at least one pixel */
+        if(*to == *from)
+            (*to)++;
+    }
+    else
+    {
+        /* to can overflow the bitmap, but it cannot overflow when averaged
+         * with from because from is within the pixel boundaries. */
+        *from = (*from + *to) / 2;
+        *to = *from + 1;
+    }
+}
+
+/* Hash the bytes of a bitmap region, eight at a time */
+static uint64_t hash_bytes(uint64_t hash, uint8_t const *p, size_t n)
+{
+    for( ; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t v;
+
+        memcpy(&v, p, 8);
+        hash = (hash ^ v) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+
+    for( ; n > 0; n--, p++)
+        hash = (hash ^ *p) * 0x100000001b3ULL;
+
+    return hash;
+}
+
+/* Hash the bytes of all the pixels from (xa, ya) to (xb - 1, yb - 1) */
+static uint64_t hash_footprint(caca_dither_t const *d, void const *pixels,
+                               int xa, int xb, int ya, int yb)
+{
+    uint8_t const * const *planes = pixels;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int y;
+
+    for(y = ya; y < yb; y++)
+    {
+        switch(d->yuv)
+        {
+        case YUV_FORMAT_I420:
+            hash = hash_bytes(hash, planes[0] + d->plane_pitch[0] * y + xa,
+                              xb - xa);
+            hash = hash_bytes(hash, planes[1] + d->plane_pitch[1] * (y / 2)
+                                     + xa / 2, (xb + 1) / 2 - xa / 2);
+            hash = hash_bytes(hash, planes[2] + d->plane_pitch[2] * (y / 2)
+                                     + xa / 2, (xb + 1) / 2 - xa / 2);
+            break;
+        case YUV_FORMAT_NV12:
+            hash = hash_bytes(hash, planes[0] + d->plane_pitch[0] * y + xa,
+                              xb - xa);
+            hash = hash_bytes(hash, planes[1] + d->plane_pitch[1] * (y / 2)
+                                     + (xa & ~1), ((xb + 1) & ~1) - (xa & ~1));
+            break;
+        case YUV_FORMAT_YUY2:
+            hash = hash_bytes(hash, planes[0] + d->plane_pitch[0] * y
+                                     + 2 * (xa & ~1),
+                              2 * (((xb + 1) & ~1) - (xa & ~1)));
+            break;
+        default:
+            hash = hash_bytes(hash, (uint8_t const *)pixels + d->pitch * y
+                                     + (d->bpp / 8) * xa,
+                              (d->bpp / 8) * (xb - xa));
+            break;
+        }
+    }
+
+    return hash;
+}
+
+/* Diffuse the Floyd-Steinberg error of cell x to the cells on its right
+ * and below it */
+static inline void diffuse_error(struct dither_job const *job, int x,
+                                 int const *error, int *remain)
+{
+    remain[0] = job->fs_r[x+1] + 7 * error[0] / 16;
+    remain[1] = job->fs_g[x+1] + 7 * error[1] / 16;
+    remain[2] = job->fs_b[x+1] + 7 * error[2] / 16;
+    job->fs_r[x-1] += 3 * error[0] / 16;
+    job->fs_g[x-1] += 3 * error[1] / 16;
+    job->fs_b[x-1] += 3 * error[2] / 16;
+    job->fs_r[x] = 5 * error[0] / 16;
+    job->fs_g[x] = 5 * error[1] / 16;
+    job->fs_b[x] = 5 * error[2] / 16;
+    job->fs_r[x+1] = 1 * error[0] / 16;
+    job->fs_g[x+1] = 1 * error[1] / 16;
+    job->fs_b[x+1] = 1 * error[2] / 16;
+}
+
+/* Transparent cells stop the Floyd-Steinberg error */
+static inline void reset_error(struct dither_job const *job, int x,
+                               int *remain)
+{
+    remain[0] = remain[1] = remain[2] = 0;
+    job->fs_r[x] = 0;
+    job->fs_g[x] = 0;
+    job->fs_b[x] = 0;
+}
+
+/* Dither lines ymin to ymax into consecutive rows of the cells array */
+static void dither_lines(struct dither_job const *job, int ymin, int ymax,
+                         uint32_t *cells)
+{
+    struct dither_state state;
+    int y;
+
+    state.seed = job->seed;
+    state.remain_r = state.remain_g = state.remain_b = 0;
+
+    for(y = ymin; y <= ymax; y++)
+    {
+        job->d->init_dither(&state, y);
+        dither_line(job, &state, y, job->xmin, job->xmax, cells);
+        cells += job->stride;
+    }
+}
+
+/* Dither cells xa to xb of a line. A line may be dithered in several
+ * calls as long as they are consecutive and share the same state. A zero
+ * character means that the cell was transparent and must be left
+ * untouched. */
+static void dither_line(struct dither_job const *job, struct dither_state *state,
+                        int y, int xa, int xb, uint32_t *cells)
+{
+    caca_dither_t const *d = job->d;
+    uint32_t *attrs = cells + job->xmax - job->xmin + 1;
+    int x, w = d->w, h = d->h, dchmax = d->glyph_count;
+    int sw = d->subcell_w, sh = d->subcell_h;
+    struct dither_cell *history = NULL;
+    int remain[3];
+
+    remain[0] = state->remain_r;
+    remain[1] = state->remain_g;
+    remain[2] = state->remain_b;
+
+    for(x = xa; x <= xb; x++)
+    {
+        uint32_t rgba[4];
+        int error[3];
+        int ch;
+        int fg_r, fg_g, fg_b, bg_r, bg_g, bg_b;
+        int fromx, fromy, tox, toy, myy, dots;
+
+        int outfg, outbg;
+        uint32_t outch;
+        uint16_t lookup;
+
+        rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+
+        /* Find the cell's footprint in the bitmap, from its first to its
+         * last sub-cell */
+        get_sample_range(d, (int64_t)(x - job->x1) * sw,
+                         (int64_t)job->deltax * sw, w, &fromx, &tox);
+        get_sample_range(d, (int64_t)(y - job->y1) * sh,
+                         (int64_t)job->deltay * sh, h, &fromy, &toy);
+        if(sw > 1)
+            get_sample_range(d, (int64_t)(x - job->x1) * sw + sw - 1,
+                             (int64_t)job->deltax * sw, w, &myy, &tox);
+        if(sh > 1)
+            get_sample_range(d, (int64_t)(y - job->y1) * sh + sh - 1,
+                             (int64_t)job->deltay * sh, h, &myy, &toy);
+
+        /* Skip the cell if neither its pixels nor the dithering state it
+         * starts with changed since the previous call, and if the canvas
+         * still shows its output */
+        if(job->history)
+        {
+            uint64_t key = hash_footprint(d, job->pixels, fromx, tox,
+                                          fromy - job->y0, toy - job->y0);
+
+            /* XXX: OMG HAX */
+            if(d->init_dither == init_fstein_dither)
+                key = hash_bytes(key, (uint8_t const *)remain, sizeof(remain));
+            else
+                key = hash_bytes(key, (uint8_t const *)&state->index,
+                                 sizeof(state->index));
+
+            history = job->history + (job->xmax - job->xmin + 1)
+                                      * (y - job->ymin) + (x - job->xmin);
+
+            if(job->history_valid && history->key == key
+                && (history->transparent
+                     || cell_unchanged(job, x, y, history)))
+            {
+                cells[x - job->xmin] = 0;
+
+                if(history->transparent)
+                {
+                    /* XXX: OMG HAX */
+                    if(d->init_dither == init_fstein_dither)
+                        reset_error(job, x, remain);
+                    continue;
+                }
+
+                /* XXX: OMG HAX */
+                if(d->init_dither == init_fstein_dither)
+                    diffuse_error(job, x, history->error, remain);
+
+                d->increment_dither(state);
+                continue;
+            }
+
+            history->key = key;
+            history->transparent = 0;
+        }
+
+        if(sw * sh > 1)
+        {
+            dither_subcells(job, state, x, y, remain, history, cells, attrs);
+            continue;
+        }
+
+        /* First get RGB */
+        for(myy = fromy; myy < toy; myy++)
+            d->sum_pixels(d, job->pixels, fromx, tox, myy - job->y0, rgba);
+
+        if(d->antialias)
+        {
+            /* Normalize */
+            dots = (tox - fromx) * (toy - fromy);
+            rgba[0] /= dots;
+            rgba[1] /= dots;
+            rgba[2] /= dots;
+            rgba[3] /= dots;
+        }
+
+        /* FIXME: hack to force greyscale */
+        if(d->color == COLOR_MODE_FULLGRAY)
+        {
+            uint32_t gray = (3 * rgba[0] + 4 * rgba[1] + rgba[2] + 4) / 8;
+            rgba[0] = rgba[1] = rgba[2] = gray;
+        }
+
+        if(d->has_alpha && rgba[3] < 0x800)
+        {
+            /* XXX: OMG HAX */
+            if(d->init_dither == init_fstein_dither)
+                reset_error(job, x, remain);
+            if(history)
+                history->transparent = 1;
+            cells[x - job->xmin] = 0;
+            continue;
+        }
+
+        /* XXX: OMG HAX */
+        if(d->init_dither == init_fstein_dither)
+        {
+            rgba[0] += remain[0];
+            rgba[1] += remain[1];
+            rgba[2] += remain[2];
+        }
+        else if(d->color == COLOR_MODE_TRUECOLOR)
+        {
+            /* Only move the colour by about one glyph step */
+            int step = 0x100 * (2 * dchmax - 1);
+
+            rgba[0] += (d->get_dither(state) - 0x80) * 0x111 / step;
+            rgba[1] += (d->get_dither(state) - 0x80) * 0x111 / step;
+            rgba[2] += (d->get_dither(state) - 0x80) * 0x111 / step;
+        }
+        else
+        {
+            rgba[0] += (d->get_dither(state) - 0x80) * 4;
+            rgba[1] += (d->get_dither(state) - 0x80) * 4;
+            rgba[2] += (d->get_dither(state) - 0x80) * 4;
+        }
+
+        if(d->color == COLOR_MODE_TRUECOLOR)
+        {
+            uint32_t rgb = pack_truecolor(rgba);
+
+            /* XXX: OMG HAX */
+            if(d->init_dither != init_fstein_dither)
+            {
+                /* Cells are solved all at once at the end of the line */
+                cells[x - job->xmin] = 1;
+                attrs[x - job->xmin] = rgb;
+                d->increment_dither(state);
+                continue;
+            }
+
+            ch = truecolor_cell(d, rgb, &outbg, &outfg);
+            outch = d->glyphs[ch];
+
+            /* Render the colours the way the canvas will */
+            bg_r = ((outbg >> 7) & 0xf) * 0x111;
+            bg_g = ((outbg >> 3) & 0xf) * 0x111;
+            bg_b = (outbg & 0x7) * 0x222;
+            fg_r = ((outfg >> 7) & 0xf) * 0x111;
+            fg_g = ((outfg >> 3) & 0xf) * 0x111;
+            fg_b = (outfg & 0x7) * 0x222;
+
+            error[0] = rgba[0] - (fg_r * ch + bg_r * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+            error[1] = rgba[1] - (fg_g * ch + bg_g * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+            error[2] = rgba[2] - (fg_b * ch + bg_b * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+
+            diffuse_error(job, x, error, remain);
+            if(history)
+            {
+                history->error[0] = error[0];
+                history->error[1] = error[1];
+                history->error[2] = error[2];
+            }
+
+            cells[x - job->xmin] = outch;
+            attrs[x - job->xmin] = truecolor_attr(d, outbg, outfg, job->attr);
+
+            d->increment_dither(state);
+            continue;
+        }
+
+        /* Look up the nearest colour pair */
+        lookup = d->rgb_lookup[rgb_lookup_index(rgba)];
+        outbg = lookup & 0xff;
+        outfg = lookup >> 8;
+
+        bg_r = d->palette[outbg * 3];
+        bg_g = d->palette[outbg * 3 + 1];
+        bg_b = d->palette[outbg * 3 + 2];
+
+        if(uses_two_colours(d))
+        {
+            int64_t dot, norm;
+
+            fg_r = d->palette[outfg * 3];
+            fg_g = d->palette[outfg * 3 + 1];
+            fg_b = d->palette[outfg * 3 + 2];
+
+            /* Project the colour on the background-foreground segment
+             * to find the glyph whose coverage matches it best. */
+            dot = (int64_t)((int)rgba[0] - bg_r) * (fg_r - bg_r)
+                + (int64_t)((int)rgba[1] - bg_g) * (fg_g - bg_g)
+                + (int64_t)((int)rgba[2] - bg_b) * (fg_b - bg_b);
+            norm = sq(fg_r - bg_r) + sq(fg_g - bg_g) + sq(fg_b - bg_b);
+
+            if(dot <= 0 || !norm)
+                ch = 0;
+            else
+            {
+                ch = (int)((dot * (2*dchmax-1) + norm / 2) / norm);
+                if(ch > dchmax - 2)
+                    ch = dchmax - 2;
+            }
+            outch = d->glyphs[ch];
+
+            /* XXX: OMG HAX */
+            if(d->init_dither == init_fstein_dither)
+            {
+                error[0] = rgba[0] - (fg_r * ch + bg_r * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+                error[1] = rgba[1] - (fg_g * ch + bg_g * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+                error[2] = rgba[2] - (fg_b * ch + bg_b * ((2*dchmax-1) - ch)) / (2*dchmax-1);
+            }
+        }
+        else
+        {
+            int lum = rgba[0];
+            if((int)rgba[1] > lum) lum = rgba[1];
+            if((int)rgba[2] > lum) lum = rgba[2];
+            outfg = outbg;
+            outbg = CACA_BLACK;
+
+            ch = lum * dchmax / 0x1000;
+            if(ch < 0)
+                ch = 0;
+            else if(ch > (int)(dchmax - 1))
+                ch = dchmax - 1;
+            outch = d->glyphs[ch];
+
+            /* XXX: OMG HAX */
+            if(d->init_dither == init_fstein_dither)
+            {
+                error[0] = rgba[0] - bg_r * ch / (dchmax-1);
+                error[1] = rgba[1] - bg_g * ch / (dchmax-1);
+                error[2] = rgba[2] - bg_b * ch / (dchmax-1);
+            }
+        }
+
+        /* XXX: OMG HAX */
+        if(d->init_dither == init_fstein_dither)
+        {
+            diffuse_error(job, x, error, remain);
+            if(history)
+            {
+                history->error[0] = error[0];
+                history->error[1] = error[1];
+                history->error[2] = error[2];
+            }
+        }
+
+        cells[x - job->xmin] = outch;
+        attrs[x - job->xmin] = palette_attr(d, outbg, outfg, job->attr);
+
+        d->increment_dither(state);
+    }
+
+    if(d->color == COLOR_MODE_TRUECOLOR && d->init_dither != init_fstein_dither)
+        solve_truecolor(d, job->attr, cells + xa - job->xmin,
+                        attrs + xa - job->xmin, xb - xa + 1);
+
+    state->remain_r = remain[0];
+    state->remain_g = remain[1];
+    state->remain_b = remain[2];
+}
+
+/* Print a dithered line on the canvas */
+static void put_dithered_line(caca_canvas_t *cv, struct dither_job const *job,
+                              int y, uint32_t const *cells)
+{
+    uint32_t const *attrs = cells + job->xmax - job->xmin + 1;
+    int x, start, n = job->xmax - job->xmin + 1;
+
+    /* Empty cells are left untouched, so print runs of non-empty ones */
+    for(x = 0; x < n; x++)
+    {
+        if(!cells[x])
+            continue;
+
+        for(start = x; x < n && cells[x]; x++)
+            ;
+
+        caca_put_cells(cv, job->xmin + start, y, cells + start,
+                       attrs + start, x - start);
+    }
+
+    /* Remember what the printed cells look like on the canvas, which may
+     * have fixed the halves of fullwidth characters around them */
+    if(!job->history || y >= (int)cv->height)
+        return;
+
+    for(x = 0; x < n && job->xmin + x < (int)cv->width; x++)
+    {
+        struct dither_cell *history = job->history + n * (y - job->ymin) + x;
+
+        if(!cells[x])
+            continue;
+
+        history->ch = cv->chars[y * cv->width + job->xmin + x];
+        history->attr = cv->attrs[y * cv->width + job->xmin + x];
+    }
+}
+
+#if defined(USE_THREADS)
+/* A band of lines dithered by a worker thread */
+struct dither_band
+{
+    struct dither_job const *job;
+    int ymin, ymax;
+    pthread_t thread;
+};
+
+static void *dither_band_thread(void *data)
+{
+    struct dither_band *band = data;
+
+    dither_lines(band->job, band->ymin, band->ymax, band->job->cells
+                  + band->job->stride * (band->ymin - band->job->ymin));
+
+    return NULL;
+}
+
+/* Split the job into horizontal bands and dither them in parallel. The
+ * calling thread takes care of the first band, as well as any band whose
+ * thread could not be started. */
+static int dither_lines_threaded(struct dither_job const *job, int threads)
+{
+    struct dither_band *bands;
+    int i, started, lines = job->ymax - job->ymin + 1;
+
+    bands = malloc(threads * sizeof(struct dither_band));
+    if(!bands)
+        return -1;
+
+    for(i = 0; i < threads; i++)
+    {
+        bands[i].job = job;
+        bands[i].ymin = job->ymin + lines * i / threads;
+        bands[i].ymax = job->ymin + lines * (i + 1) / threads - 1;
+    }
+
+    for(started = 1; started < threads; started++)
+        if(pthread_create(&bands[started].thread, NULL,
+                          dither_band_thread, bands + started))
+            break;
+
+    dither_band_thread(bands);
+    for(i = started; i < threads; i++)
+        dither_band_thread(bands + i);
+
+    for(i = 1; i < started; i++)
+        pthread_join(bands[i].thread, NULL);
+
+    free(bands);
+
+    return 0;
+}
+
+/* Floyd-Steinberg dithering of a line needs the error of the line above,
+ * which is final once that line is DITHER_WAVE_LAG cells ahead. Lines are
+ * handed out in order to the worker threads, and each line is dithered in
+ * chunks of DITHER_WAVE_CHUNK cells after waiting for the line above to
+ * be far enough. All lines share the same error buffer, which sees exactly
+ * the same sequence of updates as in the single-threaded case. */
+#define DITHER_WAVE_LAG 2
+#define DITHER_WAVE_CHUNK 8
+
+struct dither_wave
+{
+    struct dither_job const *job;
+    int next;
+    int *done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void *dither_wave_thread(void *data)
+{
+    struct dither_wave *wave = data;
+    struct dither_job const *job = wave->job;
+    struct dither_state state;
+    int width = job->xmax - job->xmin + 1;
+
+    state.seed = job->seed;
+
+    for(;;)
+    {
+        uint32_t *cells;
+        int y, x, xb, need, seen = 0;
+
+        pthread_mutex_lock(&wave->lock);
+        y = wave->next++;
+        pthread_mutex_unlock(&wave->lock);
+
+        if(y > job->ymax)
+            break;
+
+        cells = job->cells + job->stride * (y - job->ymin);
+        job->d->init_dither(&state, y);
+
+        for(x = job->xmin; x <= job->xmax; x = xb + 1)
+        {
+            xb = x + DITHER_WAVE_CHUNK - 1;
+            if(xb > job->xmax)
+                xb = job->xmax;
+
+            /* Wait for the line above to be far enough */
+            need = xb + DITHER_WAVE_LAG < job->xmax
+                    ? xb + DITHER_WAVE_LAG - job->xmin + 1 : width;
+
+            if(y > job->ymin && seen < need)
+            {
+                pthread_mutex_lock(&wave->lock);
+                while(wave->done[y - 1 - job->ymin] < need)
+                    pthread_cond_wait(&wave->cond, &wave->lock);
+                seen = wave->done[y - 1 - job->ymin];
+                pthread_mutex_unlock(&wave->lock);
+            }
+
+            dither_line(job, &state, y, x, xb, cells);
+
+            pthread_mutex_lock(&wave->lock);
+            wave->done[y - job->ymin] = xb - job->xmin + 1;
+            pthread_cond_broadcast(&wave->cond);
+            pthread_mutex_unlock(&wave->lock);
+        }
+    }
+
+    return NULL;
+}
+
+/* Dither the job's lines as a wavefront. The calling thread is one of
+ * the workers, so the job completes even if no thread could be started. */
+static int dither_lines_wavefront(struct dither_job const *job, int threads)
+{
+    struct dither_wave wave;
+    pthread_t *tids;
+    int i, started, lines = job->ymax - job->ymin + 1;
+
+    tids = malloc(threads * sizeof(pthread_t));
+    wave.done = calloc(lines, sizeof(int));
+    if(!tids || !wave.done)
+    {
+        free(tids);
+        free(wave.done);
+        return -1;
+    }
+
+    if(pthread_mutex_init(&wave.lock, NULL))
+    {
+        free(tids);
+        free(wave.done);
+        return -1;
+    }
+
+    if(pthread_cond_init(&wave.cond, NULL))
+    {
+        pthread_mutex_destroy(&wave.lock);
+        free(tids);
+        free(wave.done);
+        return -1;
+    }
+
+    wave.job = job;
+    wave.next = job->ymin;
+
+    for(started = 1; started < threads; started++)
+        if(pthread_create(&tids[started], NULL, dither_wave_thread, &wave))
+            break;
+
+    dither_wave_thread(&wave);
+
+    for(i = 1; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    pthread_cond_destroy(&wave.cond);
+    pthread_mutex_destroy(&wave.lock);
+    free(tids);
+    free(wave.done);
+
+    return 0;
+}
+#endif
+
+/*
+ * No dithering
+ */
+static void init_no_dither(struct dither_state *s, int line)
+{
+    ;
+}
+
+static int get_no_dither(struct dither_state *s)
+{
+    return 0x80;
+}
+
+static void increment_no_dither(struct dither_state *s)
+{
+    return;
+}
+
+/*
+ * Floyd-Steinberg dithering
+ */
+static void init_fstein_dither(struct dither_state *s, int line)
+{
+    s->remain_r = s->remain_g = s->remain_b = 0;
+}
+
+static int get_fstein_dither(struct dither_state *s)
+{
+    return 0x80;
+}
+
+static void increment_fstein_dither(struct dither_state *s)
+{
+    return;
+}
+
+/*
+ * Ordered 2 dithering
+ */
+static void init_ordered2_dither(struct dither_state *s, int line)
+{
+    static int const dither2x2[] =
+    {
+        0x00, 0x80,
+        0xc0, 0x40,
+    };
+
+    s->table = dither2x2 + (line % 2) * 2;
+    s->index = 0;
+}
+
+static int get_ordered2_dither(struct dither_state *s)
+{
+    return s->table[s->index];
+}
+
+static void increment_ordered2_dither(struct dither_state *s)
+{
+    s->index = (s->index + 1) % 2;
+}
+
+/*
+ * Ordered 4 dithering
+ */
+/*static int dither4x4[] = { 5,  0,  1,  6,
+                          -1, -6, -5,  2,
+                          -2, -7, -8,  3,
+                           4, -3, -4, -7};*/
+static void init_ordered4_dither(struct dither_state *s, int line)
+{
+    static int const dither4x4[] =
+    {
+        0x00, 0x80, 0x20, 0xa0,
+        0xc0, 0x40, 0xe0, 0x60,
+        0x30, 0xb0, 0x10, 0x90,
+        0xf0, 0x70, 0xd0, 0x50
+    };
+
+    s->table = dither4x4 + (line % 4) * 4;
+    s->index = 0;
+}
+
+static int get_ordered4_dither(struct dither_state *s)
+{
+    return s->table[s->index];
+}
+
+static void increment_ordered4_dither(struct dither_state *s)
+{
+    s->index = (s->index + 1) % 4;
+}
+
+/*
+ * Ordered 8 dithering
+ */
+static void init_ordered8_dither(struct dither_state *s, int line)
+{
+    static int const dither8x8[] =
+    {
+        0x00, 0x80, 0x20, 0xa0, 0x08, 0x88, 0x28, 0xa8,
+        0xc0, 0x40, 0xe0, 0x60, 0xc8, 0x48, 0xe8, 0x68,
+        0x30, 0xb0, 0x10, 0x90, 0x38, 0xb8, 0x18, 0x98,
+        0xf0, 0x70, 0xd0, 0x50, 0xf8, 0x78, 0xd8, 0x58,
+        0x0c, 0x8c, 0x2c, 0xac, 0x04, 0x84, 0x24, 0xa4,
+        0xcc, 0x4c, 0xec, 0x6c, 0xc4, 0x44, 0xe4, 0x64,
+        0x3c, 0xbc, 0x1c, 0x9c, 0x34, 0xb4, 0x14, 0x94,
+        0xfc, 0x7c, 0xdc, 0x5c, 0xf4, 0x74, 0xd4, 0x54,
+    };
+
+    s->table = dither8x8 + (line % 8) * 8;
+    s->index = 0;
+}
+
+static int get_ordered8_dither(struct dither_state *s)
+{
+    return s->table[s->index];
+}
+
+static void increment_ordered8_dither(struct dither_state *s)
+{
+    s->index = (s->index + 1) % 8;
+}
+
+/*
+ * Random dithering. Values are a hash of the call seed and of the cell
+ * position rather than the output of a global generator, so that the
+ * result does not depend on the order in which cells are visited.
+ */
+static void init_random_dither(struct dither_state *s, int line)
+{
+    s->line = line;
+    s->index = 0;
+    s->count = 0;
+}
+
+static int get_random_dither(struct dither_state *s)
+{
+    uint32_t x = s->seed;
+
+    x ^= (uint32_t)s->line * 0x9e3779b1;
+    x ^= (uint32_t)s->index * 0x85ebca6b;
+    x ^= (uint32_t)s->count++ * 0xc2b2ae35;
+
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+
+    return x >> 24;
+}
+
+static void increment_random_dither(struct dither_state *s)
+{
+    s->index++;
+    s->count = 0;
+}
+
+/* Fill the quantised RGB lookup table. Each entry stores the background
+ * colour in its lower eight bits and the foreground colour in its upper
+ * eight bits. With a perceptual distance, the palette and each of the
+ * 12-bit table colours are converted to OKLab once, here, so that the
+ * dithering itself never leaves RGB space. */
+static void init_rgb_lookup(caca_dither_t *d)
+{
+    float pal_lab[256 * 3], lab[3];
+    int r, g, b, i;
+
+    if(d->perceptual)
+        for(i = 0; i < d->palette_size; i++)
+            rgb2oklab(d->palette + i * 3, pal_lab + i * 3);
+
+    for(r = 0; r <= RGB_LOOKUP_MAX; r++)
+        for(g = 0; g <= RGB_LOOKUP_MAX; g++)
+            for(b = 0; b <= RGB_LOOKUP_MAX; b++)
+    {
+        int rgb[3], outbg, outfg;
+
+        rgb[0] = 0xfff * r / RGB_LOOKUP_MAX;
+        rgb[1] = 0xfff * g / RGB_LOOKUP_MAX;
+        rgb[2] = 0xfff * b / RGB_LOOKUP_MAX;
+
+        if(d->perceptual)
+        {
+            rgb2oklab(rgb, lab);
+            find_nearest_colors(d, rgb, lab, pal_lab, &outbg, &outfg);
+        }
+        else
+            find_nearest_colors(d, rgb, NULL, NULL, &outbg, &outfg);
+
+        d->rgb_lookup[(((r << RGB_LOOKUP_BITS) | g) << RGB_LOOKUP_BITS) | b]
+            = (outfg << 8) | outbg;
+    }
+}
+
+/* Cube root for the OKLab conversion: an exponent trick for the initial
+ * guess, then Newton's method. */
+static float cuberoot(float x)
+{
+    union { float f; uint32_t i; } u;
+    int n;
+
+    if(x <= 0.f)
+        return 0.f;
+
+    u.f = x;
+    u.i = u.i / 3 + 0x2a514067;
+
+    for(n = 0; n < 3; n++)
+        u.f = (2.f * u.f + x / (u.f * u.f)) / 3.f;
+
+    return u.f;
+}
+
+/* Convert a 12-bit sRGB colour to OKLab, as described by Björn Ottosson
+ * in "A perceptual color space for image processing". */
+static void rgb2oklab(int const *rgb, float *lab)
+{
+    float c[3], l, m, s;
+    int i;
+
+    for(i = 0; i < 3; i++)
+    {
+        float v = (float)rgb[i] / 0xfff;
+
+        if(v <= 0.f)
+            c[i] = 0.f;
+        else if(v <= 0.04045f)
+            c[i] = v / 12.92f;
+        else
+            c[i] = gammapow((v + 0.055f) / 1.055f, 2.4f);
+    }
+
+    l = cuberoot(0.4122214708f * c[0] + 0.5363325363f * c[1]
+                  + 0.0514459929f * c[2]);
+    m = cuberoot(0.2119034982f * c[0] + 0.6806995451f * c[1]
+                  + 0.1073969566f * c[2]);
+    s = cuberoot(0.0883024619f * c[0] + 0.2817188376f * c[1]
+                  + 0.6299787005f * c[2]);
+
+    lab[0] = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+    lab[1] = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+    lab[2] = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+}
+
+/* Distance between a colour and palette entry i, multiplied by the
+ * entry's weight. OKLab distances are scaled so that they keep some
+ * precision once converted to integers. */
+static int64_t colour_distance(caca_dither_t const *d, int const *rgb,
+                               float const *lab, float const *pal_lab, int i)
+{
+    int const *pal = d->palette + i * 3;
+
+    if(lab)
+    {
+        float const *p = pal_lab + i * 3;
+        float dist = (lab[0] - p[0]) * (lab[0] - p[0])
+                   + (lab[1] - p[1]) * (lab[1] - p[1])
+                   + (lab[2] - p[2]) * (lab[2] - p[2]);
+
+        return (int64_t)(dist * 16777216.f) * d->palette_weight[i];
+    }
+
+    return (int64_t)(sq(rgb[0] - pal[0]) + sq(rgb[1] - pal[1])
+                      + sq(rgb[2] - pal[2])) * d->palette_weight[i];
+}
+
+/* Find the background and foreground colours that best match a given RGB
+ * value for the current colour mode. If lab is not NULL, distances are
+ * measured between lab and the OKLab palette colours in pal_lab. */
+static void find_nearest_colors(caca_dither_t const *d, int const *rgb,
+                                float const *lab, float const *pal_lab,
+                                int *outbg, int *outfg)
+{
+    int const *pal = d->palette;
+    int64_t dist, distmin;
+    int i, bg = 0, fg = 0;
+
+    distmin = INT64_MAX;
+    for(i = 0; i < d->palette_size; i++)
+    {
+        if(d->color == COLOR_MODE_FULLGRAY
+            && (pal[i * 3] != pal[i * 3 + 1] || pal[i * 3] != pal[i * 3 + 2]))
+            continue;
+        dist = colour_distance(d, rgb, lab, pal_lab, i);
+        if(dist < distmin)
+        {
+            bg = i;
+            distmin = dist;
+        }
+    }
+
+    if(uses_two_colours(d))
+    {
+        distmin = INT64_MAX;
+        for(i = 0; i < d->palette_size; i++)
+        {
+            if(i == bg)
+                continue;
+            if(d->color == COLOR_MODE_FULLGRAY
+                && (pal[i * 3] != pal[i * 3 + 1]
+                     || pal[i * 3] != pal[i * 3 + 2]))
+                continue;
+            dist = colour_distance(d, rgb, lab, pal_lab, i);
+            if(dist < distmin)
+            {
+                fg = i;
+                distmin = dist;
+            }
+        }
+    }
+
+    *outbg = bg;
+    *outfg = fg;
+}
+
+/* Whether cells get a background colour of their own rather than black */
+static int uses_two_colours(caca_dither_t const *d)
+{
+    /* FIXME: we currently only honour "full16" */
+    return d->custom_palette || d->color == COLOR_MODE_FULL16
+            || d->color == COLOR_MODE_FULLGRAY;
+}
+
+/* Attribute for a pair of output palette colours */
+static uint32_t palette_attr(caca_dither_t const *d, int bg, int fg,
+                             uint32_t attr)
+{
+    if(d->custom_palette)
+    {
+        int const *attrs = d->custom_palette + 4 * d->palette_size;
+
+        return truecolor_attr(d, attrs[bg], attrs[fg], attr);
+    }
+
+    if(d->invert)
+    {
+        bg = 15 - bg;
+        fg = 15 - fg;
+    }
+
+    /* Same attribute as caca_set_color_ansi() would set */
+    return ((uint32_t)(bg | 0x40) << 18) | ((uint32_t)(fg | 0x40) << 4) | attr;
+}
+
+/* Prepare the glyph index computation of truecolor_cell(). Glyph ch
+ * covers ch / (2 * dchmax - 1) of the cell, like in the ANSI modes, and
+ * a coverage of 0xc00 is the whole cell. */
+static void init_truecolor_glyphs(caca_dither_t *d)
+{
+    int steps = 2 * d->glyph_count - 1, shift = 0;
+
+    while((((uint64_t)steps << (17 + shift)) + 0xbff) / 0xc00 <= 0xffff)
+        shift++;
+
+    d->glyph_bias = 0x600 / steps;
+    d->glyph_mul = (((uint64_t)steps << (16 + shift)) + 0xbff) / 0xc00;
+    d->glyph_shift = 16 + shift;
+}
+
+/* Pack a 12-bit RGB colour with 10 bits per channel */
+static uint32_t pack_truecolor(uint32_t const *rgba)
+{
+    uint32_t rgb = 0;
+    int i;
+
+    for(i = 0; i < 3; i++)
+    {
+        int v = (int)rgba[i];
+
+        v = v < 0 ? 0 : v > 0xfff ? 0xfff : v;
+        rgb = (rgb << 10) | (v >> 2);
+    }
+
+    return rgb;
+}
+
+/* Find the two colours surrounding a packed colour and the glyph that
+ * mixes them best. Colours have 4 bits of red and green and 3 bits of
+ * blue, which is what canvas attributes store. solve_truecolor() must
+ * give the same results. */
+static int truecolor_cell(caca_dither_t const *d, uint32_t rgb,
+                          int *outbg, int *outfg)
+{
+    int r = (rgb >> 20) & 0x3ff, g = (rgb >> 10) & 0x3ff, b = rgb & 0x3ff;
+    int lo, hi, coverage, ch;
+
+    /* Scale to 16 levels with 10 bits of fraction */
+    r = (r + (r >> 9)) * 15;
+    g = (g + (g >> 9)) * 15;
+    b = (b + (b >> 9)) * 15;
+
+    lo = ((r >> 10) << 7) | ((g >> 10) << 3) | (b >> 11);
+    hi = lo + ((r >> 10) < 15 ? 0x80 : 0) + ((g >> 10) < 15 ? 0x8 : 0)
+            + ((b >> 11) < 7 ? 0x1 : 0);
+    coverage = (r & 0x3ff) + (g & 0x3ff)
+                + ((b >> 11) < 7 ? (b & 0x7ff) >> 1 : 0);
+
+    /* Glyphs cover at most half of the cell, so use the upper colour as
+     * the background when it is the closest one */
+    if(coverage > 0x600)
+    {
+        *outbg = hi;
+        *outfg = lo;
+        coverage = 0xc00 - coverage;
+    }
+    else
+    {
+        *outbg = lo;
+        *outfg = hi;
     }
 
-    /* Compute -y*ln(x) */
-    tmp = - y * 2.0 * tmp;
+    ch = ((uint32_t)(coverage + d->glyph_bias) * d->glyph_mul)
+            >> d->glyph_shift;
 
-    /* Compute x^-y as e^t where t = -y*ln(x):
-     *   e^t = 1 + t/1! + t^2/2! + t^3/3! + t^4/4! + t^5/5! ...
-     * The convergence is quite faster here, thanks to the factorial. */
-    r = t = tmp;
-    tmp = 1.0 + t;
-    for(i = 2; i < 16; i++)
+    return ch < d->glyph_count - 2 ? ch : d->glyph_count - 2;
+}
+
+/* Same attribute as caca_set_color_argb() would set for opaque colours */
+static uint32_t truecolor_attr(caca_dither_t const *d, int bg, int fg,
+                               uint32_t attr)
+{
+    if(d->invert)
     {
-        r = r * t / i;
-        tmp += r;
+        bg ^= 0x7ff;
+        fg ^= 0x7ff;
     }
 
-    /* Return x^y as 1/(x^-y) */
-    return 1.0 / tmp;
+    return ((uint32_t)(bg | 0x3800) << 18) | ((uint32_t)(fg | 0x3800) << 4)
+            | attr;
+}
+
+/* Turn n packed colours into attributes and glyphs, skipping cells whose
+ * character is zero. The SSE2 version runs truecolor_cell() on eight
+ * cells at once. */
+static void solve_truecolor(caca_dither_t const *d, uint32_t attr,
+                            uint32_t *cells, uint32_t *attrs, int n)
+{
+    int i = 0, ch, bg, fg;
+
+#if defined __SSE2__ && !defined __KERNEL__
+    __m128i const k10 = _mm_set1_epi32(0x3ff);
+    __m128i const k15 = _mm_set1_epi16(15);
+    __m128i const k7 = _mm_set1_epi16(7);
+    __m128i const kfrac = _mm_set1_epi16(0x3ff);
+    __m128i const khalf = _mm_set1_epi16(0x600);
+    __m128i const kfull = _mm_set1_epi16(0xc00);
+    __m128i const kalpha = _mm_set1_epi16(0x3800);
+    __m128i const kinvert = _mm_set1_epi16(d->invert ? 0x7ff : 0);
+    __m128i const kbias = _mm_set1_epi16(d->glyph_bias);
+    __m128i const kmul = _mm_set1_epi16((short)d->glyph_mul);
+    __m128i const kshift = _mm_cvtsi32_si128(d->glyph_shift - 16);
+    __m128i const kmax = _mm_set1_epi16(d->glyph_count - 2);
+    __m128i const kattr = _mm_set1_epi32(attr);
+    __m128i const zero = _mm_setzero_si128();
+
+    for( ; i + 8 <= n; i += 8)
+    {
+        uint16_t chars[8];
+        __m128i a0 = _mm_loadu_si128((__m128i const *)(attrs + i));
+        __m128i a1 = _mm_loadu_si128((__m128i const *)(attrs + i + 4));
+        __m128i r, g, b, rl, gl, bl, lo, hi, coverage, swap, vch;
+        int k;
+
+        r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 20), k10),
+                            _mm_and_si128(_mm_srli_epi32(a1, 20), k10));
+        g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 10), k10),
+                            _mm_and_si128(_mm_srli_epi32(a1, 10), k10));
+        b = _mm_packs_epi32(_mm_and_si128(a0, k10), _mm_and_si128(a1, k10));
+
+        r = _mm_mullo_epi16(_mm_add_epi16(r, _mm_srli_epi16(r, 9)), k15);
+        g = _mm_mullo_epi16(_mm_add_epi16(g, _mm_srli_epi16(g, 9)), k15);
+        b = _mm_mullo_epi16(_mm_add_epi16(b, _mm_srli_epi16(b, 9)), k15);
+
+        rl = _mm_srli_epi16(r, 10);
+        gl = _mm_srli_epi16(g, 10);
+        bl = _mm_srli_epi16(b, 11);
+        lo = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(rl, 7),
+                                       _mm_slli_epi16(gl, 3)), bl);
+
+        /* Masks of the channels whose level can still go up */
+        rl = _mm_cmplt_epi16(rl, k15);
+        gl = _mm_cmplt_epi16(gl, k15);
+        bl = _mm_cmplt_epi16(bl, k7);
+        hi = _mm_add_epi16(lo, _mm_or_si128(_mm_or_si128(
+                 _mm_and_si128(rl, _mm_set1_epi16(0x80)),
+                 _mm_and_si128(gl, _mm_set1_epi16(0x8))),
+                 _mm_and_si128(bl, _mm_set1_epi16(0x1))));
+
+        coverage = _mm_add_epi16(
+            _mm_add_epi16(_mm_and_si128(r, kfrac), _mm_and_si128(g, kfrac)),
+            _mm_and_si128(bl, _mm_srli_epi16(_mm_slli_epi16(b, 5), 6)));
+
+        swap = _mm_cmpgt_epi16(coverage, khalf);
+        coverage = _mm_or_si128(
+            _mm_and_si128(swap, _mm_sub_epi16(kfull, coverage)),
+            _mm_andnot_si128(swap, coverage));
+        a0 = _mm_or_si128(_mm_and_si128(swap, hi), _mm_andnot_si128(swap, lo));
+        a1 = _mm_or_si128(_mm_and_si128(swap, lo), _mm_andnot_si128(swap, hi));
+        a0 = _mm_or_si128(_mm_xor_si128(a0, kinvert), kalpha);
+        a1 = _mm_or_si128(_mm_xor_si128(a1, kinvert), kalpha);
+
+        vch = _mm_mulhi_epu16(_mm_add_epi16(coverage, kbias), kmul);
+        vch = _mm_min_epi16(_mm_srl_epi16(vch, kshift), kmax);
+        _mm_storeu_si128((__m128i *)chars, vch);
+
+        _mm_storeu_si128((__m128i *)(attrs + i), _mm_or_si128(_mm_or_si128(
+            _mm_slli_epi32(_mm_unpacklo_epi16(a0, zero), 18),
+            _mm_slli_epi32(_mm_unpacklo_epi16(a1, zero), 4)), kattr));
+        _mm_storeu_si128((__m128i *)(attrs + i + 4), _mm_or_si128(_mm_or_si128(
+            _mm_slli_epi32(_mm_unpackhi_epi16(a0, zero), 18),
+            _mm_slli_epi32(_mm_unpackhi_epi16(a1, zero), 4)), kattr));
+
+        for(k = 0; k < 8; k++)
+            if(cells[i + k])
+                cells[i + k] = d->glyphs[chars[k]];
+    }
 #endif
+
+    for( ; i < n; i++)
+    {
+        if(!cells[i])
+            continue;
+
+        ch = truecolor_cell(d, attrs[i], &bg, &fg);
+        cells[i] = d->glyphs[ch];
+        attrs[i] = truecolor_attr(d, bg, fg, attr);
+    }
 }
 
-static void get_rgba_default(caca_dither_t const *d, uint8_t const *pixels,
-                             int x, int y, unsigned int *rgba)
+/* Fill the pattern to glyph table of a sub-cell character set */
+static void init_subcell_glyphs(caca_dither_t *d, int w, int h)
 {
-    uint32_t bits;
+    /* Braille dot bits for each sub-cell, line by line */
+    static uint8_t const braille_dots[] =
+    {
+        0x01, 0x08, 0x02, 0x10, 0x04, 0x20, 0x40, 0x80
+    };
 
-    pixels += (d->bpp / 8) * x + d->pitch * y;
+    int i, j;
 
-    switch(d->bpp / 8)
+    d->subcell_w = w;
+    d->subcell_h = h;
+    d->glyphs = d->subcell_glyphs;
+    d->glyph_count = 1 << (w * h);
+
+    for(i = 0; i < d->glyph_count; i++)
     {
-        case 4:
-            bits = *(uint32_t const *)pixels;
-            break;
-        case 3:
+        uint32_t ch = 0;
+
+        if(h == 2)
+            ch = quadrants_glyphs[i];
+        else if(h == 3)
         {
-#if defined(HAVE_ENDIAN_H)
-            if(__BYTE_ORDER == __BIG_ENDIAN)
-#else
-            /* This is compile-time optimised with at least -O1 or -Os */
-            uint32_t const tmp = 0x12345678;
-            if(*(uint8_t const *)&tmp == 0x12)
-#endif
-                bits = ((uint32_t)pixels[0] << 16) |
-                       ((uint32_t)pixels[1] << 8) |
-                       ((uint32_t)pixels[2]);
+            /* Sextants skip the patterns that already exist in the
+             * block elements range */
+            if(i == 0)
+                ch = ' ';
+            else if(i == 0x15)
+                ch = 0x258c; /* '▌' */
+            else if(i == 0x2a)
+                ch = 0x2590; /* '▐' */
+            else if(i == 0x3f)
+                ch = 0x2588; /* '█' */
             else
-                bits = ((uint32_t)pixels[2] << 16) |
-                       ((uint32_t)pixels[1] << 8) |
-                       ((uint32_t)pixels[0]);
-            break;
+                ch = 0x1fb00 + i - 1 - (i > 0x15) - (i > 0x2a);
         }
-        case 2:
-            bits = *(uint16_t const *)pixels;
-            break;
-        case 1:
-        default:
-            bits = pixels[0];
-            break;
+        else
+        {
+            for(j = 0; j < 8; j++)
+                if(i & (1 << j))
+                    ch |= braille_dots[j];
+            ch = ch ? 0x2800 + ch : ' ';
+        }
+
+        d->subcell_glyphs[i] = ch;
     }
+}
 
-    if(d->has_palette)
+/* Find the output colour nearest to a 12-bit RGB colour. In truecolor
+ * mode it has 4 bits of red and green and 3 bits of blue, otherwise it
+ * is an output palette index. The rendered colour is stored in rgb. */
+static int nearest_subcell_color(caca_dither_t const *d, int *rgb)
+{
+    int i, ret;
+
+    if(d->color == COLOR_MODE_TRUECOLOR)
     {
-        rgba[0] += d->gammatab[d->red[bits]];
-        rgba[1] += d->gammatab[d->green[bits]];
-        rgba[2] += d->gammatab[d->blue[bits]];
-        rgba[3] += d->alpha[bits];
+        int c[3];
+
+        for(i = 0; i < 3; i++)
+        {
+            int max = i < 2 ? 15 : 7;
+            c[i] = (rgb[i] * max + 0x7ff) / 0xfff;
+            c[i] = c[i] < 0 ? 0 : c[i] > max ? max : c[i];
+        }
+
+        rgb[0] = c[0] * 0x111;
+        rgb[1] = c[1] * 0x111;
+        rgb[2] = c[2] * 0x222;
+
+        return (c[0] << 7) | (c[1] << 3) | c[2];
     }
     else
     {
-        rgba[0] += d->gammatab[((bits & d->rmask) >> d->rright) << d->rleft];
-        rgba[1] += d->gammatab[((bits & d->gmask) >> d->gright) << d->gleft];
-        rgba[2] += d->gammatab[((bits & d->bmask) >> d->bright) << d->bleft];
-        rgba[3] += ((bits & d->amask) >> d->aright) << d->aleft;
+        uint32_t rgba[3];
+
+        rgba[0] = rgb[0];
+        rgba[1] = rgb[1];
+        rgba[2] = rgb[2];
+        ret = d->rgb_lookup[rgb_lookup_index(rgba)] & 0xff;
+
+        rgb[0] = d->palette[ret * 3];
+        rgb[1] = d->palette[ret * 3 + 1];
+        rgb[2] = d->palette[ret * 3 + 2];
+
+        return ret;
     }
 }
 
-/*
- * No dithering
- */
-static void init_no_dither(int line)
+/* Dither a cell with a sub-cell character set: split the sub-cells in
+ * two groups along the channel where they differ most, and draw the
+ * brighter group with the foreground colour. */
+static void dither_subcells(struct dither_job const *job,
+                            struct dither_state *state, int x, int y,
+                            int *remain, struct dither_cell *history,
+                            uint32_t *cells, uint32_t *attrs)
 {
-    ;
-}
+    caca_dither_t const *d = job->d;
+    int sw = d->subcell_w, sh = d->subcell_h, n = sw * sh;
+    int samples[16][3], mean[2][3], count[2], cell[3], out[2], error[3];
+    struct glyph_shape const *shape = NULL;
+    int i, c, sx, sy, best = 0, range = -1, threshold = 0;
+    unsigned int pattern = 0;
+    uint32_t alpha = 0;
+
+    for(sy = 0; sy < sh; sy++)
+    {
+        int fromy, toy, myy;
 
-static int get_no_dither(void)
-{
-    return 0x80;
-}
+        get_sample_range(d, (int64_t)(y - job->y1) * sh + sy,
+                         (int64_t)job->deltay * sh, d->h, &fromy, &toy);
 
-static void increment_no_dither(void)
-{
-    return;
-}
+        for(sx = 0; sx < sw; sx++)
+        {
+            uint32_t rgba[4];
+            int fromx, tox, dots;
 
-/*
- * Floyd-Steinberg dithering
- */
-static void init_fstein_dither(int line)
-{
-    ;
-}
+            get_sample_range(d, (int64_t)(x - job->x1) * sw + sx,
+                             (int64_t)job->deltax * sw, d->w, &fromx, &tox);
 
-static int get_fstein_dither(void)
-{
-    return 0x80;
-}
+            rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+            for(myy = fromy; myy < toy; myy++)
+                d->sum_pixels(d, job->pixels, fromx, tox, myy - job->y0,
+                              rgba);
 
-static void increment_fstein_dither(void)
-{
-    return;
-}
+            dots = (tox - fromx) * (toy - fromy);
+            for(c = 0; c < 3; c++)
+                samples[sy * sw + sx][c] = rgba[c] / dots;
+            alpha += rgba[3] / dots;
+        }
+    }
 
-/*
- * Ordered 2 dithering
- */
-static int const *ordered2_table;
-static int ordered2_index;
+    if(d->has_alpha && alpha < 0x800 * (uint32_t)n)
+    {
+        /* XXX: OMG HAX */
+        if(d->init_dither == init_fstein_dither)
+            reset_error(job, x, remain);
+        if(history)
+            history->transparent = 1;
+        cells[x - job->xmin] = 0;
+        return;
+    }
 
-static void init_ordered2_dither(int line)
-{
-    static int const dither2x2[] =
+    /* Pick the channel with the widest range and split it in the middle */
+    for(c = 0; c < 3; c++)
     {
-        0x00, 0x80,
-        0xc0, 0x40,
-    };
+        int min = 0xfff, max = 0;
 
-    ordered2_table = dither2x2 + (line % 2) * 2;
-    ordered2_index = 0;
-}
+        for(i = 0; i < n; i++)
+        {
+            if(samples[i][c] < min) min = samples[i][c];
+            if(samples[i][c] > max) max = samples[i][c];
+        }
 
-static int get_ordered2_dither(void)
-{
-    return ordered2_table[ordered2_index];
-}
+        if(max - min > range)
+        {
+            best = c;
+            range = max - min;
+            threshold = (min + max) / 2;
+        }
+    }
 
-static void increment_ordered2_dither(void)
-{
-    ordered2_index = (ordered2_index + 1) % 2;
-}
+    memset(mean, 0, sizeof(mean));
+    count[0] = count[1] = 0;
+    for(i = 0; i < n; i++)
+    {
+        int on = range > 0 && samples[i][best] > threshold;
 
-/*
- * Ordered 4 dithering
- */
-/*static int dither4x4[] = { 5,  0,  1,  6,
-                          -1, -6, -5,  2,
-                          -2, -7, -8,  3,
-                           4, -3, -4, -7};*/
-static int const *ordered4_table;
-static int ordered4_index;
+        pattern |= on << i;
+        count[on]++;
+        for(c = 0; c < 3; c++)
+            mean[on][c] += samples[i][c];
+    }
 
-static void init_ordered4_dither(int line)
-{
-    static int const dither4x4[] =
+    if(d->use_shapes)
+        shape = match_glyph_shape(d, (int const (*)[3])samples, mean, count);
+
+    for(c = 0; c < 3; c++)
     {
-        0x00, 0x80, 0x20, 0xa0,
-        0xc0, 0x40, 0xe0, 0x60,
-        0x30, 0xb0, 0x10, 0x90,
-        0xf0, 0x70, 0xd0, 0x50
-    };
+        int noise = 0;
 
-    ordered4_table = dither4x4 + (line % 4) * 4;
-    ordered4_index = 0;
-}
+        cell[c] = (mean[0][c] + mean[1][c]) / n;
 
-static int get_ordered4_dither(void)
-{
-    return ordered4_table[ordered4_index];
-}
+        /* XXX: OMG HAX */
+        if(d->init_dither == init_fstein_dither)
+            noise = remain[c];
+        else if(d->color == COLOR_MODE_TRUECOLOR)
+            noise = (d->get_dither(state) - 0x80) * 0x111 / 0x100;
+        else
+            noise = (d->get_dither(state) - 0x80) * 4;
 
-static void increment_ordered4_dither(void)
-{
-    ordered4_index = (ordered4_index + 1) % 4;
-}
+        cell[c] += noise;
+        mean[0][c] = count[0] ? mean[0][c] / count[0] + noise : cell[c];
+        mean[1][c] = count[1] ? mean[1][c] / count[1] + noise : cell[c];
+    }
 
-/*
- * Ordered 8 dithering
- */
-static int const *ordered8_table;
-static int ordered8_index;
+    out[0] = uses_two_colours(d) || d->color == COLOR_MODE_TRUECOLOR
+             ? nearest_subcell_color(d, mean[0]) : CACA_BLACK;
+    if(out[0] == CACA_BLACK && !uses_two_colours(d)
+        && d->color != COLOR_MODE_TRUECOLOR)
+        mean[0][0] = mean[0][1] = mean[0][2] = 0;
+    out[1] = nearest_subcell_color(d, mean[1]);
 
-static void init_ordered8_dither(int line)
-{
-    static int const dither8x8[] =
+    /* Both groups got the same colour, the pattern does not matter */
+    if(out[0] == out[1])
     {
-        0x00, 0x80, 0x20, 0xa0, 0x08, 0x88, 0x28, 0xa8,
-        0xc0, 0x40, 0xe0, 0x60, 0xc8, 0x48, 0xe8, 0x68,
-        0x30, 0xb0, 0x10, 0x90, 0x38, 0xb8, 0x18, 0x98,
-        0xf0, 0x70, 0xd0, 0x50, 0xf8, 0x78, 0xd8, 0x58,
-        0x0c, 0x8c, 0x2c, 0xac, 0x04, 0x84, 0x24, 0xa4,
-        0xcc, 0x4c, 0xec, 0x6c, 0xc4, 0x44, 0xe4, 0x64,
-        0x3c, 0xbc, 0x1c, 0x9c, 0x34, 0xb4, 0x14, 0x94,
-        0xfc, 0x7c, 0xdc, 0x5c, 0xf4, 0x74, 0xd4, 0x54,
-    };
+        pattern = 0;
+        if(shape)
+            shape = d->shapes;
+    }
 
-    ordered8_table = dither8x8 + (line % 8) * 8;
-    ordered8_index = 0;
-}
+    /* XXX: OMG HAX */
+    if(d->init_dither == init_fstein_dither)
+    {
+        for(c = 0; c < 3; c++)
+            if(shape)
+                error[c] = cell[c] - (mean[0][c] * (0xff - shape->mean)
+                                       + mean[1][c] * shape->mean) / 0xff;
+            else
+                error[c] = cell[c] - (mean[0][c] * count[0]
+                                       + mean[1][c] * count[1]) / n;
 
-static int get_ordered8_dither(void)
-{
-    return ordered8_table[ordered8_index];
-}
+        diffuse_error(job, x, error, remain);
+        if(history)
+        {
+            history->error[0] = error[0];
+            history->error[1] = error[1];
+            history->error[2] = error[2];
+        }
+    }
 
-static void increment_ordered8_dither(void)
-{
-    ordered8_index = (ordered8_index + 1) % 8;
-}
+    cells[x - job->xmin] = shape ? shape->ch : d->glyphs[pattern];
 
-/*
- * Random dithering
- */
-static void init_random_dither(int line)
-{
-    ;
-}
+    if(d->color == COLOR_MODE_TRUECOLOR)
+        attrs[x - job->xmin] = truecolor_attr(d, out[0], out[1], job->attr);
+    else
+        attrs[x - job->xmin] = palette_attr(d, out[0], out[1], job->attr);
 
-static int get_random_dither(void)
-{
-    return caca_rand(0x00, 0x100);
+    d->increment_dither(state);
 }
 
-static void increment_random_dither(void)
+/* Render the ASCII characters and block elements of a glyph index's
+ * built-in font, and store the coverage of each 4x4th of their cell.
+ * Glyphs with the same coverage as a previous one are dropped. The space
+ * character comes first. */
+static int init_glyph_shapes(struct glyph_index *index)
 {
-    return;
-}
+    struct glyph_shape *shapes;
+    caca_font_t *f;
+    caca_canvas_t *cv;
+    uint32_t const *blocks;
+    uint8_t *buf;
+    uint32_t ch;
+    int i, j, k, n = 0, fw, fh;
+
+    f = caca_load_font(index->font, 0);
+    if(!f)
+    {
+        seterrno(ENOMEM);
+        return -1;
+    }
 
-/*
- * Lookup tables
- */
-static int init_lookup(void)
-{
-    int v, s, h;
-
-    /* These ones are constant */
-    lookup_colors[0] = CACA_BLACK;
-    lookup_colors[1] = CACA_DARKGRAY;
-    lookup_colors[2] = CACA_LIGHTGRAY;
-    lookup_colors[3] = CACA_WHITE;
-
-    /* These ones will be overwritten */
-    lookup_colors[4] = CACA_MAGENTA;
-    lookup_colors[5] = CACA_LIGHTMAGENTA;
-    lookup_colors[6] = CACA_RED;
-    lookup_colors[7] = CACA_LIGHTRED;
-
-    for(v = 0; v < LOOKUP_VAL; v++)
-        for(s = 0; s < LOOKUP_SAT; s++)
-            for(h = 0; h < LOOKUP_HUE; h++)
-    {
-        int i, distbg, distfg, dist;
-        int val, sat, hue;
-        uint8_t outbg, outfg;
-
-        val = 0xfff * v / (LOOKUP_VAL - 1);
-        sat = 0xfff * s / (LOOKUP_SAT - 1);
-        hue = 0xfff * h / (LOOKUP_HUE - 1);
-
-        /* Initialise distances to the distance between pure black HSV
-         * coordinates and our white colour (3) */
-        outbg = outfg = 3;
-        distbg = distfg = HSV_DISTANCE(0, 0, 0, 3);
-
-        /* Calculate distances to eight major colour values and store the
-         * two nearest points in our lookup table. */
-        for(i = 0; i < 8; i++)
+    fw = caca_get_font_width(f);
+    fh = caca_get_font_height(f);
+
+    /* Count the candidate glyphs present in the font */
+    blocks = caca_get_font_blocks(f);
+    for(i = 0; blocks[i + 1]; i += 2)
+        for(ch = blocks[i]; ch < blocks[i + 1]; ch++)
+            if((ch >= 0x20 && ch < 0x7f) || (ch >= 0x2580 && ch < 0x25a0))
+                n++;
+
+    cv = caca_create_canvas(n, 1);
+    buf = malloc(4 * n * fw * fh);
+    shapes = malloc(n * sizeof(struct glyph_shape));
+
+    if(!cv || !buf || !shapes)
+    {
+        caca_free_canvas(cv);
+        free(buf);
+        free(shapes);
+        caca_free_font(f);
+        seterrno(ENOMEM);
+        return -1;
+    }
+
+    caca_set_color_ansi(cv, CACA_WHITE, CACA_BLACK);
+    for(i = 0, n = 0; blocks[i + 1]; i += 2)
+        for(ch = blocks[i]; ch < blocks[i + 1]; ch++)
+            if((ch >= 0x20 && ch < 0x7f) || (ch >= 0x2580 && ch < 0x25a0))
+                caca_put_char(cv, n++, 0, ch);
+
+    caca_render_canvas(cv, f, buf, n * fw, fh, 4 * n * fw);
+
+    index->count = 0;
+    for(k = 0; k < n; k++)
+    {
+        struct glyph_shape *shape = shapes + index->count;
+        int total = 0;
+
+        for(i = 0; i < 16; i++)
         {
-            dist = HSV_DISTANCE(hue, sat, val, i);
-            if(dist <= distbg)
-            {
-                outfg = outbg;
-                distfg = distbg;
-                outbg = i;
-                distbg = dist;
-            }
-            else if(dist <= distfg)
-            {
-                outfg = i;
-                distfg = dist;
-            }
+            int x0 = k * fw + (i % 4) * fw / 4, x1 = k * fw + (i % 4 + 1) * fw / 4;
+            int y0 = (i / 4) * fh / 4, y1 = (i / 4 + 1) * fh / 4;
+            int x, y, sum = 0;
+
+            /* The glyph is white on black, so any channel is the coverage */
+            for(y = y0; y < y1; y++)
+                for(x = x0; x < x1; x++)
+                    sum += buf[4 * (y * n * fw + x) + 1];
+
+            shape->coverage[i] = sum / ((x1 - x0) * (y1 - y0));
+            total += sum;
         }
 
-        hsv_distances[v][s][h] = (outfg << 4) | outbg;
+        shape->ch = caca_get_char(cv, k, 0);
+        shape->mean = total / (fw * fh);
+
+        for(j = 0; j < index->count; j++)
+            if(!memcmp(shapes[j].coverage, shape->coverage, 16))
+                break;
+
+        if(j == index->count)
+            index->count++;
     }
 
+    caca_free_canvas(cv);
+    free(buf);
+    caca_free_font(f);
+
+    index->shapes = shapes;
+
     return 0;
 }
 
+/* Find the glyph shape that best matches the position of each sub-cell
+ * between the two group colours. The groups are swapped if the glyph
+ * looks better with the colours reversed, which is only possible when
+ * the background colour is not forced to black. */
+static struct glyph_shape const *match_glyph_shape(caca_dither_t const *d,
+                                                   int const (*samples)[3],
+                                                   int (*mean)[3], int *count)
+{
+    uint8_t target[2][16];
+    int i, c, j, m0[3], m1[3], best = 0, swap = 0, norm = 0, dist;
+    int can_swap = uses_two_colours(d) || d->color == COLOR_MODE_TRUECOLOR;
+    int distmin = INT_MAX;
+
+    if(!count[0] || !count[1])
+        return d->shapes;
+
+    for(c = 0; c < 3; c++)
+    {
+        m0[c] = mean[0][c] / count[0];
+        m1[c] = mean[1][c] / count[1] - m0[c];
+        norm += m1[c] * m1[c];
+    }
+
+    if(!norm)
+        return d->shapes;
+
+    /* Project the sub-cells on the segment between the two colours */
+    for(i = 0; i < 16; i++)
+    {
+        int64_t dot = 0;
+        int t;
+
+        for(c = 0; c < 3; c++)
+            dot += (int64_t)(samples[i][c] - m0[c]) * m1[c];
+
+        t = (int)(dot * 0xff / norm);
+        t = t < 0 ? 0 : t > 0xff ? 0xff : t;
+        target[0][i] = t;
+        target[1][i] = 0xff - t;
+    }
+
+    for(j = 0; j < 2 * d->shape_count; j++)
+    {
+        uint8_t const *a = target[j & 1], *b = d->shapes[j >> 1].coverage;
+
+        if((j & 1) && !can_swap)
+            continue;
+
+#if defined __SSE2__ && !defined __KERNEL__
+        {
+            __m128i sad = _mm_sad_epu8(_mm_loadu_si128((__m128i const *)a),
+                                       _mm_loadu_si128((__m128i const *)b));
+            dist = _mm_cvtsi128_si32(sad)
+                    + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+        }
+#else
+        for(i = 0, dist = 0; i < 16; i++)
+            dist += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+#endif
+
+        if(dist < distmin)
+        {
+            distmin = dist;
+            best = j >> 1;
+            swap = j & 1;
+        }
+    }
+
+    if(swap)
+    {
+        for(c = 0; c < 3; c++)
+        {
+            int tmp = mean[0][c];
+            mean[0][c] = mean[1][c];
+            mean[1][c] = tmp;
+        }
+
+        i = count[0];
+        count[0] = count[1];
+        count[1] = i;
+    }
+
+    return d->shapes + best;
+}
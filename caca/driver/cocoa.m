@@ -1010,6 +1010,7 @@ int cocoa_install(caca_display_t *dp)
     dp->drv.handle_resize = cocoa_handle_resize;
     dp->drv.get_event = cocoa_get_event;
     dp->drv.set_mouse = cocoa_set_mouse;
+    dp->drv.scroll = NULL;
 
     return 0;
 }
@@ -624,6 +624,7 @@ int gl_install(caca_display_t *dp)
     dp->drv.get_event = gl_get_event;
     dp->drv.set_mouse = gl_set_mouse;
     dp->drv.set_cursor = NULL;
+    dp->drv.scroll = NULL;
 
     return 0;
 }
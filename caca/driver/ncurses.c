@@ -354,38 +354,30 @@ static int ncurses_get_display_height(caca_display_t const *dp)
 
 static void ncurses_display(caca_display_t *dp)
 {
-    int x, y, i;
+    int x, y, dx, dy, dw;
 
-    for(i = 0; i < caca_get_dirty_rect_count(dp->cv); i++)
+    /* Only redraw the changed parts of each line */
+    for(dx = dy = 0; !caca_get_dirty_span(dp->cv, &dx, &dy, &dw); dx += dw)
     {
         uint32_t const *cvchars, *cvattrs;
-        int dx, dy, dw, dh;
-
-        caca_get_dirty_rect(dp->cv, i, &dx, &dy, &dw, &dh);
 
         cvchars = caca_get_canvas_chars(dp->cv) + dx + dy * dp->cv->width;
         cvattrs = caca_get_canvas_attrs(dp->cv) + dx + dy * dp->cv->width;
 
-        for(y = dy; y < dy + dh; y++)
+        move(dy, dx);
+        for(x = dx; x < dx + dw; x++)
         {
-            move(y, dx);
-            for(x = dx; x < dx + dw; x++)
-            {
-                uint32_t attr = *cvattrs++;
-
-                (void)attrset(dp->drv.p->attr[caca_attr_to_ansi(attr)]);
-                if(attr & CACA_BOLD)
-                    attron(A_BOLD);
-                if(attr & CACA_BLINK)
-                    attron(A_BLINK);
-                if(attr & CACA_UNDERLINE)
-                    attron(A_UNDERLINE);
+            uint32_t attr = *cvattrs++;
 
-                ncurses_write_utf32(*cvchars++);
-            }
+            (void)attrset(dp->drv.p->attr[caca_attr_to_ansi(attr)]);
+            if(attr & CACA_BOLD)
+                attron(A_BOLD);
+            if(attr & CACA_BLINK)
+                attron(A_BLINK);
+            if(attr & CACA_UNDERLINE)
+                attron(A_UNDERLINE);
 
-            cvchars += dp->cv->width - dw;
-            cvattrs += dp->cv->width - dw;
+            ncurses_write_utf32(*cvchars++);
         }
     }
 
@@ -396,6 +388,24 @@ static void ncurses_display(caca_display_t *dp)
     refresh();
 }
 
+static int ncurses_scroll(caca_display_t *dp, int x, int y, int w, int h,
+                          int dy)
+{
+    /* Terminals can only scroll whole lines */
+    if(x != 0 || w != caca_get_canvas_width(dp->cv))
+        return -1;
+
+    if(setscrreg(y, y + h - 1) == ERR)
+        return -1;
+
+    scrollok(stdscr, TRUE);
+    scrl(dy);
+    scrollok(stdscr, FALSE);
+    setscrreg(0, LINES - 1);
+
+    return 0;
+}
+
 static void ncurses_handle_resize(caca_display_t *dp)
 {
     struct winsize size;
@@ -879,6 +889,7 @@ int ncurses_install(caca_display_t *dp)
     dp->drv.get_event = ncurses_get_event;
     dp->drv.set_mouse = NULL;
     dp->drv.set_cursor = ncurses_set_cursor;
+    dp->drv.scroll = ncurses_scroll;
 
     return 0;
 }
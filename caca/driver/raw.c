@@ -106,6 +106,7 @@ int raw_install(caca_display_t *dp)
     dp->drv.get_event = raw_get_event;
     dp->drv.set_mouse = NULL;
     dp->drv.set_cursor = NULL;
+    dp->drv.scroll = NULL;
 
     return 0;
 }
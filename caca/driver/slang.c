@@ -233,69 +233,61 @@ static int slang_get_display_height(caca_display_t const *dp)
 
 static void slang_display(caca_display_t *dp)
 {
-    int x, y, i;
+    int x, dx, dy, dw;
 
     SLsig_block_signals();
-    for(i = 0; i < caca_get_dirty_rect_count(dp->cv); i++)
+    /* Only redraw the changed parts of each line */
+    for(dx = dy = 0; !caca_get_dirty_span(dp->cv, &dx, &dy, &dw); dx += dw)
     {
         uint32_t const *cvchars, *cvattrs;
-        int dx, dy, dw, dh;
-
-        caca_get_dirty_rect(dp->cv, i, &dx, &dy, &dw, &dh);
 
         cvchars = caca_get_canvas_chars(dp->cv) + dx + dy * dp->cv->width;
         cvattrs = caca_get_canvas_attrs(dp->cv) + dx + dy * dp->cv->width;
 
-        for(y = dy; y < dy + dh; y++)
+        SLsmg_gotorc(dy, dx);
+        for(x = dx; x < dx + dw; x++)
         {
-            SLsmg_gotorc(y, dx);
-            for(x = dx; x < dx + dw; x++)
-            {
-                uint32_t ch = *cvchars++;
+            uint32_t ch = *cvchars++;
 
 #if defined(OPTIMISE_SLANG_PALETTE)
-                /* If foreground == background, just don't use this colour
-                 * pair, and print a space instead of the real character. */
-                /* XXX: disabled, because I can't remember what it was
-                 * here for, and in cases where SLang does not render
-                 * bright backgrounds, it's just fucked up. */
+            /* If foreground == background, just don't use this colour
+             * pair, and print a space instead of the real character. */
+            /* XXX: disabled, because I can't remember what it was
+             * here for, and in cases where SLang does not render
+             * bright backgrounds, it's just fucked up. */
 #if 0
-                uint8_t fgcolor = caca_attr_to_ansi_fg(*cvattrs);
-                uint8_t bgcolor = caca_attr_to_ansi_bg(*cvattrs);
-
-                if(fgcolor >= 0x10)
-                    fgcolor = CACA_LIGHTGRAY;
-
-                if(bgcolor >= 0x10)
-                    bgcolor = CACA_BLACK; /* FIXME: handle transparency */
-
-                if(fgcolor == bgcolor)
-                {
-                    if(fgcolor == CACA_BLACK)
-                        fgcolor = CACA_WHITE;
-                    else if(fgcolor == CACA_WHITE
-                             || fgcolor <= CACA_LIGHTGRAY)
-                        fgcolor = CACA_BLACK;
-                    else
-                        fgcolor = CACA_WHITE;
-                    SLsmg_set_color(slang_assoc[fgcolor + 16 * bgcolor]);
-                    SLsmg_write_char(' ');
-                    cvattrs++;
-                }
+            uint8_t fgcolor = caca_attr_to_ansi_fg(*cvattrs);
+            uint8_t bgcolor = caca_attr_to_ansi_bg(*cvattrs);
+
+            if(fgcolor >= 0x10)
+                fgcolor = CACA_LIGHTGRAY;
+
+            if(bgcolor >= 0x10)
+                bgcolor = CACA_BLACK; /* FIXME: handle transparency */
+
+            if(fgcolor == bgcolor)
+            {
+                if(fgcolor == CACA_BLACK)
+                    fgcolor = CACA_WHITE;
+                else if(fgcolor == CACA_WHITE
+                         || fgcolor <= CACA_LIGHTGRAY)
+                    fgcolor = CACA_BLACK;
                 else
+                    fgcolor = CACA_WHITE;
+                SLsmg_set_color(slang_assoc[fgcolor + 16 * bgcolor]);
+                SLsmg_write_char(' ');
+                cvattrs++;
+            }
+            else
 #endif
-                {
-                    SLsmg_set_color(slang_assoc[caca_attr_to_ansi(*cvattrs++)]);
-                    slang_write_utf32(ch);
-                }
-#else
-                SLsmg_set_color(caca_attr_to_ansi(*cvattrs++));
+            {
+                SLsmg_set_color(slang_assoc[caca_attr_to_ansi(*cvattrs++)]);
                 slang_write_utf32(ch);
-#endif
             }
-
-            cvchars += dp->cv->width - dw;
-            cvattrs += dp->cv->width - dw;
+#else
+            SLsmg_set_color(caca_attr_to_ansi(*cvattrs++));
+            slang_write_utf32(ch);
+#endif
         }
     }
     SLsmg_gotorc(caca_wherey(dp->cv), caca_wherex(dp->cv));
@@ -602,6 +594,7 @@ int slang_install(caca_display_t *dp)
     dp->drv.get_event = slang_get_event;
     dp->drv.set_mouse = NULL;
     dp->drv.set_cursor = slang_set_cursor;
+    dp->drv.scroll = NULL;
 
     return 0;
 }
@@ -184,6 +184,7 @@ int vga_install(caca_display_t *dp)
     dp->drv.get_event = vga_get_event;
     dp->drv.set_mouse = NULL;
     dp->drv.set_cursor = NULL;
+    dp->drv.scroll = NULL;
 
     return 0;
 }
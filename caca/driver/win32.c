@@ -499,6 +499,7 @@ int win32_install(caca_display_t *dp)
     dp->drv.get_event = win32_get_event;
     dp->drv.set_mouse = NULL;
     dp->drv.set_cursor = NULL;
+    dp->drv.scroll = NULL;
 
     return 0;
 }
@@ -512,6 +512,27 @@ static void x11_display(caca_display_t *dp)
     XFlush(dp->drv.p->dpy);
 }
 
+static int x11_scroll(caca_display_t *dp, int x, int y, int w, int h, int dy)
+{
+    int fw = dp->drv.p->font_width, fh = dp->drv.p->font_height;
+    int cx = dp->drv.p->dirty_cursor_x, cy = dp->drv.p->dirty_cursor_y;
+
+    /* Scroll the pixmap, which is copied to the window upon display */
+    XCopyArea(dp->drv.p->dpy, dp->drv.p->pixmap, dp->drv.p->pixmap,
+              dp->drv.p->gc, x * fw, (dy > 0 ? y + dy : y) * fh,
+              w * fw, (h - (dy > 0 ? dy : -dy)) * fh,
+              x * fw, (dy > 0 ? y : y - dy) * fh);
+
+    /* The cursor that needs to be erased moved along with the cells */
+    if(cx >= x && cx < x + w && cy >= y && cy < y + h)
+    {
+        cy -= dy;
+        dp->drv.p->dirty_cursor_y = cy >= y && cy < y + h ? cy : -1;
+    }
+
+    return 0;
+}
+
 static void x11_handle_resize(caca_display_t *dp)
 {
     Pixmap new_pixmap;
@@ -986,6 +1007,7 @@ int x11_install(caca_display_t *dp)
     dp->drv.get_event = x11_get_event;
     dp->drv.set_mouse = x11_set_mouse;
     dp->drv.set_cursor = x11_set_cursor;
+    dp->drv.scroll = x11_scroll;
 
     return 0;
 }
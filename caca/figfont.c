@@ -243,22 +243,41 @@ int caca_put_figchar(caca_canvas_t *cv, uint32_t ch)
 #endif
     caca_set_canvas_size(cv, ff->w, ff->h);
 
-    /* Render our char (FIXME: create a rect-aware caca_blit_canvas?) */
+    /* Render our char, one run of non-blank cells at a time (FIXME: create
+     * a rect-aware caca_blit_canvas?) */
     for(y = 0; y < h; y++)
-        for(x = 0; x < w; x++)
+        for(x = 0; x < w; )
     {
-        uint32_t ch1, ch2;
-        uint32_t tmpat = caca_get_attr(ff->fontcv, x, y + c * ff->height);
-        ch2 = caca_get_char(ff->charcv, x, y);
-        if(ch2 == ' ')
-            continue;
-        ch1 = caca_get_char(cv, ff->x + x - overlap, ff->y + y);
-        if(ch1 == ' ' || ff->hmode != H_SMUSH)
-            caca_put_char(cv, ff->x + x - overlap, ff->y + y, ch2);
-        else
-            caca_put_char(cv, ff->x + x - overlap, ff->y + y,
-                           hsmush(ch1, ch2, ff->hsmushrule));
-        caca_put_attr(cv, ff->x + x, ff->y + y, tmpat);
+        uint32_t chars[256], attrs[256];
+        int start = 0, n = 0;
+
+        for( ; x < w && n < (int)(sizeof(chars) / sizeof(*chars)); x++)
+        {
+            uint32_t ch1, ch2, attr;
+            ch2 = caca_get_char(ff->charcv, x, y);
+            if(ch2 == ' ')
+            {
+                if(n)
+                    break;
+                continue;
+            }
+            if(!n)
+                start = x;
+            ch1 = caca_get_char(cv, ff->x + x - overlap, ff->y + y);
+            if(ch1 != ' ' && ff->hmode == H_SMUSH)
+                ch2 = hsmush(ch1, ch2, ff->hsmushrule);
+            /* Font attributes below 0x10 only hold style flags, as with
+             * caca_put_attr() */
+            attr = caca_get_attr(ff->fontcv, x, y + c * ff->height);
+            if(attr < 0x00000010)
+                attr |= cv->curattr & 0xfffffff0;
+            chars[n] = ch2;
+            attrs[n++] = attr;
+        }
+
+        if(n)
+            caca_put_cells(cv, ff->x + start - overlap, ff->y + y,
+                           chars, attrs, n);
     }
 
     /* Advance cursor */
@@ -271,7 +290,7 @@ int caca_put_figchar(caca_canvas_t *cv, uint32_t ch)
 int caca_flush_figlet(caca_canvas_t *cv)
 {
     caca_charfont_t *ff = cv->ff;
-    int x, y;
+    int x, y, n;
 
     if (!ff)
         return -1;
@@ -281,14 +300,25 @@ int caca_flush_figlet(caca_canvas_t *cv)
     caca_set_canvas_size(cv, ff->w, ff->h);
 
     /* FIXME: do this somewhere else, or record hardblank positions */
-    for(y = 0; y < ff->h; y++)
-        for(x = 0; x < ff->w; x++)
-            if(caca_get_char(cv, x, y) == 0xa0)
-            {
-                uint32_t attr = caca_get_attr(cv, x, y);
-                caca_put_char(cv, x, y, ' ');
-                caca_put_attr(cv, x, y, attr);
-            }
+    for(y = 0; y < cv->height; y++)
+        for(x = 0; x < cv->width; x += n)
+    {
+        uint32_t spaces[256], attrs[256];
+
+        for(n = 0; x + n < cv->width && n < (int)(sizeof(spaces)
+                                                  / sizeof(*spaces)); n++)
+        {
+            if(cv->chars[y * cv->width + x + n] != 0xa0)
+                break;
+            spaces[n] = ' ';
+            attrs[n] = cv->attrs[y * cv->width + x + n];
+        }
+
+        if(n)
+            caca_put_cells(cv, x, y, spaces, attrs, n);
+        else
+            n = 1;
+    }
 
     ff->x = ff->y = 0;
     ff->w = ff->h = 0;
@@ -483,31 +513,47 @@ static caca_charfont_t * open_charfont(char const *path)
     free(data);
 
     /* Remove EOL characters. For now we ignore hardblanks, don’t do any
-     * smushing, nor any kind of error checking. */
-    for(j = 0; j < ff->height * ff->glyphs; j++)
+     * smushing, nor any kind of error checking. Lines are read from right
+     * to left in chunks, and each chunk is printed back at once. */
+    for(j = 0; j < ff->height * ff->glyphs && j < ff->fontcv->height; j++)
     {
-        uint32_t ch, oldch = 0;
+        uint32_t chars[256], attrs[256], ch, oldch = 0;
+        int n, end = ff->max_length < ff->fontcv->width
+                   ? ff->max_length : ff->fontcv->width;
 
-        for(i = ff->max_length; i--;)
+        for( ; end > 0; end -= n)
         {
-            ch = caca_get_char(ff->fontcv, i, j);
+            n = end < (int)(sizeof(chars) / sizeof(*chars))
+              ? end : (int)(sizeof(chars) / sizeof(*chars));
 
-            /* Replace hardblanks with U+00A0 NO-BREAK SPACE */
-            if(ch == ff->hardblank)
-                caca_put_char(ff->fontcv, i, j, ch = 0xa0);
+            memcpy(chars, ff->fontcv->chars + j * ff->fontcv->width + end - n,
+                   n * sizeof(uint32_t));
+            memcpy(attrs, ff->fontcv->attrs + j * ff->fontcv->width + end - n,
+                   n * sizeof(uint32_t));
 
-            if(oldch && ch != oldch)
+            for(i = n; i--;)
             {
-                if(!ff->lookup[j / ff->height * 2 + 1])
-                    ff->lookup[j / ff->height * 2 + 1] = i + 1;
-            }
-            else if(oldch && ch == oldch)
-                caca_put_char(ff->fontcv, i, j, ' ');
-            else if(ch != ' ')
-            {
-                oldch = ch;
-                caca_put_char(ff->fontcv, i, j, ' ');
+                ch = chars[i];
+
+                /* Replace hardblanks with U+00A0 NO-BREAK SPACE */
+                if(ch == ff->hardblank)
+                    chars[i] = ch = 0xa0;
+
+                if(oldch && ch != oldch)
+                {
+                    if(!ff->lookup[j / ff->height * 2 + 1])
+                        ff->lookup[j / ff->height * 2 + 1] = end - n + i + 1;
+                }
+                else if(oldch && ch == oldch)
+                    chars[i] = ' ';
+                else if(ch != ' ')
+                {
+                    oldch = ch;
+                    chars[i] = ' ';
+                }
             }
+
+            caca_put_cells(ff->fontcv, end - n, j, chars, attrs, n);
         }
     }
 
@@ -49,6 +49,8 @@ int caca_get_frame_count(caca_canvas_t const *cv)
  *
  *  If an error occurs, -1 is returned and \b errno is set accordingly:
  *  - \c EINVAL Requested frame is out of range.
+ *  - \c ENOMEM Not enough memory to track the dirty cells of a frame of
+ *    another size.
  *
  *  \param cv A libcaca canvas
  *  \param id The canvas frame to activate
@@ -68,7 +70,8 @@ int caca_set_frame(caca_canvas_t *cv, int id)
 
     _caca_save_frame_info(cv);
     cv->frame = id;
-    _caca_load_frame_info(cv);
+    if(_caca_load_frame_info(cv) < 0)
+        return -1;
 
     if(!cv->dirty_disabled)
         caca_add_dirty_rect(cv, 0, 0, cv->width, cv->height);
@@ -144,9 +147,26 @@ int caca_set_frame_name(caca_canvas_t *cv, char const *name)
  */
 int caca_create_frame(caca_canvas_t *cv, int id)
 {
-    int size = cv->width * cv->height;
+    int *shared = cv->frames[cv->frame].shared;
     int f;
 
+    /* The new frame shares its cells with the current frame until one of
+     * them is written to */
+    if(!shared)
+    {
+        shared = malloc(sizeof(int));
+        if(!shared)
+        {
+            seterrno(ENOMEM);
+            return -1;
+        }
+
+        *shared = 1;
+        cv->frames[cv->frame].shared = shared;
+    }
+
+    (*shared)++;
+
     if(id < 0)
         id = 0;
     else if(id > cv->framecount)
@@ -164,10 +184,9 @@ int caca_create_frame(caca_canvas_t *cv, int id)
 
     cv->frames[id].width = cv->width;
     cv->frames[id].height = cv->height;
-    cv->frames[id].chars = malloc(size * sizeof(uint32_t));
-    memcpy(cv->frames[id].chars, cv->chars, size * sizeof(uint32_t));
-    cv->frames[id].attrs = malloc(size * sizeof(uint32_t));
-    memcpy(cv->frames[id].attrs, cv->attrs, size * sizeof(uint32_t));
+    cv->frames[id].chars = cv->chars;
+    cv->frames[id].attrs = cv->attrs;
+    cv->frames[id].shared = shared;
     cv->frames[id].curattr = cv->curattr;
 
     cv->frames[id].x = cv->frames[cv->frame].x;
@@ -197,6 +216,8 @@ int caca_create_frame(caca_canvas_t *cv, int id)
  *  If an error occurs, -1 is returned and \b errno is set accordingly:
  *  - \c EINVAL Requested frame is out of range, or attempt to delete the
  *    last frame of the canvas.
+ *  - \c ENOMEM Not enough memory to track the dirty cells of a new active
+ *    frame of another size.
  *
  *  \param cv A libcaca canvas
  *  \param id The index of the frame to delete
@@ -218,8 +239,7 @@ int caca_free_frame(caca_canvas_t *cv, int id)
         return -1;
     }
 
-    free(cv->frames[id].chars);
-    free(cv->frames[id].attrs);
+    _caca_release_frame(cv, id);
     free(cv->frames[id].name);
 
     for(f = id + 1; f < cv->framecount; f++)
@@ -234,7 +254,8 @@ int caca_free_frame(caca_canvas_t *cv, int id)
     else if(cv->frame == id)
     {
         cv->frame = 0;
-        _caca_load_frame_info(cv);
+        if(_caca_load_frame_info(cv) < 0)
+            return -1;
         if(!cv->dirty_disabled)
             caca_add_dirty_rect(cv, 0, 0, cv->width, cv->height);
     }
@@ -254,7 +275,9 @@ void _caca_save_frame_info(caca_canvas_t *cv)
     cv->frames[cv->frame].curattr = cv->curattr;
 }
 
-void _caca_load_frame_info(caca_canvas_t *cv)
+/* Load the current frame's shortcuts into the canvas. Frames may not all
+ * have the same size, so the dirty cell tracking is resized as well. */
+int _caca_load_frame_info(caca_canvas_t *cv)
 {
     cv->width = cv->frames[cv->frame].width;
     cv->height = cv->frames[cv->frame].height;
@@ -263,5 +286,66 @@ void _caca_load_frame_info(caca_canvas_t *cv)
     cv->attrs = cv->frames[cv->frame].attrs;
 
     cv->curattr = cv->frames[cv->frame].curattr;
+
+    return _caca_resize_dirty(cv);
+}
+
+
+/* Give a frame its own copy of its cells if it shares them with other
+ * frames. This must be called before the frame's cells are written to. */
+int _caca_unshare_frame(caca_canvas_t *cv, int f)
+{
+    struct caca_frame *frame = &cv->frames[f];
+    int size = frame->width * frame->height;
+    uint32_t *chars, *attrs;
+
+    if(!frame->shared)
+        return 0;
+
+    /* The other frames are gone */
+    if(*frame->shared == 1)
+    {
+        free(frame->shared);
+        frame->shared = NULL;
+        return 0;
+    }
+
+    chars = _caca_alloc_cells(cv, frame->width, frame->height);
+    attrs = _caca_alloc_cells(cv, frame->width, frame->height);
+    if(size && (!chars || !attrs))
+    {
+        _caca_free_cells(cv, chars);
+        _caca_free_cells(cv, attrs);
+        seterrno(ENOMEM);
+        return -1;
+    }
+
+    memcpy(chars, frame->chars, size * sizeof(uint32_t));
+    memcpy(attrs, frame->attrs, size * sizeof(uint32_t));
+
+    (*frame->shared)--;
+    frame->shared = NULL;
+    frame->chars = chars;
+    frame->attrs = attrs;
+
+    if(f == cv->frame)
+    {
+        cv->chars = chars;
+        cv->attrs = attrs;
+    }
+
+    return 0;
 }
 
+/* Free a frame's cells, unless other frames still share them */
+void _caca_release_frame(caca_canvas_t *cv, int f)
+{
+    struct caca_frame *frame = &cv->frames[f];
+
+    if(frame->shared && --*frame->shared > 0)
+        return;
+
+    free(frame->shared);
+    _caca_free_cells(cv, frame->chars);
+    _caca_free_cells(cv, frame->attrs);
+}
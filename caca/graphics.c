@@ -138,6 +138,10 @@ int caca_get_display_time(caca_display_t const *dp)
  *  a time range shorter than the value set with caca_set_display_time(),
  *  the second call will be delayed before performing the screen refresh.
  *
+ *  If an area of the canvas was scrolled with caca_scroll_canvas() and the
+ *  display driver can scroll the screen, only the lines that scrolled into
+ *  view and the cells that changed are redrawn.
+ *
  *  This function never fails.
  *
  *  \param dp The libcaca display context.
@@ -151,11 +155,23 @@ int caca_refresh_display(caca_display_t *dp)
 #if !defined(_DOXYGEN_SKIP_ME)
 #   define IDLE_USEC 5000
 #endif
+    caca_canvas_t *cv = dp->cv;
     int ticks = dp->lastticks + _caca_getticks(&dp->timer);
 
 #if defined PROF
     _caca_getticks(&proftimer);
 #endif
+    /* Scroll the screen if the driver can, otherwise redraw the area */
+    if(cv->scroll_dy)
+    {
+        if(dp->drv.scroll && !dp->drv.scroll(dp, cv->scroll_x, cv->scroll_y,
+                                             cv->scroll_w, cv->scroll_h,
+                                             cv->scroll_dy))
+            cv->scroll_dy = 0;
+        else
+            _caca_flush_scroll(cv);
+    }
+
     dp->drv.display(dp);
 #if defined PROF
     STAT_IADD(&dp->display_stat, _caca_getticks(&proftimer));
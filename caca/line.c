@@ -255,10 +255,21 @@ static void draw_solid_line(caca_canvas_t *cv, struct line* s)
         int dpr = dy << 1;
         int dpru = dpr - (dx << 1);
         int delta = dpr - dx;
+        int xs = x1;
+
+        /* Print each horizontal run at once, except for fullwidth
+         * characters, which overlap and depend on the drawing order */
+        int wide = caca_utf32_is_fullwidth(s->ch);
 
         for(; dx>=0; dx--)
         {
-            caca_put_char(cv, x1, y1, s->ch);
+            if(delta > 0 || !dx || wide)
+            {
+                _caca_fill_span(cv, xs < x1 ? xs : x1, xs < x1 ? x1 : xs,
+                                y1, s->ch);
+                xs = x1 + xinc;
+            }
+
             if(delta > 0)
             {
                 x1 += xinc;
@@ -0,0 +1,353 @@
+/*
+ *  libcaca       Colour ASCII-Art library
+ *  Copyright (c) 2002-2012 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This library is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What the Fuck You Want
+ *  to Public License, Version 2, as published by Sam Hocevar. See
+ *  http://www.wtfpl.net/ for more details.
+ */
+
+/*
+ *  This file contains the sparse canvas functions.
+ *
+ *
+ *  About sparse canvases:
+ *
+ *  * A sparse canvas is split into tiles of SPARSE_WIDTH x SPARSE_HEIGHT
+ *  cells. Each tile is an ordinary canvas that is only created when
+ *  something is first blitted over it. Tiles that were never written to
+ *  read as blank cells with the default colours, like a new canvas.
+ *
+ *  * The tile table only has one pointer per row of tiles. The rows
+ *  themselves are allocated along with their first tile.
+ *
+ *  * Only a window of a sparse canvas is meant to be displayed or
+ *  exported at a time: caca_blit_from_sparse() copies it into an
+ *  ordinary canvas, which can then be used with the display and export
+ *  functions.
+ */
+
+#include "config.h"
+
+#if !defined(__KERNEL__)
+#   include <stdio.h>
+#   include <stdlib.h>
+#   include <string.h>
+#endif
+
+#include "caca.h"
+#include "caca_internals.h"
+
+#define SPARSE_WIDTH 64
+#define SPARSE_HEIGHT 16
+
+struct caca_sparse_canvas
+{
+    int width, height;
+    int tw, th;
+    caca_canvas_t ***rows;
+};
+
+static caca_canvas_t *get_tile(caca_sparse_canvas_t const *, int, int);
+
+/** \brief Create a sparse canvas.
+ *
+ *  Create a sparse canvas of the given size. Unlike an ordinary canvas,
+ *  it only uses memory for the areas that were written to, so it can be
+ *  much larger than the available memory.
+ *
+ *  If an error occurs, NULL is returned and \b errno is set accordingly:
+ *  - \c EINVAL Specified width or height is invalid.
+ *  - \c ENOMEM Not enough memory for the tile table.
+ *
+ *  \param width The desired sparse canvas width
+ *  \param height The desired sparse canvas height
+ *  \return A sparse canvas handle upon success, NULL if an error occurred.
+ */
+caca_sparse_canvas_t *caca_create_sparse_canvas(int width, int height)
+{
+    caca_sparse_canvas_t *scv;
+    int tw, th;
+
+    if(width < 0 || height < 0)
+    {
+        seterrno(EINVAL);
+        return NULL;
+    }
+
+    tw = width / SPARSE_WIDTH + (width % SPARSE_WIDTH != 0);
+    th = height / SPARSE_HEIGHT + (height % SPARSE_HEIGHT != 0);
+
+    scv = malloc(sizeof(caca_sparse_canvas_t));
+    if(!scv)
+    {
+        seterrno(ENOMEM);
+        return NULL;
+    }
+
+    scv->width = width;
+    scv->height = height;
+    scv->tw = tw;
+    scv->th = th;
+    scv->rows = NULL;
+
+    if(tw && th)
+    {
+        scv->rows = calloc(th, sizeof(caca_canvas_t **));
+        if(!scv->rows)
+        {
+            free(scv);
+            seterrno(ENOMEM);
+            return NULL;
+        }
+    }
+
+    return scv;
+}
+
+/** \brief Free a sparse canvas.
+ *
+ *  Free all resources allocated by caca_create_sparse_canvas().
+ *
+ *  This function never fails.
+ *
+ *  \param scv A sparse canvas.
+ *  \return This function always returns 0.
+ */
+int caca_free_sparse_canvas(caca_sparse_canvas_t *scv)
+{
+    int tx, ty;
+
+    for(ty = 0; ty < scv->th; ty++)
+    {
+        if(!scv->rows[ty])
+            continue;
+
+        for(tx = 0; tx < scv->tw; tx++)
+            if(scv->rows[ty][tx])
+                caca_free_canvas(scv->rows[ty][tx]);
+
+        free(scv->rows[ty]);
+    }
+
+    free(scv->rows);
+    free(scv);
+
+    return 0;
+}
+
+/** \brief Get the width of a sparse canvas.
+ *
+ *  This function never fails.
+ *
+ *  \param scv A sparse canvas.
+ *  \return The sparse canvas width.
+ */
+int caca_get_sparse_canvas_width(caca_sparse_canvas_t const *scv)
+{
+    return scv->width;
+}
+
+/** \brief Get the height of a sparse canvas.
+ *
+ *  This function never fails.
+ *
+ *  \param scv A sparse canvas.
+ *  \return The sparse canvas height.
+ */
+int caca_get_sparse_canvas_height(caca_sparse_canvas_t const *scv)
+{
+    return scv->height;
+}
+
+/** \brief Get the number of tiles in use in a sparse canvas.
+ *
+ *  Get the number of tiles that were written to, and therefore use
+ *  memory, in a sparse canvas.
+ *
+ *  This function never fails.
+ *
+ *  \param scv A sparse canvas.
+ *  \return The number of allocated tiles.
+ */
+int caca_get_sparse_canvas_tile_count(caca_sparse_canvas_t const *scv)
+{
+    int tx, ty, n = 0;
+
+    for(ty = 0; ty < scv->th; ty++)
+        for(tx = 0; scv->rows[ty] && tx < scv->tw; tx++)
+            if(scv->rows[ty][tx])
+                n++;
+
+    return n;
+}
+
+/** \brief Blit a canvas onto a sparse canvas.
+ *
+ *  Blit a canvas onto a sparse canvas at the given coordinates, exactly
+ *  like caca_blit() does with ordinary canvases. The tiles covered by the
+ *  source canvas are created if necessary. Fullwidth characters that
+ *  straddle two tiles are replaced with spaces.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL A mask was specified but the mask size and source canvas
+ *    size do not match.
+ *  - \c ENOMEM Not enough memory to create a tile.
+ *
+ *  \param dst The destination sparse canvas.
+ *  \param x X coordinate.
+ *  \param y Y coordinate.
+ *  \param src The source canvas.
+ *  \param mask The mask canvas.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_blit_to_sparse(caca_sparse_canvas_t *dst, int x, int y,
+                        caca_canvas_t const *src, caca_canvas_t const *mask)
+{
+    int tx, ty, txmin, tymin, txmax, tymax;
+    int x1, y1, x2, y2;
+
+    if(mask && (src->width != mask->width || src->height != mask->height))
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    /* Find the covered tiles */
+    x1 = x - src->frames[src->frame].handlex;
+    y1 = y - src->frames[src->frame].handley;
+    x2 = x1 + src->width - 1;
+    y2 = y1 + src->height - 1;
+
+    if(x1 < 0) x1 = 0;
+    if(y1 < 0) y1 = 0;
+    if(x2 >= dst->width) x2 = dst->width - 1;
+    if(y2 >= dst->height) y2 = dst->height - 1;
+
+    if(x1 > x2 || y1 > y2)
+        return 0;
+
+    txmin = x1 / SPARSE_WIDTH;
+    tymin = y1 / SPARSE_HEIGHT;
+    txmax = x2 / SPARSE_WIDTH;
+    tymax = y2 / SPARSE_HEIGHT;
+
+    for(ty = tymin; ty <= tymax; ty++)
+    {
+        if(!dst->rows[ty])
+        {
+            dst->rows[ty] = calloc(dst->tw, sizeof(caca_canvas_t *));
+            if(!dst->rows[ty])
+            {
+                seterrno(ENOMEM);
+                return -1;
+            }
+        }
+
+        for(tx = txmin; tx <= txmax; tx++)
+        {
+            caca_canvas_t **tile = &dst->rows[ty][tx];
+
+            if(!*tile)
+            {
+                int w = dst->width - tx * SPARSE_WIDTH;
+                int h = dst->height - ty * SPARSE_HEIGHT;
+
+                *tile = caca_create_canvas(w < SPARSE_WIDTH ? w : SPARSE_WIDTH,
+                                           h < SPARSE_HEIGHT ? h : SPARSE_HEIGHT);
+                if(!*tile)
+                    return -1;
+
+                /* Nobody displays the tiles themselves */
+                caca_disable_dirty_rect(*tile);
+            }
+
+            if(caca_blit(*tile, x - tx * SPARSE_WIDTH, y - ty * SPARSE_HEIGHT,
+                         src, mask) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/** \brief Blit a sparse canvas onto a canvas.
+ *
+ *  Blit a sparse canvas onto an ordinary canvas at the given coordinates,
+ *  like caca_blit() does. To copy the window of the sparse canvas that
+ *  starts at (\e wx, \e wy), use -\e wx and -\e wy as coordinates. Areas
+ *  that were never written to are copied as blank cells with the default
+ *  colours. Only the cells that change are marked as dirty, so that
+ *  scrolling through a sparse canvas only redraws what is needed.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the destination frame its own
+ *    cells.
+ *
+ *  \param dst The destination canvas.
+ *  \param x X coordinate.
+ *  \param y Y coordinate.
+ *  \param src The source sparse canvas.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_blit_from_sparse(caca_canvas_t *dst, int x, int y,
+                          caca_sparse_canvas_t const *src)
+{
+    uint32_t savedattr = dst->curattr;
+    int tx, ty, txmin, tymin, txmax, tymax;
+    int x1, y1, x2, y2, ret = 0;
+
+    /* Find the visible tiles */
+    x1 = -x > 0 ? -x : 0;
+    y1 = -y > 0 ? -y : 0;
+    x2 = dst->width - 1 - x < src->width - 1 ? dst->width - 1 - x
+                                             : src->width - 1;
+    y2 = dst->height - 1 - y < src->height - 1 ? dst->height - 1 - y
+                                               : src->height - 1;
+
+    if(x1 > x2 || y1 > y2)
+        return 0;
+
+    txmin = x1 / SPARSE_WIDTH;
+    tymin = y1 / SPARSE_HEIGHT;
+    txmax = x2 / SPARSE_WIDTH;
+    tymax = y2 / SPARSE_HEIGHT;
+
+    /* Blank areas get the attribute of a new canvas */
+    dst->curattr = 0;
+    caca_set_color_ansi(dst, CACA_DEFAULT, CACA_TRANSPARENT);
+
+    for(ty = tymin; ty <= tymax && !ret; ty++)
+        for(tx = txmin; tx <= txmax && !ret; tx++)
+        {
+            caca_canvas_t *tile = get_tile(src, tx, ty);
+            int dx = x + tx * SPARSE_WIDTH, dy = y + ty * SPARSE_HEIGHT;
+
+            if(tile)
+                ret = caca_blit(dst, dx, dy, tile, NULL);
+            else
+            {
+                int w = src->width - tx * SPARSE_WIDTH;
+                int h = src->height - ty * SPARSE_HEIGHT;
+
+                caca_fill_box(dst, dx, dy, w < SPARSE_WIDTH ? w : SPARSE_WIDTH,
+                              h < SPARSE_HEIGHT ? h : SPARSE_HEIGHT, ' ');
+            }
+        }
+
+    dst->curattr = savedattr;
+
+    return ret;
+}
+
+/*
+ * XXX: The following functions are local.
+ */
+
+static caca_canvas_t *get_tile(caca_sparse_canvas_t const *scv, int tx, int ty)
+{
+    return scv->rows[ty] ? scv->rows[ty][tx] : NULL;
+}
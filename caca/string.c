@@ -144,6 +144,9 @@ int caca_put_char(caca_canvas_t *cv, int x, int y, uint32_t ch)
     else if(x < 0)
         return ret;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return ret;
+
     curchar = cv->chars + x + y * cv->width;
     curattr = cv->attrs + x + y * cv->width;
     attr = cv->curattr;
@@ -233,6 +236,238 @@ uint32_t caca_get_char(caca_canvas_t const *cv, int x, int y)
     return cv->chars[x + y * cv->width];
 }
 
+/* Print n characters on a line. If attrs is NULL, the default attribute
+ * is used and each character moves the cursor by its width, like in
+ * caca_put_str(). Otherwise each character has its own attribute and is
+ * printed on its own cell. In both cases each character is handled exactly
+ * like in caca_put_char(), but the line is only clipped once and a single
+ * dirty rectangle covering the modified cells is added at the end. */
+static int put_span(caca_canvas_t *cv, int x, int y, uint32_t const *chars,
+                    uint32_t const *attrs, int n)
+{
+    uint32_t *curchar, *curattr;
+    int i = 0, len = 0, width = cv->width, xmin = width, xmax = -1;
+
+    if(y >= 0 && y < (int)cv->height && !_caca_unshare_frame(cv, cv->frame))
+    {
+        curchar = cv->chars + y * width;
+        curattr = cv->attrs + y * width;
+
+        for( ; i < n && x + len < width; i++)
+        {
+            uint32_t ch = chars[i], attr = attrs ? attrs[i] : cv->curattr;
+            int cx = x + len, fullwidth, lo, hi;
+
+            if(ch == CACA_MAGIC_FULLWIDTH)
+            {
+                len++;
+                continue;
+            }
+
+            fullwidth = ch >= 0x2e80 && caca_utf32_is_fullwidth(ch);
+            len += fullwidth && !attrs ? 2 : 1;
+
+            if(cx == -1 && fullwidth)
+            {
+                cx = 0;
+                ch = ' ';
+                fullwidth = 0;
+            }
+            else if(cx < 0)
+                continue;
+
+            lo = hi = cx;
+
+            /* Same fullwidth character fixes as in caca_put_char() */
+            if(cx && curchar[cx] == CACA_MAGIC_FULLWIDTH)
+            {
+                curchar[cx - 1] = ' ';
+                lo--;
+            }
+
+            if(fullwidth)
+            {
+                if(cx + 1 == width)
+                    ch = ' ';
+                else
+                {
+                    hi++;
+
+                    if(cx + 2 < width
+                        && curchar[cx + 2] == CACA_MAGIC_FULLWIDTH)
+                    {
+                        curchar[cx + 2] = ' ';
+                        hi++;
+                    }
+
+                    curchar[cx + 1] = CACA_MAGIC_FULLWIDTH;
+                    curattr[cx + 1] = attr;
+                }
+            }
+            else if(cx + 1 != width && curchar[cx + 1] == CACA_MAGIC_FULLWIDTH)
+            {
+                curchar[cx + 1] = ' ';
+                hi++;
+            }
+
+            if(curchar[cx] != ch || curattr[cx] != attr)
+            {
+                if(lo < xmin)
+                    xmin = lo;
+                if(hi > xmax)
+                    xmax = hi;
+            }
+
+            curchar[cx] = ch;
+            curattr[cx] = attr;
+        }
+
+        if(!cv->dirty_disabled && xmin <= xmax)
+            caca_add_dirty_rect(cv, xmin, y, xmax - xmin + 1, 1);
+    }
+
+    /* Cropped characters are accounted for, too */
+    if(attrs)
+        return n;
+
+    for( ; i < n; i++)
+        len += chars[i] >= 0x2e80 && caca_utf32_is_fullwidth(chars[i]) ? 2 : 1;
+
+    return len;
+}
+
+/* Fill cells x1 to x2 of a line with the same character and the default
+ * attribute. The result is the same as calling caca_put_char() on each cell
+ * from left to right, but the run is only clipped once, written directly
+ * into the cell arrays, and a single dirty rectangle is added. This is
+ * the core of the filled primitives. */
+void _caca_fill_span(caca_canvas_t *cv, int x1, int x2, int y, uint32_t ch)
+{
+    uint32_t *chars, *attrs, attr = cv->curattr;
+    int x, lo, hi, xmin, xmax, width = cv->width;
+
+    if(y < 0 || y >= cv->height || ch == CACA_MAGIC_FULLWIDTH)
+        return;
+
+    /* Fullwidth characters overlap their neighbours when printed on
+     * every cell, so leave them to caca_put_char(). */
+    if(ch >= 0x2e80 && caca_utf32_is_fullwidth(ch))
+    {
+        for(x = x1 < 0 ? 0 : x1; x <= x2 && x < width; x++)
+            caca_put_char(cv, x, y, ch);
+
+        return;
+    }
+
+    if(x1 < 0)
+        x1 = 0;
+    if(x2 >= width)
+        x2 = width - 1;
+
+    if(x1 > x2)
+        return;
+
+    chars = cv->chars + y * width;
+    attrs = cv->attrs + y * width;
+
+    /* Only the cells between the first and the last changed ones need to
+     * be written */
+    for(lo = x1; lo <= x2 && chars[lo] == ch && attrs[lo] == attr; lo++)
+        ;
+
+    if(lo > x2)
+        return;
+
+    for(hi = x2; chars[hi] == ch && attrs[hi] == attr; hi--)
+        ;
+
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return;
+
+    chars = cv->chars + y * width;
+    attrs = cv->attrs + y * width;
+
+    xmin = lo;
+    xmax = hi;
+
+    /* Same fullwidth character fixes as in caca_put_char(). The halves of
+     * a fullwidth character always differ from ch, so they can only be
+     * split at the ends of the changed cells. */
+    if(lo && chars[lo] == CACA_MAGIC_FULLWIDTH)
+        chars[--xmin] = ' ';
+
+    if(hi + 1 < width && chars[hi + 1] == CACA_MAGIC_FULLWIDTH)
+        chars[++xmax] = ' ';
+
+    for(x = lo; x <= hi; x++)
+    {
+        chars[x] = ch;
+        attrs[x] = attr;
+    }
+
+    if(!cv->dirty_disabled)
+        caca_add_dirty_rect(cv, xmin, y, xmax - xmin + 1, 1);
+}
+
+/** \brief Print an array of characters.
+ *
+ *  Print \e n ASCII or Unicode characters on a line, starting at the given
+ *  coordinates and using the default foreground and background colour
+ *  values. The result is the same as calling caca_put_char() for each
+ *  character and moving right by the returned width, but this function is
+ *  much faster for long runs of characters because the canvas boundaries
+ *  are only checked once and a single dirty rectangle is added.
+ *
+ *  The coordinates may be outside the canvas boundaries and the line will
+ *  be cropped accordingly.
+ *
+ *  This function returns the number of cells covered by the characters,
+ *  including the cropped ones. Fullwidth characters account for two cells.
+ *
+ *  This function never fails.
+ *
+ *  \param cv A handle to the libcaca canvas.
+ *  \param x X coordinate.
+ *  \param y Y coordinate.
+ *  \param chars The characters to print.
+ *  \param n The number of characters.
+ *  \return The number of cells covered.
+ */
+int caca_put_chars(caca_canvas_t *cv, int x, int y,
+                   uint32_t const *chars, int n)
+{
+    return put_span(cv, x, y, chars, NULL, n);
+}
+
+/** \brief Print an array of cells.
+ *
+ *  Print \e n cells on a line, starting at the given coordinates. Unlike
+ *  caca_put_chars(), each character is printed on its own cell, with its
+ *  own attribute, so that a row of another canvas or the output of a
+ *  renderer can be copied as is. The right half of a fullwidth character
+ *  is expected to be CACA_MAGIC_FULLWIDTH and is skipped.
+ *
+ *  The attributes are stored unchanged and the default attribute is not
+ *  modified. The result is otherwise the same as calling caca_set_attr()
+ *  and caca_put_char() on each cell, see caca_put_chars() for more
+ *  information.
+ *
+ *  This function never fails.
+ *
+ *  \param cv A handle to the libcaca canvas.
+ *  \param x X coordinate.
+ *  \param y Y coordinate.
+ *  \param chars The characters to print.
+ *  \param attrs The attributes of the characters.
+ *  \param n The number of cells.
+ *  \return The number of cells, \e n.
+ */
+int caca_put_cells(caca_canvas_t *cv, int x, int y,
+                   uint32_t const *chars, uint32_t const *attrs, int n)
+{
+    return put_span(cv, x, y, chars, attrs, n);
+}
+
 /** \brief Print a string.
  *
  *  Print an UTF-8 string at the given coordinates, using the default
@@ -257,8 +492,9 @@ uint32_t caca_get_char(caca_canvas_t const *cv, int x, int y)
  */
 int caca_put_str(caca_canvas_t *cv, int x, int y, char const *s)
 {
+    uint32_t buf[256];
     size_t rd;
-    int len = 0;
+    int len = 0, n = 0;
 
     if (y < 0 || y >= (int)cv->height || x >= (int)cv->width)
     {
@@ -270,15 +506,17 @@ int caca_put_str(caca_canvas_t *cv, int x, int y, char const *s)
         return len;
     }
 
+    /* Decode the string in chunks and print them with caca_put_chars() */
     while (*s)
     {
-        uint32_t ch = caca_utf8_to_utf32(s, &rd);
-
-        if (x + len >= -1 && x + len < (int)cv->width)
-            caca_put_char(cv, x + len, y, ch);
-
-        len += caca_utf32_is_fullwidth(ch) ? 2 : 1;
+        buf[n++] = caca_utf8_to_utf32(s, &rd);
         s += rd ? rd : 1;
+
+        if (n == sizeof(buf) / sizeof(*buf) || !*s)
+        {
+            len += caca_put_chars(cv, x + len, y, buf, n);
+            n = 0;
+        }
     }
 
     return len;
@@ -370,16 +608,20 @@ int caca_vprintf(caca_canvas_t *cv, int x, int y, char const *format,
  *
  *  Clear the canvas using the current foreground and background colours.
  *
- *  This function never fails.
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the current frame its own cells.
  *
  *  \param cv The canvas to clear.
- *  \return This function always returns 0.
+ *  \return 0 in case of success, -1 if an error occurred.
  */
 int caca_clear_canvas(caca_canvas_t *cv)
 {
     uint32_t attr = cv->curattr;
     int n;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return -1;
+
     for(n = cv->width * cv->height; n--; )
     {
         cv->chars[n] = (uint32_t)' ';
@@ -448,6 +690,8 @@ int caca_get_canvas_handle_y(caca_canvas_t const *cv)
  *  If an error occurs, -1 is returned and \b errno is set accordingly:
  *  - \c EINVAL A mask was specified but the mask size and source canvas
  *    size do not match.
+ *  - \c ENOMEM Not enough memory to give the destination frame its own
+ *    cells.
  *
  *  \param dst The destination canvas.
  *  \param x X coordinate.
@@ -480,6 +724,9 @@ int caca_blit(caca_canvas_t *dst, int x, int y,
         || starti >= endi || startj >= endj)
         return 0;
 
+    if(_caca_unshare_frame(dst, dst->frame) < 0)
+        return -1;
+
     bleed_left = bleed_right = 0;
 
     for(j = startj; j < endj; j++)
@@ -543,6 +790,116 @@ int caca_blit(caca_canvas_t *dst, int x, int y,
     return 0;
 }
 
+/** \brief Scroll an area of a canvas.
+ *
+ *  Scroll the contents of a canvas area vertically. A positive \e dy
+ *  scrolls the contents up, like a terminal does when text is appended at
+ *  the bottom, and a negative \e dy scrolls them down. The lines that
+ *  scroll into view are cleared with the current colour. Fullwidth
+ *  characters that get split at the left or right edge of the area are
+ *  replaced with spaces.
+ *
+ *  This is much cheaper than redrawing the area: instead of marking the
+ *  whole area as dirty, the scroll is recorded, and caca_refresh_display()
+ *  lets display drivers that support it scroll the screen, then redraw
+ *  only the new lines and the cells that changed since.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the current frame its own cells.
+ *
+ *  \param cv A libcaca canvas.
+ *  \param x The leftmost edge of the area.
+ *  \param y The topmost edge of the area.
+ *  \param width The width of the area.
+ *  \param height The height of the area.
+ *  \param dy The number of lines to scroll the contents up by.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_scroll_canvas(caca_canvas_t *cv, int x, int y, int width, int height,
+                       int dy)
+{
+    uint32_t *chars, *attrs;
+    int i, j, n, top;
+
+    /* Clip arguments to canvas */
+    if(x < 0) { width += x; x = 0; }
+
+    if(x + width > cv->width)
+        width = cv->width - x;
+
+    if(y < 0) { height += y; y = 0; }
+
+    if(y + height > cv->height)
+        height = cv->height - y;
+
+    if(width <= 0 || height <= 0 || !dy)
+        return 0;
+
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return -1;
+
+    n = dy > 0 ? dy : -dy;
+    if(n > height)
+        n = height;
+
+    /* Move the lines that stay in the area */
+    if(width == cv->width)
+    {
+        int from = (dy > 0 ? y + n : y) * cv->width;
+        int to = (dy > 0 ? y : y + n) * cv->width;
+        size_t len = (height - n) * cv->width * sizeof(uint32_t);
+
+        memmove(cv->chars + to, cv->chars + from, len);
+        memmove(cv->attrs + to, cv->attrs + from, len);
+    }
+    else for(j = 0; j < height - n; j++)
+    {
+        int to = (dy > 0 ? y + j : y + height - 1 - j) * cv->width + x;
+        int from = to + (dy > 0 ? n : -n) * cv->width;
+
+        memcpy(cv->chars + to, cv->chars + from, width * sizeof(uint32_t));
+        memcpy(cv->attrs + to, cv->attrs + from, width * sizeof(uint32_t));
+    }
+
+    /* Clear the lines that scroll into view */
+    top = dy > 0 ? y + height - n : y;
+    for(j = top; j < top + n; j++)
+    {
+        chars = cv->chars + j * cv->width + x;
+        attrs = cv->attrs + j * cv->width + x;
+
+        for(i = 0; i < width; i++)
+        {
+            chars[i] = (uint32_t)' ';
+            attrs[i] = cv->curattr;
+        }
+    }
+
+    if(!cv->dirty_disabled)
+        _caca_scroll_dirty(cv, x, y, width, height, dy);
+
+    if(width == cv->width)
+        return 0;
+
+    /* Fix fullwidth chars split at the area's edges */
+    for(j = y; j < y + height; j++)
+        for(i = x; i <= x + width; i += width)
+        {
+            chars = cv->chars + j * cv->width;
+
+            if(i == 0 || i == cv->width
+                || caca_utf32_is_fullwidth(chars[i - 1])
+                    == (chars[i] == CACA_MAGIC_FULLWIDTH))
+                continue;
+
+            chars[chars[i] == CACA_MAGIC_FULLWIDTH ? i : i - 1] = ' ';
+            if(!cv->dirty_disabled)
+                caca_add_dirty_rect(cv, i - 1, j, 2, 1);
+        }
+
+    return 0;
+}
+
 /** \brief Set a canvas' new boundaries.
  *
  *  Set new boundaries for a canvas. This function can be used to crop a
@@ -579,7 +936,8 @@ int caca_set_canvas_boundaries(caca_canvas_t *cv, int x, int y, int w, int h)
         return -1;
     }
 
-    new = caca_create_canvas(w, h);
+    new = cv->arena ? caca_create_canvas_with_arena(w, h)
+                    : caca_create_canvas(w, h);
 
     framecount = caca_get_frame_count(cv);
     saved_f = cv->frame;
@@ -592,16 +950,25 @@ int caca_set_canvas_boundaries(caca_canvas_t *cv, int x, int y, int w, int h)
         caca_set_frame(cv, f);
         caca_set_frame(new, f);
         caca_blit(new, -x, -y, cv, NULL);
-        free(cv->frames[f].chars);
-        free(cv->frames[f].attrs);
+        _caca_release_frame(cv, f);
+        free(cv->frames[f].name);
     }
     free(cv->frames);
+    _caca_free_arena(cv);
 
     cv->frames = new->frames;
+    cv->arena = new->arena;
+    free(new->dirty_spans);
+    free(new->dirty_tiles);
+    free(new->dirty_rects);
     free(new);
 
+    /* Load the new size before switching frames, so that the dirty
+     * spans are resized first */
+    if(_caca_load_frame_info(cv) < 0)
+        return -1;
+
     caca_set_frame(cv, saved_f);
-    _caca_load_frame_info(cv);
 
     /* FIXME: this may be optimised somewhat */
     if(!cv->dirty_disabled)
@@ -13,11 +13,15 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "caca.h"
 
 #define BLIT_LOOPS 1000000
 #define PUTCHAR_LOOPS 50000000
+#define DITHER_PIXELS 100000000
+#define CANVAS_LOOPS 200000
+#define SHAPE_LOOPS 100000
 
 #define TIME(desc, code) \
 { \
@@ -67,14 +71,125 @@ static void putchars(int optim)
     caca_free_canvas(cv);
 }
 
+static void putspans(int span)
+{
+    caca_canvas_t *cv;
+    uint32_t chars[40];
+    int i, x, y;
+    cv = caca_create_canvas(40, 40);
+    for (i = 0; i < PUTCHAR_LOOPS / 1600; i++)
+        for (y = 0; y < 40; y++)
+        {
+            for (x = 0; x < 40; x++)
+                chars[x] = 'a' + (i + x + y) % 26;
+            if (span)
+                caca_put_chars(cv, 0, y, chars, 40);
+            else
+                for (x = 0; x < 40; x++)
+                    caca_put_char(cv, x, y, chars[x]);
+        }
+    caca_free_canvas(cv);
+}
+
+static void canvases(int arena)
+{
+    caca_canvas_t *cv;
+    int i;
+    for (i = 0; i < CANVAS_LOOPS; i++)
+    {
+        cv = arena ? caca_create_canvas_with_arena(80, 25)
+                   : caca_create_canvas(80, 25);
+        caca_create_frame(cv, 1);
+        caca_set_frame(cv, 1);
+        caca_put_char(cv, 0, 0, 'x');
+        caca_set_canvas_size(cv, 60, 20);
+        caca_set_canvas_size(cv, 80, 25);
+        caca_free_canvas(cv);
+    }
+}
+
+static void draw_shapes(caca_canvas_t *cv, uint32_t ch)
+{
+    caca_fill_box(cv, 0, 0, 20, 20, ch);
+    caca_fill_triangle(cv, 22, 0, 50, 0, 36, 19, ch);
+    caca_fill_ellipse(cv, 65, 9, 14, 9, ch);
+    caca_draw_line(cv, 0, 22, 79, 39, ch);
+}
+
+static void shapes(int span)
+{
+    caca_canvas_t *cv, *ref;
+    int *cells, i, j, n = 0;
+
+    /* Without spans, the primitives print each of their cells one by one */
+    ref = caca_create_canvas(80, 40);
+    draw_shapes(ref, 'x');
+    cells = malloc(80 * 40 * sizeof(int));
+    for (i = 0; i < 80 * 40; i++)
+        if (caca_get_char(ref, i % 80, i / 80) == 'x')
+            cells[n++] = i;
+
+    cv = caca_create_canvas(80, 40);
+    for (i = 0; i < SHAPE_LOOPS; i++)
+    {
+        if (span)
+            draw_shapes(cv, 'a' + i % 26);
+        else
+            for (j = 0; j < n; j++)
+                caca_put_char(cv, cells[j] % 80, cells[j] / 80, 'a' + i % 26);
+    }
+    caca_free_canvas(cv);
+    caca_free_canvas(ref);
+    free(cells);
+}
+
+static void dither(int scale, char const *antialias)
+{
+    caca_canvas_t *cv;
+    caca_dither_t *dither;
+    uint32_t *pixels;
+    int i, loops, w = 160 * scale, h = 50 * scale;
+
+    pixels = malloc(w * h * sizeof(uint32_t));
+    for (i = 0; i < w * h; i++)
+        pixels[i] = ((i % w) * 255 / w << 16) | ((i / w) * 255 / h << 8)
+                     | ((i % w + i / w) & 0xff);
+
+    cv = caca_create_canvas(160, 50);
+    dither = caca_create_dither(32, w, h, 4 * w,
+                                0xff0000, 0xff00, 0xff, 0x0);
+    caca_set_dither_antialias(dither, antialias);
+    loops = DITHER_PIXELS / (w * h) + 1;
+    for (i = 0; i < loops; i++)
+        caca_dither_bitmap(cv, 0, 0, 160, 50, dither, pixels);
+    caca_free_dither(dither);
+    caca_free_canvas(cv);
+    free(pixels);
+}
+
 int main(int argc, char *argv[])
 {
+    static int const scales[] = { 1, 2, 3, 4, 8, 16, 24 };
+    char desc[32];
+    int i;
+
     TIME("blit no mask, no clear", blit(0, 0));
     TIME("blit no mask, clear", blit(0, 1));
     TIME("blit mask, no clear", blit(1, 0));
     TIME("blit mask, clear", blit(1, 1));
     TIME("putchars, no optim", putchars(0));
     TIME("putchars, optim", putchars(1));
+    TIME("40x40 rows, put_char", putspans(0));
+    TIME("40x40 rows, put_chars", putspans(1));
+    TIME("canvases, heap", canvases(0));
+    TIME("canvases, arena", canvases(1));
+    TIME("shapes, put_char", shapes(0));
+    TIME("shapes, spans", shapes(1));
+    for (i = 0; i < (int)(sizeof(scales) / sizeof(*scales)); i++)
+    {
+        sprintf(desc, "dither %ix%i, prefilter", scales[i], scales[i]);
+        TIME(desc, dither(scales[i], "prefilter"));
+    }
     return 0;
 }
 
@@ -17,6 +17,8 @@
 #include <cppunit/TestCase.h>
 #include <cppunit/TestSuite.h>
 #include <climits>
+#include <cstdlib>
+#include <cstring>
 
 #include "caca.h"
 
@@ -27,6 +29,10 @@ class CanvasTest : public CppUnit::TestCase
     CPPUNIT_TEST(test_resize);
     CPPUNIT_TEST(test_chars);
     CPPUNIT_TEST(test_utf8);
+    CPPUNIT_TEST(test_spans);
+    CPPUNIT_TEST(test_frames);
+    CPPUNIT_TEST(test_arena);
+    CPPUNIT_TEST(test_sparse);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -116,6 +122,208 @@ public:
         /* Send only one byte of a 4-byte sequence */
         caca_put_str(cv, 0, 0, "\xf0");
     }
+
+    void test_spans()
+    {
+        /* Mix of ASCII and fullwidth characters, including a right half */
+        static uint32_t const chars[] =
+        {
+            'a', 0x4e00, 'b', 0x4e01, CACA_MAGIC_FULLWIDTH, 'c', 0x4e02, 'd',
+        };
+        uint32_t attrs[8];
+        int n = sizeof(chars) / sizeof(*chars);
+
+        for(int i = 0; i < n; i++)
+            attrs[i] = ((uint32_t)(i | 0x40) << 18) | ((15 - i) | 0x40) << 4;
+
+        for(int x = -4; x <= 12; x++)
+        {
+            caca_canvas_t *cv1 = caca_create_canvas(10, 2);
+            caca_canvas_t *cv2 = caca_create_canvas(10, 2);
+            int len1 = 0, len2;
+
+            /* Start from canvases containing fullwidth characters that
+             * get partly overwritten */
+            caca_put_str(cv1, 0, 0, "\xe4\xb8\x80\xe4\xb8\x80\xe4\xb8\x80"
+                                    "\xe4\xb8\x80\xe4\xb8\x80");
+            caca_put_str(cv2, 0, 0, "\xe4\xb8\x80\xe4\xb8\x80\xe4\xb8\x80"
+                                    "\xe4\xb8\x80\xe4\xb8\x80");
+            caca_put_str(cv1, 0, 1, "0123456789");
+            caca_put_str(cv2, 0, 1, "0123456789");
+
+            for(int i = 0; i < n; i++)
+                len1 += caca_put_char(cv1, x + len1, 0, chars[i]);
+            len2 = caca_put_chars(cv2, x, 0, chars, n);
+            CPPUNIT_ASSERT_EQUAL(len1, len2);
+
+            for(int i = 0; i < n; i++)
+            {
+                caca_set_attr(cv1, attrs[i]);
+                caca_put_char(cv1, x + i, 1, chars[i]);
+            }
+            CPPUNIT_ASSERT_EQUAL(n, caca_put_cells(cv2, x, 1, chars, attrs, n));
+
+            for(int j = 0; j < 2; j++)
+                for(int i = 0; i < 10; i++)
+                {
+                    CPPUNIT_ASSERT_EQUAL(caca_get_char(cv1, i, j),
+                                         caca_get_char(cv2, i, j));
+                    CPPUNIT_ASSERT_EQUAL(caca_get_attr(cv1, i, j),
+                                         caca_get_attr(cv2, i, j));
+                }
+
+            caca_free_canvas(cv1);
+            caca_free_canvas(cv2);
+        }
+
+        /* Spans outside the canvas still report their width */
+        caca_canvas_t *cv = caca_create_canvas(10, 2);
+        CPPUNIT_ASSERT_EQUAL(11, caca_put_chars(cv, 0, 5, chars, n));
+        CPPUNIT_ASSERT_EQUAL(11, caca_put_chars(cv, 20, 0, chars, n));
+
+        /* A span only adds one dirty rectangle */
+        caca_clear_dirty_rect_list(cv);
+        caca_put_chars(cv, 2, 1, chars, 3);
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dirty_rect_count(cv));
+        int dx, dy, dw, dh;
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(2, dx);
+        CPPUNIT_ASSERT_EQUAL(1, dy);
+        CPPUNIT_ASSERT_EQUAL(4, dw);
+        CPPUNIT_ASSERT_EQUAL(1, dh);
+
+        /* Printing the same cells again does not add any */
+        caca_clear_dirty_rect_list(cv);
+        caca_put_chars(cv, 2, 1, chars, 3);
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_rect_count(cv));
+
+        caca_free_canvas(cv);
+    }
+
+    void test_frames()
+    {
+        caca_canvas_t *cv;
+        uint32_t const *chars;
+
+        cv = caca_create_canvas(20, 10);
+        caca_put_str(cv, 0, 0, "frame 0");
+
+        /* Check that new frames share their cells until written to */
+        caca_create_frame(cv, 1);
+        caca_create_frame(cv, 2);
+        chars = caca_get_canvas_chars(cv);
+        caca_set_frame(cv, 1);
+        CPPUNIT_ASSERT(chars == caca_get_canvas_chars(cv));
+
+        caca_put_char(cv, 6, 0, '1');
+        CPPUNIT_ASSERT(chars != caca_get_canvas_chars(cv));
+        CPPUNIT_ASSERT(caca_get_char(cv, 6, 0) == '1');
+
+        caca_set_frame(cv, 0);
+        CPPUNIT_ASSERT(chars == caca_get_canvas_chars(cv));
+        CPPUNIT_ASSERT(caca_get_char(cv, 6, 0) == '0');
+
+        /* Check that shared frames are resized together */
+        caca_set_canvas_size(cv, 30, 15);
+        chars = caca_get_canvas_chars(cv);
+        caca_set_frame(cv, 2);
+        CPPUNIT_ASSERT(chars == caca_get_canvas_chars(cv));
+        CPPUNIT_ASSERT(caca_get_char(cv, 6, 0) == '0');
+        caca_set_frame(cv, 1);
+        CPPUNIT_ASSERT(caca_get_char(cv, 6, 0) == '1');
+
+        /* Check that the last remaining frame keeps its cells */
+        caca_free_frame(cv, 0);
+        caca_free_frame(cv, 1);
+        caca_set_frame(cv, 0);
+        caca_put_char(cv, 6, 0, '2');
+        CPPUNIT_ASSERT(caca_get_char(cv, 6, 0) == '2');
+
+        caca_free_canvas(cv);
+    }
+
+    void test_arena()
+    {
+        caca_canvas_t *cv[2];
+        void *buf[2];
+        size_t len[2];
+
+        cv[0] = caca_create_canvas(20, 10);
+        cv[1] = caca_create_canvas_with_arena(20, 10);
+        CPPUNIT_ASSERT(cv[1] != NULL);
+
+        /* Check that canvases with an arena behave like the others */
+        for(int i = 0; i < 2; i++)
+        {
+            caca_put_str(cv[i], 2, 2, "frame 0");
+            caca_create_frame(cv[i], 1);
+            caca_set_frame(cv[i], 1);
+            caca_put_str(cv[i], 2, 3, "frame 1");
+            caca_create_frame(cv[i], 2);
+            caca_set_frame(cv[i], 2);
+            caca_rotate_left(cv[i]);
+            caca_free_frame(cv[i], 0);
+            caca_set_canvas_size(cv[i], 50, 40);
+            caca_put_str(cv[i], 40, 30, "resized");
+            caca_set_canvas_size(cv[i], 45, 35);
+            caca_create_frame(cv[i], 0);
+            caca_set_canvas_boundaries(cv[i], -3, 2, 60, 20);
+            caca_flip(cv[i]);
+        }
+
+        for(int i = 0; i < 2; i++)
+            buf[i] = caca_export_canvas_to_memory(cv[i], "caca", &len[i]);
+
+        CPPUNIT_ASSERT_EQUAL(len[0], len[1]);
+        CPPUNIT_ASSERT(!memcmp(buf[0], buf[1], len[0]));
+
+        for(int i = 0; i < 2; i++)
+        {
+            free(buf[i]);
+            caca_free_canvas(cv[i]);
+        }
+    }
+
+    void test_sparse()
+    {
+        caca_sparse_canvas_t *scv;
+        caca_canvas_t *cv, *view;
+
+        scv = caca_create_sparse_canvas(1000000, 1000000);
+        CPPUNIT_ASSERT(scv != NULL);
+        CPPUNIT_ASSERT_EQUAL(caca_get_sparse_canvas_width(scv), 1000000);
+        CPPUNIT_ASSERT_EQUAL(caca_get_sparse_canvas_tile_count(scv), 0);
+
+        /* Check that only the tiles being written to are allocated */
+        cv = caca_create_canvas(10, 2);
+        caca_put_str(cv, 0, 0, "abcdefghij");
+        caca_blit_to_sparse(scv, 500060, 500015, cv, NULL);
+        CPPUNIT_ASSERT_EQUAL(caca_get_sparse_canvas_tile_count(scv), 2);
+        caca_blit_to_sparse(scv, 999995, 999999, cv, NULL);
+        CPPUNIT_ASSERT_EQUAL(caca_get_sparse_canvas_tile_count(scv), 3);
+
+        /* Check that a window reads back the blitted cells and blanks */
+        view = caca_create_canvas(20, 5);
+        caca_fill_box(view, 0, 0, 20, 5, 'x');
+        caca_blit_from_sparse(view, -500055, -500014, scv);
+        CPPUNIT_ASSERT(caca_get_char(view, 4, 1) == ' ');
+        CPPUNIT_ASSERT(caca_get_char(view, 5, 1) == 'a');
+        CPPUNIT_ASSERT(caca_get_char(view, 14, 1) == 'j');
+        CPPUNIT_ASSERT(caca_get_char(view, 15, 1) == ' ');
+        CPPUNIT_ASSERT(caca_get_char(view, 5, 4) == ' ');
+        CPPUNIT_ASSERT(caca_get_attr(view, 0, 0) == caca_get_attr(cv, 0, 1));
+
+        caca_fill_box(view, 0, 0, 20, 5, 'x');
+        caca_blit_from_sparse(view, -999990, -999998, scv);
+        CPPUNIT_ASSERT(caca_get_char(view, 5, 1) == 'a');
+        CPPUNIT_ASSERT(caca_get_char(view, 9, 1) == 'e');
+        CPPUNIT_ASSERT(caca_get_char(view, 10, 1) == 'x');
+        CPPUNIT_ASSERT(caca_get_char(view, 5, 2) == 'x');
+
+        caca_free_canvas(view);
+        caca_free_canvas(cv);
+        caca_free_sparse_canvas(scv);
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(CanvasTest);
@@ -28,6 +28,10 @@ class DirtyTest : public CppUnit::TestCase
     CPPUNIT_TEST(test_simplify);
     CPPUNIT_TEST(test_box);
     CPPUNIT_TEST(test_blit);
+    CPPUNIT_TEST(test_spans);
+    CPPUNIT_TEST(test_diff);
+    CPPUNIT_TEST(test_scroll);
+    CPPUNIT_TEST(test_size_change);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -279,6 +283,289 @@ public:
 
     }
 
+    void test_spans()
+    {
+        caca_canvas_t *cv;
+        int x, y, dx, dy, dw, dh;
+
+        cv = caca_create_canvas(WIDTH, HEIGHT);
+        caca_clear_dirty_rect_list(cv);
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(-1, caca_get_dirty_span(cv, &x, &y, &dw));
+
+        /* Check that scattered strings do not merge into one large
+         * rectangle, but give one span each. Spans are only exact at the
+         * ends of a line's changes, so use tile-aligned strings. */
+        for(int i = 0; i < 4; i++)
+        {
+            caca_put_str(cv, 4 + i * 20, 5, "abcd");
+            caca_put_str(cv, 4 + i * 20, 6, "abcd");
+        }
+
+        CPPUNIT_ASSERT_EQUAL(4, caca_get_dirty_rect_count(cv));
+        for(int i = 0; i < 4; i++)
+        {
+            caca_get_dirty_rect(cv, i, &dx, &dy, &dw, &dh);
+            CPPUNIT_ASSERT_EQUAL(4 + i * 20, dx);
+            CPPUNIT_ASSERT_EQUAL(5, dy);
+            CPPUNIT_ASSERT_EQUAL(4, dw);
+            CPPUNIT_ASSERT_EQUAL(2, dh);
+        }
+
+        /* Check that spans can be iterated in reading order */
+        int n = 0;
+        for(x = y = 0; !caca_get_dirty_span(cv, &x, &y, &dw); x += dw)
+        {
+            CPPUNIT_ASSERT_EQUAL(4 + (n % 4) * 20, x);
+            CPPUNIT_ASSERT_EQUAL(5 + n / 4, y);
+            CPPUNIT_ASSERT_EQUAL(4, dw);
+            n++;
+        }
+        CPPUNIT_ASSERT_EQUAL(8, n);
+
+        /* Check that removing an area clears the spans it covers */
+        caca_remove_dirty_rect(cv, 0, 5, 30, 1);
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(44, x);
+        CPPUNIT_ASSERT_EQUAL(5, y);
+        CPPUNIT_ASSERT_EQUAL(6, caca_get_dirty_rect_count(cv));
+
+        /* Check that spans are clipped when the canvas shrinks */
+        caca_clear_dirty_rect_list(cv);
+        caca_put_char(cv, 70, 5, 'y');
+        caca_put_char(cv, 10, 40, 'y');
+        caca_set_canvas_size(cv, 60, 30);
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(-1, caca_get_dirty_span(cv, &x, &y, &dw));
+
+        caca_set_canvas_size(cv, WIDTH, HEIGHT);
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(60, x);
+        CPPUNIT_ASSERT_EQUAL(0, y);
+        CPPUNIT_ASSERT_EQUAL(WIDTH - 60, dw);
+
+        caca_free_canvas(cv);
+    }
+
+    void test_diff()
+    {
+        caca_canvas_t *cv, *ref;
+        int x, y, dw;
+
+        cv = caca_create_canvas(WIDTH, HEIGHT);
+        ref = caca_create_canvas(WIDTH, HEIGHT);
+
+        /* Check that identical canvases have no differences */
+        caca_put_str(cv, 0, 0, "same");
+        caca_put_str(ref, 0, 0, "same");
+        caca_clear_dirty_rect_list(cv);
+        CPPUNIT_ASSERT_EQUAL(0, caca_diff_canvas(cv, ref));
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_rect_count(cv));
+
+        /* Check that only the changed cells are marked as dirty. Spans
+         * are only exact at the ends of a line's changes. */
+        caca_disable_dirty_rect(cv);
+        caca_put_str(cv, 8, 3, "xy");
+        caca_put_char(cv, 44, 3, 'z');
+        caca_put_char(cv, 12, 20, 'w');
+        caca_enable_dirty_rect(cv);
+        CPPUNIT_ASSERT_EQUAL(4, caca_diff_canvas(cv, ref));
+
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(8, x);
+        CPPUNIT_ASSERT_EQUAL(3, y);
+        CPPUNIT_ASSERT_EQUAL(4, dw);
+        x += dw;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(44, x);
+        CPPUNIT_ASSERT_EQUAL(3, y);
+        CPPUNIT_ASSERT_EQUAL(1, dw);
+        x += dw;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(12, x);
+        CPPUNIT_ASSERT_EQUAL(20, y);
+        x += dw;
+        CPPUNIT_ASSERT_EQUAL(-1, caca_get_dirty_span(cv, &x, &y, &dw));
+
+        /* Check that attribute changes are detected */
+        caca_clear_dirty_rect_list(cv);
+        caca_set_attr(cv, CACA_BOLD);
+        caca_put_char(ref, 0, 0, 's');
+        caca_put_char(cv, 0, 0, 's');
+        CPPUNIT_ASSERT_EQUAL(5, caca_diff_canvas(cv, ref));
+
+        /* Check that cells outside a smaller reference are dirty */
+        caca_clear_dirty_rect_list(cv);
+        caca_blit(ref, 0, 0, cv, NULL);
+        caca_set_canvas_size(ref, WIDTH - 10, HEIGHT);
+        CPPUNIT_ASSERT_EQUAL(10 * HEIGHT, caca_diff_canvas(cv, ref));
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dirty_rect_count(cv));
+
+        /* Check that frames can be compared */
+        caca_clear_canvas(cv);
+        caca_create_frame(cv, 1);
+        caca_disable_dirty_rect(cv);
+        caca_set_frame(cv, 1);
+        caca_put_char(cv, 30, 30, 'f');
+        caca_enable_dirty_rect(cv);
+        caca_clear_dirty_rect_list(cv);
+        CPPUNIT_ASSERT_EQUAL(1, caca_diff_frame(cv, 0));
+        CPPUNIT_ASSERT_EQUAL(0, caca_diff_frame(cv, 1));
+        CPPUNIT_ASSERT_EQUAL(-1, caca_diff_frame(cv, 2));
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(30, x);
+        CPPUNIT_ASSERT_EQUAL(30, y);
+        CPPUNIT_ASSERT_EQUAL(1, dw);
+
+        caca_free_canvas(ref);
+        caca_free_canvas(cv);
+
+        /* Check that frames of different sizes only compare the area they
+         * have in common */
+        cv = caca_create_canvas(10, 4);
+        caca_put_char(cv, 0, 1, 'a');
+        caca_create_frame(cv, 1);
+        caca_set_frame(cv, 1);
+        caca_stretch_left(cv);
+        caca_clear_canvas(cv);
+        caca_put_char(cv, 0, 1, 'a');
+        caca_clear_dirty_rect_list(cv);
+        CPPUNIT_ASSERT_EQUAL(24, caca_diff_frame(cv, 0));
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(0, x);
+        CPPUNIT_ASSERT_EQUAL(4, y);
+        CPPUNIT_ASSERT_EQUAL(4, dw);
+
+        caca_set_frame(cv, 0);
+        caca_clear_dirty_rect_list(cv);
+        CPPUNIT_ASSERT_EQUAL(24, caca_diff_frame(cv, 1));
+        x = y = 0;
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_span(cv, &x, &y, &dw));
+        CPPUNIT_ASSERT_EQUAL(4, x);
+        CPPUNIT_ASSERT_EQUAL(0, y);
+        CPPUNIT_ASSERT_EQUAL(6, dw);
+
+        caca_free_canvas(cv);
+    }
+
+    void test_scroll()
+    {
+        caca_canvas_t *cv;
+        int dx, dy, dw, dh;
+
+        cv = caca_create_canvas(WIDTH, HEIGHT);
+        caca_put_str(cv, 0, 0, "line 0");
+        caca_put_str(cv, 0, 1, "line 1");
+        caca_put_str(cv, 0, 2, "line 2");
+        caca_clear_dirty_rect_list(cv);
+
+        /* Check that the contents move up and the new line is blank */
+        caca_scroll_canvas(cv, 0, 0, WIDTH, 3, 1);
+        CPPUNIT_ASSERT(caca_get_char(cv, 5, 0) == '1');
+        CPPUNIT_ASSERT(caca_get_char(cv, 5, 1) == '2');
+        CPPUNIT_ASSERT(caca_get_char(cv, 5, 2) == ' ');
+
+        /* Check that the scrolled area is dirty for anyone who asks */
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dirty_rect_count(cv));
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(0, dx);
+        CPPUNIT_ASSERT_EQUAL(0, dy);
+        CPPUNIT_ASSERT_EQUAL(WIDTH, dw);
+        CPPUNIT_ASSERT_EQUAL(3, dh);
+
+        /* Check that part of a line can be scrolled down */
+        caca_clear_dirty_rect_list(cv);
+        caca_scroll_canvas(cv, 2, 0, 4, 3, -2);
+        CPPUNIT_ASSERT(caca_get_char(cv, 1, 0) == 'i');
+        CPPUNIT_ASSERT(caca_get_char(cv, 5, 0) == ' ');
+        CPPUNIT_ASSERT(caca_get_char(cv, 5, 2) == '1');
+        CPPUNIT_ASSERT(caca_get_char(cv, 0, 2) == ' ');
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(2, dx);
+        CPPUNIT_ASSERT_EQUAL(4, dw);
+        CPPUNIT_ASSERT_EQUAL(3, dh);
+
+        /* Check that fullwidth characters are not split */
+        caca_put_char(cv, 3, 5, 0x2f06 /* ⼆ */);
+        caca_put_char(cv, 5, 5, 0x2f06 /* ⼆ */);
+        caca_scroll_canvas(cv, 4, 5, 2, 2, 1);
+        CPPUNIT_ASSERT(caca_get_char(cv, 3, 5) == ' ');
+        CPPUNIT_ASSERT(caca_get_char(cv, 6, 5) == ' ');
+
+        /* Check that nothing is recorded with dirty rectangles disabled */
+        caca_clear_dirty_rect_list(cv);
+        caca_disable_dirty_rect(cv);
+        caca_scroll_canvas(cv, 0, 0, WIDTH, HEIGHT, 3);
+        caca_enable_dirty_rect(cv);
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_rect_count(cv));
+
+        caca_free_canvas(cv);
+    }
+
+    void test_size_change()
+    {
+        caca_canvas_t *cv;
+        int dx, dy, dw, dh;
+
+        /* Check that rotating makes the new lines trackable */
+        cv = caca_create_canvas(40, 2);
+        caca_put_str(cv, 0, 0, "rotate me");
+        caca_clear_dirty_rect_list(cv);
+        caca_rotate_left(cv);
+        CPPUNIT_ASSERT_EQUAL(4, caca_get_canvas_width(cv));
+        CPPUNIT_ASSERT_EQUAL(20, caca_get_canvas_height(cv));
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(4, dw);
+        CPPUNIT_ASSERT_EQUAL(20, dh);
+
+        caca_clear_dirty_rect_list(cv);
+        caca_put_char(cv, 3, 19, 'x');
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dirty_rect_count(cv));
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(3, dx);
+        CPPUNIT_ASSERT_EQUAL(19, dy);
+
+        /* Check that stretching back makes the new columns trackable */
+        caca_stretch_right(cv);
+        CPPUNIT_ASSERT_EQUAL(20, caca_get_canvas_width(cv));
+        CPPUNIT_ASSERT_EQUAL(4, caca_get_canvas_height(cv));
+        caca_clear_dirty_rect_list(cv);
+        caca_put_char(cv, 19, 3, 'y');
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(19, dx);
+        CPPUNIT_ASSERT_EQUAL(3, dy);
+
+        /* Check that switching to a frame of another size does too */
+        caca_create_frame(cv, 1);
+        caca_set_frame(cv, 1);
+        caca_rotate_right(cv);
+        caca_stretch_left(cv);
+        caca_set_frame(cv, 0);
+        CPPUNIT_ASSERT_EQUAL(20, caca_get_canvas_width(cv));
+        caca_set_frame(cv, 1);
+        CPPUNIT_ASSERT_EQUAL(10, caca_get_canvas_width(cv));
+        CPPUNIT_ASSERT_EQUAL(8, caca_get_canvas_height(cv));
+        caca_clear_dirty_rect_list(cv);
+        caca_put_char(cv, 9, 7, 'z');
+        caca_get_dirty_rect(cv, 0, &dx, &dy, &dw, &dh);
+        CPPUNIT_ASSERT_EQUAL(9, dx);
+        CPPUNIT_ASSERT_EQUAL(7, dy);
+
+        /* Check that freeing the current frame does too */
+        caca_free_frame(cv, 1);
+        CPPUNIT_ASSERT_EQUAL(20, caca_get_canvas_width(cv));
+        caca_clear_dirty_rect_list(cv);
+        caca_put_char(cv, 19, 3, 'w');
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dirty_rect_count(cv));
+
+        caca_free_canvas(cv);
+    }
+
 private:
     static int const WIDTH, HEIGHT;
 };
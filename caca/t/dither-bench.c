@@ -0,0 +1,394 @@
+/*
+ *  dither-bench  libcaca dither benchmark program
+ *  Copyright © 2026 Sam Hocevar <sam@hocevar.net>
+ *              All Rights Reserved
+ *
+ *  This program is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What the Fuck You Want
+ *  to Public License, Version 2, as published by Sam Hocevar. See
+ *  http://www.wtfpl.net/ for more details.
+ */
+
+/*
+ *  This program times caca_dither_bitmap() for every dithering algorithm,
+ *  character set, colour mode and antialiasing method, and for several
+ *  source depths and scale ratios. By default each setting is varied on
+ *  its own around a reference setup; with --all every combination is
+ *  timed. Results can be printed as a table, as CSV or as JSON.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(HAVE_SYS_TIME_H)
+#   include <sys/time.h>
+#endif
+
+#include "caca.h"
+
+#define WIDTH 160
+#define HEIGHT 50
+
+enum format { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON };
+
+struct setup
+{
+    char const *algorithm, *charset, *color, *antialias;
+    int bpp, ratio;
+};
+
+static int const depths[] = { 8, 16, 24, 32 };
+static int const ratios[] = { 1, 2, 4, 8 };
+
+static enum format format = FORMAT_TEXT;
+static double mintime = 0.2;
+static int nresults = 0;
+
+static double get_time(void)
+{
+#if defined(HAVE_GETTIMEOFDAY)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 0.000001;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Create a test picture with gradients and some noise, in the given
+ * depth, and the matching dither. */
+static void *create_picture(int bpp, int w, int h, caca_dither_t **d)
+{
+    uint32_t r[256], g[256], b[256], a[256];
+    uint8_t *pixels;
+    int x, y, i, bytes = bpp / 8;
+
+    pixels = malloc(w * h * bytes);
+    if(!pixels)
+        return NULL;
+
+    for(y = 0; y < h; y++)
+        for(x = 0; x < w; x++)
+    {
+        uint32_t noise = (x * 7919 + y * 104729) * 2654435761u >> 24;
+        uint32_t red = x * 255 / w, green = y * 255 / h;
+        uint32_t blue = (red + green + (noise & 0x3f)) / 2 & 0xff;
+        uint32_t p;
+        uint16_t p16;
+        uint8_t *dst = pixels + (y * w + x) * bytes;
+
+        switch(bpp)
+        {
+        case 8:
+            dst[0] = (red >> 5 << 5) | (green >> 5 << 2) | (blue >> 6);
+            break;
+        case 16:
+            p16 = (red >> 3 << 11) | (green >> 2 << 5) | (blue >> 3);
+            memcpy(dst, &p16, 2);
+            break;
+        case 24:
+            dst[0] = blue; dst[1] = green; dst[2] = red;
+            break;
+        default:
+            p = 0xff000000 | (red << 16) | (green << 8) | blue;
+            memcpy(dst, &p, 4);
+            break;
+        }
+    }
+
+    switch(bpp)
+    {
+    case 8:
+        *d = caca_create_dither(8, w, h, w, 0, 0, 0, 0);
+        for(i = 0; i < 256; i++)
+        {
+            r[i] = (i >> 5) * 0xfff / 7;
+            g[i] = ((i >> 2) & 7) * 0xfff / 7;
+            b[i] = (i & 3) * 0xfff / 3;
+            a[i] = 0xfff;
+        }
+        caca_set_dither_palette(*d, r, g, b, a);
+        break;
+    case 16:
+        *d = caca_create_dither(16, w, h, 2 * w, 0xf800, 0x7e0, 0x1f, 0);
+        break;
+    case 24:
+        *d = caca_create_dither(24, w, h, 3 * w, 0xff0000, 0xff00, 0xff, 0);
+        break;
+    default:
+        *d = caca_create_dither(32, w, h, 4 * w,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+        break;
+    }
+
+    return pixels;
+}
+
+static void report(struct setup const *s, int frames, double elapsed)
+{
+    double cells = (double)frames * WIDTH * HEIGHT / elapsed;
+    double mpixels = (double)frames * WIDTH * s->ratio * HEIGHT * s->ratio
+                      / elapsed / 1000000.0;
+    double ms = elapsed * 1000.0 / frames;
+
+    switch(format)
+    {
+    case FORMAT_TEXT:
+        if(!nresults)
+            printf("%-9s %-13s %-9s %-9s %3s %5s %9s %12s %9s\n",
+                   "algorithm", "charset", "color", "antialias", "bpp",
+                   "ratio", "ms/frame", "cells/s", "Mpixels/s");
+        printf("%-9s %-13s %-9s %-9s %3i %5i %9.3f %12.0f %9.2f\n",
+               s->algorithm, s->charset, s->color, s->antialias, s->bpp,
+               s->ratio, ms, cells, mpixels);
+        break;
+    case FORMAT_CSV:
+        if(!nresults)
+            printf("algorithm,charset,color,antialias,bpp,ratio,"
+                   "ms_per_frame,cells_per_second,mpixels_per_second\n");
+        printf("%s,%s,%s,%s,%i,%i,%.4f,%.0f,%.3f\n",
+               s->algorithm, s->charset, s->color, s->antialias, s->bpp,
+               s->ratio, ms, cells, mpixels);
+        break;
+    case FORMAT_JSON:
+        printf("%s\n  { \"algorithm\": \"%s\", \"charset\": \"%s\", "
+               "\"color\": \"%s\", \"antialias\": \"%s\", \"bpp\": %i, "
+               "\"ratio\": %i, \"ms_per_frame\": %.4f, "
+               "\"cells_per_second\": %.0f, \"mpixels_per_second\": %.3f }",
+               nresults ? "," : "[", s->algorithm, s->charset, s->color,
+               s->antialias, s->bpp, s->ratio, ms, cells, mpixels);
+        break;
+    }
+
+    nresults++;
+    fflush(stdout);
+}
+
+/* Dither the test picture until mintime seconds have elapsed. The first
+ * frame is not timed, so that one-time initialisations are left out.
+ * Nothing is reported for warmup runs, which only let the CPU clock up
+ * before the first real measurement. */
+static int run(struct setup const *s, int warmup)
+{
+    caca_canvas_t *cv;
+    caca_dither_t *d;
+    void *pixels;
+    double start, elapsed;
+    int frames = 0, w = WIDTH * s->ratio, h = HEIGHT * s->ratio;
+
+    pixels = create_picture(s->bpp, w, h, &d);
+    if(!pixels || !d)
+    {
+        fprintf(stderr, "dither-bench: cannot create %ibpp dither\n", s->bpp);
+        free(pixels);
+        return -1;
+    }
+
+    if(caca_set_dither_algorithm(d, s->algorithm)
+        || caca_set_dither_charset(d, s->charset)
+        || caca_set_dither_color(d, s->color)
+        || caca_set_dither_antialias(d, s->antialias))
+    {
+        fprintf(stderr, "dither-bench: invalid setup %s/%s/%s/%s\n",
+                s->algorithm, s->charset, s->color, s->antialias);
+        caca_free_dither(d);
+        free(pixels);
+        return -1;
+    }
+
+    cv = caca_create_canvas(WIDTH, HEIGHT);
+    caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, pixels);
+
+    start = get_time();
+    do
+    {
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, pixels);
+        frames++;
+        elapsed = get_time() - start;
+    }
+    while(elapsed < mintime);
+
+    if(!warmup)
+        report(s, frames, elapsed);
+
+    caca_free_canvas(cv);
+    caca_free_dither(d);
+    free(pixels);
+
+    return 0;
+}
+
+/* Return the internal names of a list of interleaved names and
+ * descriptions, as returned by the caca_get_dither_*_list() functions. */
+static int get_names(char const * const *list, char const **names)
+{
+    int n;
+
+    for(n = 0; list[n * 2]; n++)
+        names[n] = list[n * 2];
+
+    return n;
+}
+
+static void usage(char const *argv0)
+{
+    printf("Usage: %s [-a] [-f format] [-t seconds]\n", argv0);
+    printf("Time caca_dither_bitmap() with various dither settings.\n\n");
+    printf("  -a, --all            time every combination of settings instead of\n"
+           "                       varying one setting at a time\n");
+    printf("  -f, --format <fmt>   output format: text (default), csv or json\n");
+    printf("  -t, --time <secs>    minimum time spent on each setup (default 0.2)\n");
+    printf("  -h, --help           display this help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char const *algorithms[64], *charsets[64], *colors[64], *antialias[64];
+    int nalgorithms, ncharsets, ncolors, nantialias;
+    struct setup ref, s;
+    caca_dither_t *d;
+    int all = 0, fails = 0;
+    unsigned int i, j, k, l, m, n;
+
+    for(;;)
+    {
+        int option_index = 0;
+        static struct caca_option long_options[] =
+        {
+            { "all",    0, NULL, 'a' },
+            { "format", 1, NULL, 'f' },
+            { "time",   1, NULL, 't' },
+            { "help",   0, NULL, 'h' },
+        };
+        int c = caca_getopt(argc, argv, "af:t:h", long_options, &option_index);
+        if(c == -1)
+            break;
+
+        switch(c)
+        {
+        case 'a': /* --all */
+            all = 1;
+            break;
+        case 'f': /* --format */
+            if(!strcasecmp(caca_optarg, "text"))
+                format = FORMAT_TEXT;
+            else if(!strcasecmp(caca_optarg, "csv"))
+                format = FORMAT_CSV;
+            else if(!strcasecmp(caca_optarg, "json"))
+                format = FORMAT_JSON;
+            else
+            {
+                fprintf(stderr, "%s: invalid format '%s'\n",
+                        argv[0], caca_optarg);
+                return 1;
+            }
+            break;
+        case 't': /* --time */
+            mintime = atof(caca_optarg);
+            break;
+        case 'h': /* --help */
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Every setting is listed by the library itself, so that new ones
+     * are benchmarked as soon as they are added. */
+    d = caca_create_dither(32, 1, 1, 4, 0xff0000, 0xff00, 0xff, 0);
+    nalgorithms = get_names(caca_get_dither_algorithm_list(d), algorithms);
+    ncharsets = get_names(caca_get_dither_charset_list(d), charsets);
+    ncolors = get_names(caca_get_dither_color_list(d), colors);
+    nantialias = get_names(caca_get_dither_antialias_list(d), antialias);
+    ref.algorithm = caca_get_dither_algorithm(d);
+    ref.charset = caca_get_dither_charset(d);
+    ref.color = caca_get_dither_color(d);
+    ref.antialias = caca_get_dither_antialias(d);
+    ref.bpp = 32;
+    ref.ratio = 4;
+    caca_free_dither(d);
+
+    run(&ref, 1);
+
+    if(all)
+    {
+        for(i = 0; i < (unsigned int)nalgorithms; i++)
+        for(j = 0; j < (unsigned int)ncharsets; j++)
+        for(k = 0; k < (unsigned int)ncolors; k++)
+        for(l = 0; l < (unsigned int)nantialias; l++)
+        for(m = 0; m < sizeof(depths) / sizeof(*depths); m++)
+        for(n = 0; n < sizeof(ratios) / sizeof(*ratios); n++)
+        {
+            s.algorithm = algorithms[i];
+            s.charset = charsets[j];
+            s.color = colors[k];
+            s.antialias = antialias[l];
+            s.bpp = depths[m];
+            s.ratio = ratios[n];
+            fails += run(&s, 0) < 0;
+        }
+    }
+    else
+    {
+        fails += run(&ref, 0) < 0;
+
+        for(i = 0; i < (unsigned int)nalgorithms; i++)
+            if(strcmp(algorithms[i], ref.algorithm))
+            {
+                s = ref;
+                s.algorithm = algorithms[i];
+                fails += run(&s, 0) < 0;
+            }
+
+        for(i = 0; i < (unsigned int)ncharsets; i++)
+            if(strcmp(charsets[i], ref.charset))
+            {
+                s = ref;
+                s.charset = charsets[i];
+                fails += run(&s, 0) < 0;
+            }
+
+        for(i = 0; i < (unsigned int)ncolors; i++)
+            if(strcmp(colors[i], ref.color))
+            {
+                s = ref;
+                s.color = colors[i];
+                fails += run(&s, 0) < 0;
+            }
+
+        for(i = 0; i < (unsigned int)nantialias; i++)
+            if(strcmp(antialias[i], ref.antialias))
+            {
+                s = ref;
+                s.antialias = antialias[i];
+                fails += run(&s, 0) < 0;
+            }
+
+        for(i = 0; i < sizeof(depths) / sizeof(*depths); i++)
+            if(depths[i] != ref.bpp)
+            {
+                s = ref;
+                s.bpp = depths[i];
+                fails += run(&s, 0) < 0;
+            }
+
+        for(i = 0; i < sizeof(ratios) / sizeof(*ratios); i++)
+            if(ratios[i] != ref.ratio)
+            {
+                s = ref;
+                s.ratio = ratios[i];
+                fails += run(&s, 0) < 0;
+            }
+    }
+
+    if(format == FORMAT_JSON)
+        printf("%s\n", nresults ? "\n]" : "[]");
+
+    return fails ? 1 : 0;
+}
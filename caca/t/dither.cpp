@@ -0,0 +1,661 @@
+/*
+ *  caca-test     testsuite program for libcaca
+ *  Copyright (c) 2026 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This program is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What the Fuck You Want
+ *  to Public License, Version 2, as published by Sam Hocevar. See
+ *  http://www.wtfpl.net/ for more details.
+ */
+
+#include "config.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCaller.h>
+#include <cppunit/TestCase.h>
+#include <cppunit/TestSuite.h>
+#include <cstring>
+
+#include "caca.h"
+#include "caca++.h"
+
+class DitherTest : public CppUnit::TestCase
+{
+    CPPUNIT_TEST_SUITE(DitherTest);
+    CPPUNIT_TEST(test_threads);
+    CPPUNIT_TEST(test_threads_identical);
+    CPPUNIT_TEST(test_yuv);
+    CPPUNIT_TEST(test_incremental);
+    CPPUNIT_TEST(test_stream);
+    CPPUNIT_TEST(test_truecolor);
+    CPPUNIT_TEST(test_subcells);
+    CPPUNIT_TEST(test_structure);
+    CPPUNIT_TEST(test_output_palette);
+    CPPUNIT_TEST(test_distance);
+    CPPUNIT_TEST(test_time_budget);
+    CPPUNIT_TEST(test_static_dither);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    DitherTest() : CppUnit::TestCase("Dither Test") {}
+
+    void setUp()
+    {
+        /* A gradient with a few transparent blocks */
+        for (int y = 0; y < PH; y++)
+            for (int x = 0; x < PW; x++)
+            {
+                uint32_t a = ((x / 16 + y / 16) % 5) ? 0xff : 0;
+                pixels[y * PW + x] = (a << 24) | ((x * 255 / PW) << 16)
+                                      | ((y * 255 / PH) << 8) | ((x ^ y) & 0xff);
+            }
+    }
+
+    void tearDown() {}
+
+    void test_threads()
+    {
+        caca_dither_t *d;
+
+        d = caca_create_dither(32, PW, PH, 4 * PW,
+                               0xff0000, 0xff00, 0xff, 0xff000000);
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_threads(d));
+
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_threads(d, 0));
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_threads(d));
+
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_threads(d, 1));
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_threads(d));
+
+        caca_free_dither(d);
+    }
+
+    void test_threads_identical()
+    {
+        static char const * const algos[] =
+        {
+            "none", "ordered2", "ordered4", "ordered8", "random", "fstein"
+        };
+
+        for (unsigned int i = 0; i < sizeof(algos) / sizeof(*algos); i++)
+        {
+            caca_canvas_t *cv1, *cv2;
+            caca_dither_t *d1, *d2;
+
+            cv1 = caca_create_canvas(WIDTH, HEIGHT);
+            cv2 = caca_create_canvas(WIDTH, HEIGHT);
+
+            d1 = caca_create_dither(32, PW, PH, 4 * PW,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            d2 = caca_create_dither(32, PW, PH, 4 * PW,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            caca_set_dither_algorithm(d1, algos[i]);
+            caca_set_dither_algorithm(d2, algos[i]);
+
+            /* Skip the test if thread support is not available */
+            if (caca_set_dither_threads(d2, 7) == 0)
+            {
+                caca_dither_bitmap(cv1, -2, 1, WIDTH + 3, HEIGHT - 2,
+                                   d1, pixels);
+                caca_dither_bitmap(cv2, -2, 1, WIDTH + 3, HEIGHT - 2,
+                                   d2, pixels);
+
+                CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                                       caca_get_canvas_chars(cv2),
+                                       WIDTH * HEIGHT * sizeof(uint32_t)));
+                CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                                       caca_get_canvas_attrs(cv2),
+                                       WIDTH * HEIGHT * sizeof(uint32_t)));
+            }
+
+            caca_free_dither(d1);
+            caca_free_dither(d2);
+            caca_free_canvas(cv1);
+            caca_free_canvas(cv2);
+        }
+    }
+
+    void test_yuv()
+    {
+        static char const * const formats[] = { "I420", "NV12", "YUY2" };
+        static uint8_t yplane[PH][PW], uplane[PH / 2][PW / 2],
+                       vplane[PH / 2][PW / 2], uvplane[PH / 2][PW],
+                       yuy2[PH][PW * 2];
+        static uint32_t rgb[PH][PW];
+
+        /* Build the same 4:2:0 image in all formats, and its conversion
+         * to RGB with the documented BT.601 coefficients */
+        for (int y = 0; y < PH; y++)
+            for (int x = 0; x < PW; x++)
+            {
+                int Y = (x * 7 + y * 3) & 0xff;
+                int U = (x * 2 + 40) & 0xff, V = (y * 5 + 90) & 0xff;
+
+                yplane[y][x] = Y;
+                uplane[y / 2][x / 2] = uvplane[y / 2][x / 2 * 2] = U;
+                vplane[y / 2][x / 2] = uvplane[y / 2][x / 2 * 2 + 1] = V;
+            }
+
+        for (int y = 0; y < PH; y++)
+            for (int x = 0; x < PW; x++)
+            {
+                int Y = yplane[y][x];
+                int U = uplane[y / 2][x / 2], V = vplane[y / 2][x / 2];
+                int c = 298 * (Y - 16) + 128;
+                int r = (c + 409 * (V - 128)) >> 8;
+                int g = (c - 100 * (U - 128) - 208 * (V - 128)) >> 8;
+                int b = (c + 516 * (U - 128)) >> 8;
+
+                r = r < 0 ? 0 : r > 255 ? 255 : r;
+                g = g < 0 ? 0 : g > 255 ? 255 : g;
+                b = b < 0 ? 0 : b > 255 ? 255 : b;
+                rgb[y][x] = (r << 16) | (g << 8) | b;
+
+                yuy2[y][x * 2] = Y;
+                yuy2[y][x / 2 * 4 + 1] = U;
+                yuy2[y][x / 2 * 4 + 3] = V;
+            }
+
+        int const pitches[3][3] =
+        {
+            { PW, PW / 2, PW / 2 }, { PW, PW, 0 }, { PW * 2, 0, 0 }
+        };
+        void const *planes[3][3] =
+        {
+            { yplane, uplane, vplane }, { yplane, uvplane, NULL },
+            { yuy2, NULL, NULL }
+        };
+
+        caca_canvas_t *cv1 = caca_create_canvas(WIDTH, HEIGHT);
+        caca_canvas_t *cv2 = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d1 = caca_create_dither(32, PW, PH, 4 * PW,
+                                               0xff0000, 0xff00, 0xff, 0);
+        caca_dither_bitmap(cv1, 0, 0, WIDTH, HEIGHT, d1, rgb);
+
+        for (int i = 0; i < 3; i++)
+        {
+            caca_dither_t *d2 = caca_create_yuv_dither(formats[i], PW, PH,
+                                                       pitches[i]);
+            CPPUNIT_ASSERT(d2);
+
+            caca_clear_canvas(cv2);
+            caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, planes[i]);
+
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                                   caca_get_canvas_chars(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                                   caca_get_canvas_attrs(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+
+            caca_free_dither(d2);
+        }
+
+        CPPUNIT_ASSERT(!caca_create_yuv_dither("YV21", PW, PH, pitches[0]));
+
+        caca_free_dither(d1);
+        caca_free_canvas(cv1);
+        caca_free_canvas(cv2);
+    }
+
+    void test_incremental()
+    {
+        static char const * const algos[] = { "ordered4", "fstein" };
+
+        for (int i = 0; i < 2; i++)
+        {
+            caca_canvas_t *cv1 = caca_create_canvas(WIDTH, HEIGHT);
+            caca_canvas_t *cv2 = caca_create_canvas(WIDTH, HEIGHT);
+            caca_dither_t *d1 = caca_create_dither(32, PW, PH, 4 * PW,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            caca_dither_t *d2 = caca_create_dither(32, PW, PH, 4 * PW,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            caca_set_dither_algorithm(d1, algos[i]);
+            caca_set_dither_algorithm(d2, algos[i]);
+
+            CPPUNIT_ASSERT_EQUAL(0, caca_get_dither_incremental(d2));
+            caca_set_dither_incremental(d2, 1);
+            CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_incremental(d2));
+
+            caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+
+            /* Change a few pixels, then dither again */
+            for (int y = 30; y < 40; y++)
+                for (int x = 50; x < 60; x++)
+                    pixels[y * PW + x] ^= 0x00ffffff;
+
+            caca_dither_bitmap(cv1, 0, 0, WIDTH, HEIGHT, d1, pixels);
+            caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                                   caca_get_canvas_chars(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                                   caca_get_canvas_attrs(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+
+            /* Nothing changed, nothing is redrawn */
+            caca_clear_dirty_rect_list(cv2);
+            caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+            CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_rect_count(cv2));
+
+            /* Cells that were modified on the canvas are redrawn */
+            caca_clear_canvas(cv2);
+            caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                                   caca_get_canvas_chars(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+
+            caca_create_frame(cv2, 1);
+            caca_set_frame(cv2, 1);
+            caca_clear_canvas(cv2);
+            caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                                   caca_get_canvas_chars(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                                   caca_get_canvas_attrs(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+
+            caca_free_dither(d1);
+            caca_free_dither(d2);
+            caca_free_canvas(cv1);
+            caca_free_canvas(cv2);
+        }
+    }
+
+    void test_stream()
+    {
+        static char const * const algos[] = { "ordered4", "fstein" };
+        static char const * const modes[] = { "none", "prefilter" };
+        /* Drawing areas: full canvas, upscaled, partly outside */
+        static int const areas[][4] =
+        {
+            { 0, 0, WIDTH, HEIGHT },
+            { 2, 1, 2 * PW, 2 * PH },
+            { -5, 10, WIDTH, HEIGHT / 3 },
+        };
+
+        for (int i = 0; i < 2 * 2 * 3; i++)
+        {
+            int const *a = areas[i / 4];
+            caca_canvas_t *cv1 = caca_create_canvas(WIDTH, HEIGHT);
+            caca_canvas_t *cv2 = caca_create_canvas(WIDTH, HEIGHT);
+            caca_dither_t *d = caca_create_dither(32, PW, PH, 4 * PW,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            caca_set_dither_algorithm(d, algos[i % 2]);
+            caca_set_dither_antialias(d, modes[i / 2 % 2]);
+            if (i % 3 == 2)
+                caca_set_dither_charset(d, "braille");
+
+            caca_dither_bitmap(cv1, a[0], a[1], a[2], a[3], d, pixels);
+
+            caca_dither_stream_t *s = caca_create_dither_stream(cv2,
+                                          a[0], a[1], a[2], a[3], d);
+            CPPUNIT_ASSERT(s != NULL);
+
+            /* Give the lines in uneven chunks */
+            int lines = 0;
+            for (int y = 0, n = 1; y < PH; y += n, n = n % 7 + 1)
+            {
+                if (y + n > PH)
+                    n = PH - y;
+                int ret = caca_push_dither_rows(s, pixels + y * PW, n);
+                CPPUNIT_ASSERT(ret >= 0);
+                lines += ret;
+            }
+            CPPUNIT_ASSERT_EQUAL(-1, caca_push_dither_rows(s, pixels, 1));
+            caca_free_dither_stream(s);
+
+            CPPUNIT_ASSERT(lines > 0);
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                                   caca_get_canvas_chars(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+            CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                                   caca_get_canvas_attrs(cv2),
+                                   WIDTH * HEIGHT * sizeof(uint32_t)));
+
+            caca_free_dither(d);
+            caca_free_canvas(cv1);
+            caca_free_canvas(cv2);
+        }
+    }
+
+    void test_truecolor()
+    {
+        static char const * const algos[] = { "none", "ordered4", "fstein" };
+        static uint32_t opaque[PW * PH];
+
+        for (int n = 0; n < PW * PH; n++)
+            opaque[n] = pixels[n] | 0xff000000;
+
+        for (int i = 0; i < 3; i++)
+        {
+            caca_canvas_t *cv = caca_create_canvas(WIDTH, HEIGHT);
+            caca_dither_t *d = caca_create_dither(32, PW, PH, 4 * PW,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            caca_set_dither_algorithm(d, algos[i]);
+            CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_color(d, "truecolor"));
+            CPPUNIT_ASSERT(!strcmp("truecolor", caca_get_dither_color(d)));
+
+            caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, opaque);
+
+            /* Cells only use ARGB colours, never ANSI ones */
+            uint32_t const *attrs = caca_get_canvas_attrs(cv);
+            for (int n = 0; n < WIDTH * HEIGHT; n++)
+            {
+                CPPUNIT_ASSERT((attrs[n] >> 18) >= 0x100);
+                CPPUNIT_ASSERT(((attrs[n] >> 4) & 0x3fff) >= 0x100);
+            }
+
+            caca_free_dither(d);
+            caca_free_canvas(cv);
+        }
+
+        /* A colour that the canvas can store is rendered exactly */
+        for (int n = 0; n < PW * PH; n++)
+            opaque[n] = 0xff8844cc;
+
+        caca_canvas_t *cv = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d = caca_create_dither(32, PW, PH, 4 * PW,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+        caca_set_dither_color(d, "truecolor");
+        caca_set_dither_algorithm(d, "none");
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, opaque);
+
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++)
+            {
+                uint32_t attr = caca_get_attr(cv, x, y);
+                CPPUNIT_ASSERT_EQUAL((uint32_t)' ', caca_get_char(cv, x, y));
+                CPPUNIT_ASSERT_EQUAL((uint16_t)0x84c,
+                                     caca_attr_to_rgb12_bg(attr));
+            }
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_subcells()
+    {
+        static char const * const charsets[] =
+            { "quadrants", "sextants", "braille" };
+        static int const heights[] = { 2, 3, 4 };
+        /* Glyphs for the left half of a cell */
+        static uint32_t const glyphs[] = { 0x258c, 0x258c, 0x2847 };
+
+        for (int i = 0; i < 3; i++)
+        {
+            int bw = 2 * WIDTH, bh = heights[i] * HEIGHT;
+            uint32_t *bitmap = new uint32_t[bw * bh];
+
+            /* Vertical white and black lines, one sub-cell wide */
+            for (int n = 0; n < bw * bh; n++)
+                bitmap[n] = (n % 2) ? 0xff000000 : 0xffffffff;
+
+            caca_canvas_t *cv = caca_create_canvas(WIDTH, HEIGHT);
+            caca_dither_t *d = caca_create_dither(32, bw, bh, 4 * bw,
+                                    0xff0000, 0xff00, 0xff, 0xff000000);
+            CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_charset(d, charsets[i]));
+            CPPUNIT_ASSERT(!strcmp(charsets[i], caca_get_dither_charset(d)));
+            caca_set_dither_algorithm(d, "none");
+            caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, bitmap);
+
+            for (int y = 0; y < HEIGHT; y++)
+                for (int x = 0; x < WIDTH; x++)
+                {
+                    CPPUNIT_ASSERT_EQUAL(glyphs[i], caca_get_char(cv, x, y));
+                    CPPUNIT_ASSERT_EQUAL((uint8_t)0x0f,
+                                         caca_attr_to_ansi(caca_get_attr(cv, x, y)));
+                }
+
+            caca_free_dither(d);
+            caca_free_canvas(cv);
+            delete[] bitmap;
+        }
+    }
+
+    void test_structure()
+    {
+        int bw = 4 * WIDTH, bh = 4 * HEIGHT;
+        uint32_t *bitmap = new uint32_t[bw * bh];
+
+        /* The left half of each cell is white, the right half is black */
+        for (int n = 0; n < bw * bh; n++)
+            bitmap[n] = (n % 4 < 2) ? 0xffffffff : 0xff000000;
+
+        caca_canvas_t *cv = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d = caca_create_dither(32, bw, bh, 4 * bw,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_charset(d, "structure"));
+        CPPUNIT_ASSERT(!strcmp("structure", caca_get_dither_charset(d)));
+        caca_set_dither_algorithm(d, "none");
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, bitmap);
+
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++)
+            {
+                CPPUNIT_ASSERT_EQUAL((uint32_t)0x258c, caca_get_char(cv, x, y));
+                CPPUNIT_ASSERT_EQUAL((uint8_t)0x0f,
+                                     caca_attr_to_ansi(caca_get_attr(cv, x, y)));
+            }
+
+        /* Flat areas only use spaces */
+        for (int n = 0; n < bw * bh; n++)
+            bitmap[n] = 0xff808080;
+
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, bitmap);
+
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++)
+                CPPUNIT_ASSERT_EQUAL((uint32_t)' ', caca_get_char(cv, x, y));
+
+        /* The bold font has shapes of its own */
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_charset(d, "boldstructure"));
+        CPPUNIT_ASSERT(!strcmp("boldstructure", caca_get_dither_charset(d)));
+        for (int n = 0; n < bw * bh; n++)
+            bitmap[n] = (n % 4 < 2) ? 0xffffffff : 0xff000000;
+
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, bitmap);
+        CPPUNIT_ASSERT_EQUAL((uint32_t)0x258c, caca_get_char(cv, 0, 0));
+        CPPUNIT_ASSERT_EQUAL((uint32_t)0x258c,
+                             caca_get_char(cv, WIDTH - 1, HEIGHT - 1));
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+        delete[] bitmap;
+    }
+
+    void test_output_palette()
+    {
+        static uint32_t const colors[] =
+            { 0x000000, 0xff0000, 0x00ff00, 0x0000ff, 0x808080 };
+        static int const weights[] = { 1, 1, 1, 1, 1000 };
+        static uint32_t flat[PW * PH];
+
+        caca_canvas_t *cv = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d = caca_create_dither(32, PW, PH, 4 * PW,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+        caca_set_dither_algorithm(d, "none");
+
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_output_palette(d, 1,
+                                                                colors, NULL));
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_output_palette(d, 257,
+                                                                colors, NULL));
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_output_palette(d, 4,
+                                                               colors, NULL));
+
+        /* Palette colours are output as ARGB values */
+        for (int n = 0; n < PW * PH; n++)
+            flat[n] = 0xffff0000;
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++)
+                CPPUNIT_ASSERT_EQUAL((uint16_t)0xf00,
+                    caca_attr_to_rgb12_bg(caca_get_attr(cv, x, y)));
+
+        /* A heavy weight keeps the gray colour away */
+        for (int n = 0; n < PW * PH; n++)
+            flat[n] = 0xff707070;
+        caca_set_dither_output_palette(d, 5, colors, NULL);
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        CPPUNIT_ASSERT_EQUAL((uint16_t)0x888,
+            caca_attr_to_rgb12_bg(caca_get_attr(cv, 0, 0)));
+        caca_set_dither_output_palette(d, 5, colors, weights);
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        CPPUNIT_ASSERT(caca_attr_to_rgb12_bg(caca_get_attr(cv, 0, 0)) != 0x888);
+
+        /* Back to the ANSI colours */
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_output_palette(d, 0,
+                                                               NULL, NULL));
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        CPPUNIT_ASSERT((caca_get_attr(cv, 0, 0) >> 18) < 0x50);
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_distance()
+    {
+        static uint32_t const colors[] = { 0x000000, 0x808080, 0xffffff };
+        static uint32_t flat[PW * PH];
+
+        caca_canvas_t *cv = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d = caca_create_dither(32, PW, PH, 4 * PW,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+        caca_set_dither_algorithm(d, "none");
+
+        CPPUNIT_ASSERT(!strcmp("rgb", caca_get_dither_distance(d)));
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_distance(d, "hsv"));
+        CPPUNIT_ASSERT(!strcmp("oklab", caca_get_dither_distance_list(d)[2]));
+
+        /* A dark gray is closer to black in RGB space, but looks closer
+         * to the mid gray */
+        caca_set_dither_output_palette(d, 3, colors, NULL);
+        for (int n = 0; n < PW * PH; n++)
+            flat[n] = 0xff333333;
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        CPPUNIT_ASSERT_EQUAL((uint16_t)0x000,
+            caca_attr_to_rgb12_bg(caca_get_attr(cv, 0, 0)));
+
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_distance(d, "oklab"));
+        CPPUNIT_ASSERT(!strcmp("oklab", caca_get_dither_distance(d)));
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        CPPUNIT_ASSERT_EQUAL((uint16_t)0x888,
+            caca_attr_to_rgb12_bg(caca_get_attr(cv, 0, 0)));
+
+        /* White still maps to itself */
+        for (int n = 0; n < PW * PH; n++)
+            flat[n] = 0xffffffff;
+        caca_dither_bitmap(cv, 0, 0, WIDTH, HEIGHT, d, flat);
+        CPPUNIT_ASSERT_EQUAL((uint16_t)0xffe,
+            caca_attr_to_rgb12_bg(caca_get_attr(cv, 0, 0)));
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_time_budget()
+    {
+        caca_canvas_t *cv1 = caca_create_canvas(WIDTH, HEIGHT);
+        caca_canvas_t *cv2 = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d1 = caca_create_dither(32, PW, PH, 4 * PW,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+        caca_dither_t *d2 = caca_create_dither(32, PW, PH, 4 * PW,
+                                0xff0000, 0xff00, 0xff, 0xff000000);
+
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dither_time_budget(d1));
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_time_budget(d1, -1));
+
+        /* An impossible budget lowers the quality to the minimum */
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_time_budget(d1, 1));
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_time_budget(d1));
+        for (int i = 0; i < 5; i++)
+            caca_dither_bitmap(cv1, 0, 0, WIDTH, HEIGHT, d1, pixels);
+        CPPUNIT_ASSERT_EQUAL(3, caca_get_dither_quality(d1));
+        CPPUNIT_ASSERT(!strcmp("fstein", caca_get_dither_algorithm(d1)));
+
+        caca_set_dither_algorithm(d2, "none");
+        caca_set_dither_antialias(d2, "none");
+        caca_dither_bitmap(cv1, 0, 0, WIDTH, HEIGHT, d1, pixels);
+        caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+        CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                               caca_get_canvas_chars(cv2),
+                               WIDTH * HEIGHT * sizeof(uint32_t)));
+        CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                               caca_get_canvas_attrs(cv2),
+                               WIDTH * HEIGHT * sizeof(uint32_t)));
+
+        /* A generous budget brings it back to full quality */
+        caca_set_dither_algorithm(d2, "fstein");
+        caca_set_dither_antialias(d2, "prefilter");
+        caca_set_dither_time_budget(d1, 1000000000);
+        for (int i = 0; i < 100; i++)
+            caca_dither_bitmap(cv1, 0, 0, WIDTH, HEIGHT, d1, pixels);
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dither_quality(d1));
+        caca_dither_bitmap(cv1, 0, 0, WIDTH, HEIGHT, d1, pixels);
+        caca_dither_bitmap(cv2, 0, 0, WIDTH, HEIGHT, d2, pixels);
+        CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                               caca_get_canvas_chars(cv2),
+                               WIDTH * HEIGHT * sizeof(uint32_t)));
+        CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                               caca_get_canvas_attrs(cv2),
+                               WIDTH * HEIGHT * sizeof(uint32_t)));
+
+        caca_free_dither(d1);
+        caca_free_dither(d2);
+        caca_free_canvas(cv1);
+        caca_free_canvas(cv2);
+    }
+
+    template <typename Pixel, typename Algorithm, typename Color>
+    void check_static_dither(int bpp, uint32_t r, uint32_t g, uint32_t b,
+                             uint32_t a, char const *algo, char const *color)
+    {
+        caca_canvas_t *cv1 = caca_create_canvas(WIDTH, HEIGHT);
+        caca_canvas_t *cv2 = caca_create_canvas(WIDTH, HEIGHT);
+        caca_dither_t *d = caca_create_dither(bpp, PW, PH, bpp / 8 * PW,
+                                              r, g, b, a);
+        StaticDither<Pixel, Algorithm, Color> sd(PW, PH, bpp / 8 * PW);
+
+        caca_set_dither_algorithm(d, algo);
+        caca_set_dither_color(d, color);
+
+        caca_dither_bitmap(cv1, -2, 1, WIDTH + 3, HEIGHT - 2, d, pixels);
+        sd.Bitmap(cv2, -2, 1, WIDTH + 3, HEIGHT - 2, pixels);
+
+        CPPUNIT_ASSERT(!memcmp(caca_get_canvas_chars(cv1),
+                               caca_get_canvas_chars(cv2),
+                               WIDTH * HEIGHT * sizeof(uint32_t)));
+        CPPUNIT_ASSERT(!memcmp(caca_get_canvas_attrs(cv1),
+                               caca_get_canvas_attrs(cv2),
+                               WIDTH * HEIGHT * sizeof(uint32_t)));
+
+        caca_free_dither(d);
+        caca_free_canvas(cv1);
+        caca_free_canvas(cv2);
+    }
+
+    void test_static_dither()
+    {
+        check_static_dither<PixelRGB32, DitherNone, ColorFull16>
+            (32, 0xff0000, 0xff00, 0xff, 0, "none", "full16");
+        check_static_dither<PixelARGB32, DitherOrdered8, ColorFull16>
+            (32, 0xff0000, 0xff00, 0xff, 0xff000000, "ordered8", "full16");
+        check_static_dither<PixelARGB32, DitherFstein, ColorFull16>
+            (32, 0xff0000, 0xff00, 0xff, 0xff000000, "fstein", "full16");
+        check_static_dither<PixelRGB24, DitherFstein, ColorFullGray>
+            (24, 0xff0000, 0xff00, 0xff, 0, "fstein", "fullgray");
+        check_static_dither<PixelRGB16, DitherOrdered8, ColorFull16>
+            (16, 0xf800, 0x7e0, 0x1f, 0, "ordered8", "full16");
+    }
+
+private:
+    enum { WIDTH = 80, HEIGHT = 50, PW = 160, PH = 120 };
+    uint32_t pixels[PW * PH];
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DitherTest);
+
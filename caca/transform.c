@@ -36,16 +36,22 @@ static void rightpair(uint32_t pair[2]);
  *  Invert a canvas' colours (black becomes white, red becomes cyan, etc.)
  *  without changing the characters in it.
  *
- *  This function never fails.
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the current frame its own cells.
  *
  *  \param cv The canvas to invert.
- *  \return This function always returns 0.
+ *  \return 0 in case of success, -1 if an error occurred.
  */
 int caca_invert(caca_canvas_t *cv)
 {
-    uint32_t *attrs = cv->attrs;
+    uint32_t *attrs;
     int i;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return -1;
+
+    attrs = cv->attrs;
+
     for(i = cv->height * cv->width; i--; )
     {
         *attrs = *attrs ^ 0x000f000f;
@@ -65,15 +71,19 @@ int caca_invert(caca_canvas_t *cv)
  *  unchanged by the process, but the operation is guaranteed to be
  *  involutive: performing it again gives back the original canvas.
  *
- *  This function never fails.
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the current frame its own cells.
  *
  *  \param cv The canvas to flip.
- *  \return This function always returns 0.
+ *  \return 0 in case of success, -1 if an error occurred.
  */
 int caca_flip(caca_canvas_t *cv)
 {
     int y;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return -1;
+
     for(y = 0; y < cv->height; y++)
     {
         uint32_t *cleft = cv->chars + y * cv->width;
@@ -127,15 +137,19 @@ int caca_flip(caca_canvas_t *cv)
  *  unchanged by the process, but the operation is guaranteed to be
  *  involutive: performing it again gives back the original canvas.
  *
- *  This function never fails.
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the current frame its own cells.
  *
  *  \param cv The canvas to flop.
- *  \return This function always returns 0.
+ *  \return 0 in case of success, -1 if an error occurred.
  */
 int caca_flop(caca_canvas_t *cv)
 {
     int x;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return -1;
+
     for(x = 0; x < cv->width; x++)
     {
         uint32_t *ctop = cv->chars + x;
@@ -176,19 +190,25 @@ int caca_flop(caca_canvas_t *cv)
  *  guaranteed to be involutive: performing it again gives back the
  *  original canvas.
  *
- *  This function never fails.
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c ENOMEM Not enough memory to give the current frame its own cells.
  *
  *  \param cv The canvas to rotate.
- *  \return This function always returns 0.
+ *  \return 0 in case of success, -1 if an error occurred.
  */
 int caca_rotate_180(caca_canvas_t *cv)
 {
-    uint32_t *cbegin = cv->chars;
-    uint32_t *cend = cbegin + cv->width * cv->height - 1;
-    uint32_t *abegin = cv->attrs;
-    uint32_t *aend = abegin + cv->width * cv->height - 1;
+    uint32_t *cbegin, *cend, *abegin, *aend;
     int y;
 
+    if(_caca_unshare_frame(cv, cv->frame) < 0)
+        return -1;
+
+    cbegin = cv->chars;
+    cend = cbegin + cv->width * cv->height - 1;
+    abegin = cv->attrs;
+    aend = abegin + cv->width * cv->height - 1;
+
     if(!cbegin)
       return 0;
 
@@ -269,17 +289,17 @@ int caca_rotate_left(caca_canvas_t *cv)
     w2 = (cv->width + 1) / 2;
     h2 = cv->height;
 
-    newchars = _caca_alloc2d(w2, h2, 2 * sizeof(uint32_t));
+    newchars = _caca_alloc_cells(cv, w2 * 2, h2);
     if(!newchars)
     {
         seterrno(ENOMEM);
         return -1;
     }
 
-    newattrs = _caca_alloc2d(w2, h2, 2 * sizeof(uint32_t));
+    newattrs = _caca_alloc_cells(cv, w2 * 2, h2);
     if(!newattrs)
     {
-        free(newchars);
+        _caca_free_cells(cv, newchars);
         seterrno(ENOMEM);
         return -1;
     }
@@ -322,8 +342,7 @@ int caca_rotate_left(caca_canvas_t *cv)
         }
     }
 
-    free(cv->chars);
-    free(cv->attrs);
+    _caca_release_frame(cv, cv->frame);
 
     /* Swap X and Y information */
     x = cv->frames[cv->frame].x;
@@ -341,9 +360,11 @@ int caca_rotate_left(caca_canvas_t *cv)
 
     cv->frames[cv->frame].chars = newchars;
     cv->frames[cv->frame].attrs = newattrs;
+    cv->frames[cv->frame].shared = NULL;
 
     /* Reset the current frame shortcuts */
-    _caca_load_frame_info(cv);
+    if(_caca_load_frame_info(cv) < 0)
+        return -1;
 
     if(!cv->dirty_disabled)
         caca_add_dirty_rect(cv, 0, 0, cv->width, cv->height);
@@ -389,17 +410,17 @@ int caca_rotate_right(caca_canvas_t *cv)
     w2 = (cv->width + 1) / 2;
     h2 = cv->height;
 
-    newchars = _caca_alloc2d(w2 * 2, h2, sizeof(uint32_t));
+    newchars = _caca_alloc_cells(cv, w2 * 2, h2);
     if(!newchars)
     {
         seterrno(ENOMEM);
         return -1;
     }
 
-    newattrs = _caca_alloc2d(w2 * 2, h2, sizeof(uint32_t));
+    newattrs = _caca_alloc_cells(cv, w2 * 2, h2);
     if(!newattrs)
     {
-        free(newchars);
+        _caca_free_cells(cv, newchars);
         seterrno(ENOMEM);
         return -1;
     }
@@ -442,8 +463,7 @@ int caca_rotate_right(caca_canvas_t *cv)
         }
     }
 
-    free(cv->chars);
-    free(cv->attrs);
+    _caca_release_frame(cv, cv->frame);
 
     /* Swap X and Y information */
     x = cv->frames[cv->frame].x;
@@ -461,9 +481,11 @@ int caca_rotate_right(caca_canvas_t *cv)
 
     cv->frames[cv->frame].chars = newchars;
     cv->frames[cv->frame].attrs = newattrs;
+    cv->frames[cv->frame].shared = NULL;
 
     /* Reset the current frame shortcuts */
-    _caca_load_frame_info(cv);
+    if(_caca_load_frame_info(cv) < 0)
+        return -1;
 
     if(!cv->dirty_disabled)
         caca_add_dirty_rect(cv, 0, 0, cv->width, cv->height);
@@ -504,17 +526,17 @@ int caca_stretch_left(caca_canvas_t *cv)
     /* Save the current frame shortcuts */
     _caca_save_frame_info(cv);
 
-    newchars = _caca_alloc2d(cv->width, cv->height, sizeof(uint32_t));
+    newchars = _caca_alloc_cells(cv, cv->width, cv->height);
     if(!newchars)
     {
         seterrno(ENOMEM);
         return -1;
     }
 
-    newattrs = _caca_alloc2d(cv->width, cv->height, sizeof(uint32_t));
+    newattrs = _caca_alloc_cells(cv, cv->width, cv->height);
     if(!newattrs)
     {
-        free(newchars);
+        _caca_free_cells(cv, newchars);
         seterrno(ENOMEM);
         return -1;
     }
@@ -536,8 +558,7 @@ int caca_stretch_left(caca_canvas_t *cv)
         }
     }
 
-    free(cv->chars);
-    free(cv->attrs);
+    _caca_release_frame(cv, cv->frame);
 
     /* Swap X and Y information */
     x = cv->frames[cv->frame].x;
@@ -555,9 +576,11 @@ int caca_stretch_left(caca_canvas_t *cv)
 
     cv->frames[cv->frame].chars = newchars;
     cv->frames[cv->frame].attrs = newattrs;
+    cv->frames[cv->frame].shared = NULL;
 
     /* Reset the current frame shortcuts */
-    _caca_load_frame_info(cv);
+    if(_caca_load_frame_info(cv) < 0)
+        return -1;
 
     caca_add_dirty_rect(cv, 0, 0, cv->width, cv->height);
 
@@ -597,17 +620,17 @@ int caca_stretch_right(caca_canvas_t *cv)
     /* Save the current frame shortcuts */
     _caca_save_frame_info(cv);
 
-    newchars = _caca_alloc2d(cv->width, cv->height, sizeof(uint32_t));
+    newchars = _caca_alloc_cells(cv, cv->width, cv->height);
     if(!newchars)
     {
         seterrno(ENOMEM);
         return -1;
     }
 
-    newattrs = _caca_alloc2d(cv->width, cv->height, sizeof(uint32_t));
+    newattrs = _caca_alloc_cells(cv, cv->width, cv->height);
     if(!newattrs)
     {
-        free(newchars);
+        _caca_free_cells(cv, newchars);
         seterrno(ENOMEM);
         return -1;
     }
@@ -629,8 +652,7 @@ int caca_stretch_right(caca_canvas_t *cv)
         }
     }
 
-    free(cv->chars);
-    free(cv->attrs);
+    _caca_release_frame(cv, cv->frame);
 
     /* Swap X and Y information */
     x = cv->frames[cv->frame].x;
@@ -648,9 +670,11 @@ int caca_stretch_right(caca_canvas_t *cv)
 
     cv->frames[cv->frame].chars = newchars;
     cv->frames[cv->frame].attrs = newattrs;
+    cv->frames[cv->frame].shared = NULL;
 
     /* Reset the current frame shortcuts */
-    _caca_load_frame_info(cv);
+    if(_caca_load_frame_info(cv) < 0)
+        return -1;
 
     caca_add_dirty_rect(cv, 0, 0, cv->width, cv->height);
 
@@ -87,7 +87,7 @@ int caca_draw_thin_triangle(caca_canvas_t * cv, int x1, int y1,
 int caca_fill_triangle(caca_canvas_t * cv, int x1, int y1, int x2, int y2,
                        int x3, int y3, uint32_t ch)
 {
-    int x, y, xmin, xmax, ymin, ymax;
+    int y, ymin, ymax;
     int xx1, xx2, xa, xb, sl21, sl31, sl32;
 
     /* Bubble-sort y1 <= y2 <= y3 */
@@ -140,11 +140,7 @@ int caca_fill_triangle(caca_canvas_t * cv, int x1, int y1, int x2, int y2,
             xx2 = (xa + 0x801) / 0x10000;
         }
 
-        xmin = xx1 < 0 ? 0 : xx1;
-        xmax = xx2 + 1 < cv->width ? xx2 + 1 : cv->width;
-
-        for (x = xmin; x < xmax; x++)
-            caca_put_char(cv, x, y, ch);
+        _caca_fill_span(cv, xx1, xx2, y, ch);
 
         xa += y < y2 ? sl21 : sl32;
         xb += sl31;
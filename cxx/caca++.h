@@ -90,6 +90,7 @@ __class Canvas
 {
     friend class Caca;
     friend class Dither;
+    template <typename, typename, typename> friend class StaticDither;
     friend class Font;
  public:
     Canvas();
@@ -201,4 +202,372 @@ __class Caca
     caca_display_t *dp;
 };
 
+/*
+ * Compile-time specialised dithering
+ *
+ * StaticDither<Pixel, Algorithm, Color> draws the same result as a Dither
+ * created for the given pixel format, with the given algorithm and colour
+ * mode, "prefilter" antialiasing and the "ascii" charset. Since these are
+ * known at compile time, the pixel fetching, dithering and colour lookup
+ * code is inlined into a single loop for each combination. Gamma,
+ * brightness and contrast correction are not available.
+ */
+
+/* Pixel formats, named after the caca_create_dither() arguments they
+ * match. Each one adds the 12-bit channels of pixel x of a line to rgba. */
+struct PixelRGB32 /* 32, 0xff0000, 0xff00, 0xff, 0 */
+{
+    enum { alpha = 0 };
+    static inline void add(void const *line, int x, uint32_t *rgba)
+    {
+        uint32_t bits = ((uint32_t const *)line)[x];
+        rgba[0] += (bits >> 12) & 0xff0;
+        rgba[1] += (bits >> 4) & 0xff0;
+        rgba[2] += (bits << 4) & 0xff0;
+    }
+};
+
+struct PixelARGB32 /* 32, 0xff0000, 0xff00, 0xff, 0xff000000 */
+{
+    enum { alpha = 1 };
+    static inline void add(void const *line, int x, uint32_t *rgba)
+    {
+        uint32_t bits = ((uint32_t const *)line)[x];
+        rgba[0] += (bits >> 12) & 0xff0;
+        rgba[1] += (bits >> 4) & 0xff0;
+        rgba[2] += (bits << 4) & 0xff0;
+        rgba[3] += (bits >> 20) & 0xff0;
+    }
+};
+
+struct PixelRGB24 /* 24, 0xff0000, 0xff00, 0xff, 0 */
+{
+    enum { alpha = 0 };
+    static inline void add(void const *line, int x, uint32_t *rgba)
+    {
+        uint8_t const *p = (uint8_t const *)line + 3 * x;
+        /* This is compile-time optimised with at least -O1 or -Os */
+        uint32_t const tmp = 0x12345678;
+        int big = *(uint8_t const *)&tmp == 0x12;
+        rgba[0] += (uint32_t)p[big ? 0 : 2] << 4;
+        rgba[1] += (uint32_t)p[1] << 4;
+        rgba[2] += (uint32_t)p[big ? 2 : 0] << 4;
+    }
+};
+
+struct PixelRGB16 /* 16, 0xf800, 0x7e0, 0x1f, 0 */
+{
+    enum { alpha = 0 };
+    static inline void add(void const *line, int x, uint32_t *rgba)
+    {
+        uint32_t bits = ((uint16_t const *)line)[x];
+        rgba[0] += (bits >> 4) & 0xf80;
+        rgba[1] += (bits << 1) & 0xfc0;
+        rgba[2] += (bits << 7) & 0xf80;
+    }
+};
+
+/* Dithering algorithms, matching the caca_set_dither_algorithm() values */
+struct DitherNone /* "none" */
+{
+    enum { diffuse = 0 };
+    inline void init(int) {}
+    inline int get() const { return 0x80; }
+    inline void increment() {}
+};
+
+struct DitherOrdered8 /* "ordered8" */
+{
+    enum { diffuse = 0 };
+    inline void init(int line)
+    {
+        static int const dither8x8[] =
+        {
+            0x00, 0x80, 0x20, 0xa0, 0x08, 0x88, 0x28, 0xa8,
+            0xc0, 0x40, 0xe0, 0x60, 0xc8, 0x48, 0xe8, 0x68,
+            0x30, 0xb0, 0x10, 0x90, 0x38, 0xb8, 0x18, 0x98,
+            0xf0, 0x70, 0xd0, 0x50, 0xf8, 0x78, 0xd8, 0x58,
+            0x0c, 0x8c, 0x2c, 0xac, 0x04, 0x84, 0x24, 0xa4,
+            0xcc, 0x4c, 0xec, 0x6c, 0xc4, 0x44, 0xe4, 0x64,
+            0x3c, 0xbc, 0x1c, 0x9c, 0x34, 0xb4, 0x14, 0x94,
+            0xfc, 0x7c, 0xdc, 0x5c, 0xf4, 0x74, 0xd4, 0x54,
+        };
+
+        table = dither8x8 + (line % 8) * 8;
+        index = 0;
+    }
+    inline int get() const { return table[index]; }
+    inline void increment() { index = (index + 1) % 8; }
+
+ private:
+    int const *table;
+    int index;
+};
+
+struct DitherFstein /* "fstein" */
+{
+    enum { diffuse = 1 };
+    inline void init(int) {}
+    inline int get() const { return 0x80; }
+    inline void increment() {}
+};
+
+/* Colour modes, matching the caca_set_dither_color() values */
+struct ColorFull16 /* "full16" */
+{
+    enum { gray = 0 };
+};
+
+struct ColorFullGray /* "fullgray" */
+{
+    enum { gray = 1 };
+};
+
+template <typename Pixel, typename Algorithm, typename Color>
+class StaticDither
+{
+ public:
+    StaticDither(unsigned int w, unsigned int h, unsigned int pitch);
+    ~StaticDither();
+
+    int Bitmap(Canvas *, int, int, int, int, void const *);
+    int Bitmap(caca_canvas_t *, int, int, int, int, void const *);
+
+ private:
+    StaticDither(StaticDither const &);
+    StaticDither &operator=(StaticDither const &);
+
+    static inline void range(int i, int count, int size, int *from, int *to)
+    {
+        *from = (int)((uint64_t)i * size / count);
+        *to = (int)((uint64_t)(i + 1) * size / count);
+        if(*to == *from)
+            (*to)++;
+    }
+
+    static inline int sq(int x) { return x * x; }
+
+    /* The 16 ANSI colours, in 12-bit RGB */
+    static inline int const *ansi()
+    {
+        static int const palette[] =
+        {
+            0x0,   0x0,   0x0,   0x0,   0x0,   0x7ff, 0x0,   0x7ff, 0x0,
+            0x0,   0x7ff, 0x7ff, 0x7ff, 0x0,   0x0,   0x7ff, 0x0,   0x7ff,
+            0x7ff, 0x7ff, 0x0,   0xaaa, 0xaaa, 0xaaa, 0x555, 0x555, 0x555,
+            0x000, 0x000, 0xfff, 0x000, 0xfff, 0x000, 0x000, 0xfff, 0xfff,
+            0xfff, 0x000, 0x000, 0xfff, 0x000, 0xfff, 0xfff, 0xfff, 0x000,
+            0xfff, 0xfff, 0xfff,
+        };
+
+        return palette;
+    }
+
+    unsigned int width, height, pitch;
+    int *errors;
+    unsigned int errors_size;
+    uint16_t lookup[4096];
+};
+
+template <typename Pixel, typename Algorithm, typename Color>
+StaticDither<Pixel, Algorithm, Color>::StaticDither(unsigned int w,
+                                            unsigned int h, unsigned int p)
+  : width(w), height(h), pitch(p), errors(NULL), errors_size(0)
+{
+
+    /* Nearest background and foreground colours of each 12-bit colour,
+     * computed the same way as by the C library */
+    for(int n = 0; n < 4096; n++)
+    {
+        int rgb[3] = { 0xfff * (n >> 8) / 15, 0xfff * ((n >> 4) & 15) / 15,
+                       0xfff * (n & 15) / 15 };
+        int best[2] = { 0, 0 };
+
+        for(int pass = 0; pass < 2; pass++)
+        {
+            int distmin = 0x7fffffff;
+
+            for(int i = 0; i < 16; i++)
+            {
+                int const *c = ansi() + 3 * i;
+
+                if((pass && i == best[0])
+                    || (Color::gray && (c[0] != c[1] || c[0] != c[2])))
+                    continue;
+
+                int dist = sq(rgb[0] - c[0]) + sq(rgb[1] - c[1])
+                            + sq(rgb[2] - c[2]);
+                if(dist < distmin)
+                {
+                    best[pass] = i;
+                    distmin = dist;
+                }
+            }
+        }
+
+        lookup[n] = (uint16_t)((best[1] << 8) | best[0]);
+    }
+}
+
+template <typename Pixel, typename Algorithm, typename Color>
+StaticDither<Pixel, Algorithm, Color>::~StaticDither()
+{
+    delete[] errors;
+}
+
+template <typename Pixel, typename Algorithm, typename Color>
+int StaticDither<Pixel, Algorithm, Color>::Bitmap(Canvas *cv, int x, int y,
+                                          int w, int h, void const *pixels)
+{
+    return Bitmap(cv->get_caca_canvas_t(), x, y, w, h, pixels);
+}
+
+template <typename Pixel, typename Algorithm, typename Color>
+int StaticDither<Pixel, Algorithm, Color>::Bitmap(caca_canvas_t *cv,
+                                          int x, int y, int w, int h,
+                                          void const *pixels)
+{
+    static uint32_t const glyphs[] =
+    {
+        ' ', '.', ':', ';', 't', '%', 'S', 'X', '@', '8'
+    };
+    /* Glyph ch covers ch / steps of the cell */
+    int const steps = 21;
+
+    if(!pixels)
+        return 0;
+
+    /* Like caca_dither_bitmap(), dither one more column and line than the
+     * canvas, whose error still diffuses to the visible cells */
+    int cvw = caca_get_canvas_width(cv), cvh = caca_get_canvas_height(cv);
+    int xmin = x > 0 ? x : 0, xmax = x + w - 1 < cvw ? x + w - 1 : cvw;
+    int ymin = y > 0 ? y : 0, ymax = y + h - 1 < cvh ? y + h - 1 : cvh;
+
+    if(xmax < xmin || ymax < ymin)
+        return 0;
+
+    unsigned int length = xmax + 3;
+    if(Algorithm::diffuse && errors_size < 3 * length)
+    {
+        delete[] errors;
+        errors = new int[3 * length];
+        errors_size = 3 * length;
+    }
+
+    int *fs[3] = { NULL, NULL, NULL };
+    if(Algorithm::diffuse)
+    {
+        for(unsigned int i = 0; i < 3 * length; i++)
+            errors[i] = 0;
+        for(int i = 0; i < 3; i++)
+            fs[i] = errors + i * length + 1;
+    }
+
+    /* Cells are buffered and printed in runs with caca_put_cells() */
+    uint32_t chars[64], attrs[64];
+    uint32_t attr = caca_get_attr(cv, -1, -1) & 0x0000000f;
+    Algorithm state;
+
+    for(int cy = ymin; cy <= ymax; cy++)
+    {
+        int fromy, toy, remain[3] = { 0, 0, 0 }, run = 0;
+
+        range(cy - y, h, height, &fromy, &toy);
+        state.init(cy);
+
+        for(int cx = xmin; cx <= xmax; cx++)
+        {
+            uint32_t rgba[4] = { 0, 0, 0, 0 };
+            int fromx, tox, rgb[3], error[3];
+
+            range(cx - x, w, width, &fromx, &tox);
+
+            for(int py = fromy; py < toy; py++)
+            {
+                void const *line = (uint8_t const *)pixels + pitch * py;
+                for(int px = fromx; px < tox; px++)
+                    Pixel::add(line, px, rgba);
+            }
+
+            uint32_t dots = (tox - fromx) * (toy - fromy);
+            for(int i = 0; i < 3; i++)
+                rgb[i] = (int)(rgba[i] / dots);
+
+            if(Color::gray)
+                rgb[0] = rgb[1] = rgb[2]
+                       = (3 * rgb[0] + 4 * rgb[1] + rgb[2] + 4) / 8;
+
+            if(Pixel::alpha && rgba[3] / dots < 0x800)
+            {
+                if(run)
+                    caca_put_cells(cv, cx - run, cy, chars, attrs, run);
+                run = 0;
+                if(Algorithm::diffuse)
+                    for(int i = 0; i < 3; i++)
+                        remain[i] = fs[i][cx] = 0;
+                continue;
+            }
+
+            for(int i = 0; i < 3; i++)
+                rgb[i] += Algorithm::diffuse ? remain[i]
+                                             : (state.get() - 0x80) * 4;
+
+            int n = 0;
+            for(int i = 0; i < 3; i++)
+            {
+                int val = rgb[i] < 0 ? 0 : rgb[i] > 0xfff ? 0xfff : rgb[i];
+                n = (n << 4) | ((val * 15 + 0x800) >> 12);
+            }
+
+            int bg = lookup[n] & 0xff, fg = lookup[n] >> 8;
+            int const *b = ansi() + 3 * bg, *f = ansi() + 3 * fg;
+
+            /* Project the colour on the background-foreground segment
+             * to find the glyph whose coverage matches it best */
+            int64_t dot = (int64_t)(rgb[0] - b[0]) * (f[0] - b[0])
+                        + (int64_t)(rgb[1] - b[1]) * (f[1] - b[1])
+                        + (int64_t)(rgb[2] - b[2]) * (f[2] - b[2]);
+            int64_t norm = sq(f[0] - b[0]) + sq(f[1] - b[1])
+                            + sq(f[2] - b[2]);
+            int g = 0;
+
+            if(dot > 0 && norm)
+            {
+                g = (int)((dot * steps + norm / 2) / norm);
+                if(g > 9)
+                    g = 9;
+            }
+
+            if(Algorithm::diffuse)
+            {
+                for(int i = 0; i < 3; i++)
+                {
+                    error[i] = rgb[i] - (f[i] * g + b[i] * (steps - g))
+                                          / steps;
+                    remain[i] = fs[i][cx + 1] + 7 * error[i] / 16;
+                    fs[i][cx - 1] += 3 * error[i] / 16;
+                    fs[i][cx] = 5 * error[i] / 16;
+                    fs[i][cx + 1] = 1 * error[i] / 16;
+                }
+            }
+
+            chars[run] = glyphs[g];
+            attrs[run] = ((uint32_t)(bg | 0x40) << 18)
+                          | ((uint32_t)(fg | 0x40) << 4) | attr;
+            if(++run == 64)
+            {
+                caca_put_cells(cv, cx + 1 - run, cy, chars, attrs, run);
+                run = 0;
+            }
+
+            state.increment();
+        }
+
+        if(run)
+            caca_put_cells(cv, xmax + 1 - run, cy, chars, attrs, run);
+    }
+
+    return 0;
+}
+
 #endif /* _CACA_PP_H */
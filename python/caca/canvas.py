@@ -375,6 +375,33 @@ class Canvas(_Canvas):
             else:
                 return ret
 
+    def scroll(self, x, y, width, height, dy):
+        """ Scroll an area of a canvas.
+
+            x       -- the leftmost edge of the area
+            y       -- the topmost edge of the area
+            width   -- the width of the area
+            height  -- the height of the area
+            dy      -- the number of lines to scroll the contents up by
+        """
+        _lib.caca_scroll_canvas.argtypes = [
+              _Canvas, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+              ctypes.c_int
+            ]
+        _lib.caca_scroll_canvas.restype  = ctypes.c_int
+
+        try:
+            ret = _lib.caca_scroll_canvas(self, x, y, width, height, dy)
+        except ctypes.ArgumentError:
+            raise CanvasError("Specified coordinate, size or line count is"
+                              " invalid")
+        else:
+            if ret == -1:
+                raise CanvasError("Not enough memory to give the current"
+                                  " frame its own cells")
+            else:
+                return ret
+
     def set_boundaries(self, x, y, width, height):
         """ Set a canvas' new boundaries.
 
@@ -472,6 +499,29 @@ class Canvas(_Canvas):
                 }
                 return dct
 
+    def get_dirty_span(self, x, y):
+        """ Get the first dirty span of a canvas starting at or after the
+            given cell. Return python dictionnary with coords as keys: x, y,
+            width, or None if there are no dirty spans left.
+
+            x   -- the column where the search starts
+            y   -- the line where the search starts
+        """
+        x = ctypes.c_int(x)
+        y = ctypes.c_int(y)
+        width = ctypes.c_int()
+
+        _lib.caca_get_dirty_span.argtypes = [
+                _Canvas, ctypes.POINTER(ctypes.c_int),
+                ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int)
+            ]
+        _lib.caca_get_dirty_span.restype  = ctypes.c_int
+
+        if _lib.caca_get_dirty_span(self, x, y, width) == -1:
+            return None
+        else:
+            return {'x': x.value, 'y': y.value, 'width': width.value}
+
     def add_dirty_rect(self, x, y, width, height):
         """ Add an area to the canvas's dirty rectangle list.
 
@@ -534,6 +584,41 @@ class Canvas(_Canvas):
 
         return _lib.caca_clear_dirty_rect_list(self)
 
+    def diff_canvas(self, ref):
+        """ Mark the cells that differ from another canvas as dirty. Return
+            the number of cells that differ.
+
+            ref -- the reference canvas
+        """
+        _lib.caca_diff_canvas.argtypes = [_Canvas, _Canvas]
+        _lib.caca_diff_canvas.restype  = ctypes.c_int
+
+        if not isinstance(ref, Canvas):
+            raise CanvasError("Specified reference canvas is invalid")
+
+        return _lib.caca_diff_canvas(self, ref)
+
+    def diff_frame(self, id):
+        """ Mark the cells that differ from another frame as dirty. Return
+            the number of cells that differ.
+
+            id  -- the frame to compare the current frame with
+        """
+        _lib.caca_diff_frame.argtypes = [_Canvas, ctypes.c_int]
+        _lib.caca_diff_frame.restype  = ctypes.c_int
+
+        try:
+            ret = _lib.caca_diff_frame(self, id)
+        except ctypes.ArgumentError:
+            raise CanvasError("Specified frame index is invalid")
+        else:
+            if ret == -1:
+                err = ctypes.c_int.in_dll(_lib, "errno")
+                if err.value == errno.EINVAL:
+                    raise CanvasError("Requested frame is out of range")
+            else:
+                return ret
+
     def invert(self):
         """ Invert a canvas' colours.
         """
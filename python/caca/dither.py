@@ -208,6 +208,8 @@ class Dither(_Dither):
                        the background
                      + "full16" or "default": use the 16 ANSI colours for both the
                        characters and the background (default)
+                     + "truecolor": use ARGB colours for both the characters
+                       and the background
         """
         _lib.caca_set_dither_color.argtypes = [_Dither, ctypes.c_char_p]
         _lib.caca_set_dither_color.restype  = ctypes.c_int
@@ -239,6 +241,25 @@ class Dither(_Dither):
 
         return lst
 
+    def set_distance(self, value):
+        """ Choose the colour distance used for dithering.
+
+            value   -- + "rgb" or "default": use the RGB distance (default)
+                       + "oklab": use the perceptual OKLab distance
+        """
+        _lib.caca_set_dither_distance.argtypes = [_Dither, ctypes.c_char_p]
+        _lib.caca_set_dither_distance.restype  = ctypes.c_int
+
+        return _lib.caca_set_dither_distance(self, value)
+
+    def get_distance(self):
+        """ Get current colour distance.
+        """
+        _lib.caca_get_dither_distance.argtypes = [_Dither]
+        _lib.caca_get_dither_distance.restype  = ctypes.c_char_p
+
+        return _lib.caca_get_dither_distance(self)
+
     def set_charset(self, value):
         """ Choose characters used for dithering.
 
@@ -251,6 +272,13 @@ class Dither(_Dither):
                        also present in the CP437 codepage available on DOS and VGA.
                      + "blocks": use Unicode quarter-cell block combinations.
                        These characters are only found in the Unicode set.
+                     + "quadrants", "sextants" or "braille": split each cell
+                       in 2x2, 2x3 or 2x4 sub-cells drawn with the matching
+                       Unicode characters.
+                     + "structure": use the ASCII character or Unicode block
+                       element whose shape best matches the cell.
+                     + "boldstructure": same as "structure", with the shapes
+                       of a bold font.
         """
         _lib.caca_set_dither_charset.argtypes = [_Dither, ctypes.c_char_p]
         _lib.caca_set_dither_charset.restype  = ctypes.c_int
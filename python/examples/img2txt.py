@@ -77,6 +77,11 @@ CHARSET list:
   - ascii: use only ascii character
   - shades: use unicode character
   - blocks: use unicode quarter-cell combinations
+  - quadrants: use unicode 2x2 sub-cell blocks
+  - sextants: use unicode 2x3 sub-cell blocks
+  - braille: use unicode 2x4 braille patterns
+  - structure: use the characters whose shape best matches the image
+  - boldstructure: same as structure, with bold character shapes
 """ % (os.path.basename(sys.argv[0]), os.path.basename(sys.argv[0]))
 
 VERSION_MSG="""\